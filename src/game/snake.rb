@@ -70,6 +70,9 @@ while @running
       end
     end
 
+    # Player timing makes the DIV register a good entropy source
+    srand if turned
+
     frame_count += 1
   end
 
@@ -126,8 +129,9 @@ while @running
 
     # Spawn new food if eaten
     if ate_food
-      @food_x = rand(GRID_W)
-      @food_y = rand(GRID_H)
+      pos = rand_pos(GRID_W, GRID_H)
+      @food_x = pos & 0xFF
+      @food_y = pos >> 8
       # Simple collision avoidance
       tries = 0
       while tries < 10
@@ -138,8 +142,9 @@ while @running
           i += 1
         end
         if collision
-          @food_x = rand(GRID_W)
-          @food_y = rand(GRID_H)
+          pos = rand_pos(GRID_W, GRID_H)
+          @food_x = pos & 0xFF
+          @food_y = pos >> 8
         end
         tries += 1
       end
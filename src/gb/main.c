@@ -4,7 +4,6 @@
  */
 
 #include <gb/gb.h>
-#include <stdio.h>
 #include "../mrbz/vm.h"
 #include "platform.h"
 
@@ -16,7 +15,26 @@ extern void load_game_tiles(void);
 #define GAME_BYTECODE snake_bytecode
 #define GAME_NAME "Snake"
 
+#if MRBZ_WORLD
+// Packed world map (src/game/world.txt, converted by mrbz-map)
+#include "../game/world.map.c"
+#endif
+
+// The VM lives in static WRAM, not on the stack: its tables are sized for
+// the game at build time (mrbz_config.h), and the stack stays small
+static mrbz_vm vm;
+
+#if MRBZ_JIT
+// Hot loops are compiled here; WRAM is executable, ROM isn't writable
+static uint8_t jit_code[MRBZ_JIT_CODE];
+#endif
+
 void main(void) {
+#if MRBZ_CGB
+    // Before anything is timed: a CGB runs the whole game at double speed
+    gb_speed_init();
+#endif
+
     // Initialize display
     DISPLAY_ON;
     SHOW_BKG;
@@ -25,10 +43,21 @@ void main(void) {
     load_game_tiles();
 
     // Initialize and run VM
-    mrbz_vm vm;
     mrbz_value result;
+#if MRBZ_SAVE
+    uint8_t status;
+#endif
 
     mrbz_vm_init(&vm);
+#if MRBZ_JIT
+    mrbz_jit_init(&vm, jit_code, MRBZ_JIT_CODE);
+#endif
+#if MRBZ_WORLD
+    gb_world_open(world_map_data);
+#endif
+#if MRBZ_RECORD
+    gb_record_start();
+#endif
 
     // Clear screen before starting game
     for (uint8_t y = 0; y < 18; y++) {
@@ -37,10 +66,49 @@ void main(void) {
         }
     }
 
+#if MRBZ_PROFILE
+    gb_profile_start(&vm, GAME_BYTECODE);
+#endif
+
+#if MRBZ_SAVE
+    // Step one frame at a time so the game can be saved between frames:
+    // SELECT saves, holding START at power-on continues the saved game
+    mrbz_vm_load(&vm, GAME_BYTECODE);
+    if (joypad() & J_START) {
+        gb_restore_state(&vm);
+    }
+    do {
+        status = mrbz_vm_step(&vm, 0xFFFF);
+        if (status == MRBZ_STEP_YIELDED) {
+            if (joypad() & J_SELECT) {
+                gb_save_state(&vm);
+            }
+            gb_wait_vbl(&vm, &result);
+        }
+    } while (status == MRBZ_STEP_YIELDED || status == MRBZ_STEP_BUDGET);
+#else
     mrbz_vm_run(&vm, &result, GAME_BYTECODE);
+#endif
+#if MRBZ_PROFILE
+    gb_profile_stop();
+#endif
+#if MRBZ_TRACE
+    // The last instructions, whether the VM stopped on an error or not
+    ENABLE_RAM;
+    mrbz_trace_dump(&vm, SRAM_LOG_BASE, SRAM_LOG_SIZE);
+#endif
+
+    // A program the VM can't run stops at load (or at the bad instruction);
+    // say so instead of leaving a blank screen that looks like a hang
+    if (vm.error != MRBZ_ERR_NONE) {
+        fill_bkg_rect(0, 0, 20, 18, TILE_EMPTY);
+        gb_draw_text(&vm, 3, 2, "VM ERROR", &result);
+        gb_draw_number(&vm, 12, 2, vm.error, 0, &result);
+        gb_draw_text(&vm, 3, 4, "PC", &result);
+        gb_draw_number(&vm, 6, 4, (int16_t)vm.error_pc, 0, &result);
+    }
 
-    // VM should not return for snake (game_over halts)
-    // Wait forever as fallback
+    // game_over stops the VM; keep the final screen up
     while (1) {
         wait_vbl_done();
     }
@@ -4,36 +4,163 @@
  */
 
 #include <gb/gb.h>
-#include <stdio.h>
+#if MRBZ_CGB
+#include <gb/cgb.h>
+#endif
 #include "platform.h"
 #include "../mrbz/vm.h"
 
-// Random seed
-static uint16_t rand_seed = 12345;
+// Random generator state (one VM per Game Boy)
+static uint16_t rand_state = 12345;
+
+// Direction symbol names, indexed by SYM_*
+static const char* const dir_names[] = { 0, "up", "down", "left", "right" };
+
+#if MRBZ_CGB
+uint8_t gb_double_speed;
+
+// Switch a Game Boy Color to double speed (call first thing at boot); a
+// DMG has no second speed and carries on at normal speed
+void gb_speed_init(void) {
+    if (_cpu == CGB_TYPE) {
+        cpu_fast();
+        gb_double_speed = 1;
+    }
+}
+#endif
+
+#if MRBZ_RECORD
+// Input log in cartridge SRAM, read back from the emulator's .sav file
+static replay_log input_log;
+
+// Start recording (call before running the VM)
+void gb_record_start(void) {
+    ENABLE_RAM;
+    replay_record_start(&input_log, SRAM_LOG_BASE, SRAM_LOG_SIZE, rand_state);
+}
+#endif
+
+#if MRBZ_PROFILE
+// Histogram in cartridge SRAM, read back from the emulator's .sav file or
+// a cartridge dump with mrbz-prof
+static profile_log profile;
+static mrbz_vm* profile_vm;
+
+static void profile_tick(void) {
+    profile_sample(&profile, profile_vm->prof_pc, profile_vm->prof_sym);
+}
+
+// Start sampling vm (call before running the VM)
+void gb_profile_start(mrbz_vm* vm, const uint8_t* bytecode) {
+    ENABLE_RAM;
+    profile_vm = vm;
+    profile_start(&profile, SRAM_LOG_BASE, SRAM_LOG_SIZE, bytecode, PROFILE_RATE);
+    CRITICAL {
+#if MRBZ_CGB
+        // The timer clock doubles with the CPU; count twice as far
+        TMA_REG = gb_double_speed ? PROFILE_TMA_FAST : PROFILE_TMA;
+#else
+        TMA_REG = PROFILE_TMA;
+#endif
+        TIMA_REG = TMA_REG;
+        TAC_REG = 0x04;     // Timer on, 4096 Hz clock (8192 Hz in double speed)
+        add_TIM(profile_tick);
+    }
+    set_interrupts(VBL_IFLAG | TIM_IFLAG);
+}
+
+// Stop sampling; the histogram stays in SRAM
+void gb_profile_stop(void) {
+    set_interrupts(VBL_IFLAG);
+    TAC_REG = 0x00;
+}
+#endif
+
+#if MRBZ_WORLD
+// World map in ROM, streamed into the background ring at VBlank
+static world_map world;
+
+static void world_put(void* ctx, uint8_t x, uint8_t y, uint8_t w, uint8_t h, const uint8_t* tiles) {
+    (void)ctx;
+    set_bkg_tiles(x, y, w, h, tiles);
+}
+
+// Use a packed map (see world.c); returns 0 if it isn't one
+uint8_t gb_world_open(const uint8_t* map) {
+    return world_open(&world, map);
+}
+#endif
+
+#if MRBZ_SAVE
+// Save slot: 'S', u16 snapshot length, VM snapshot, random state, then the
+// visible 20x18 tilemap. The marker is written last, so a save cut short
+// by power-off leaves no slot rather than a broken one.
+#define SAVE_MARK  'S'
+#define SAVE_TILES (20 * 18)
+
+void gb_save_state(mrbz_vm* vm) {
+    uint8_t* p = SRAM_SAVE_BASE;
+    uint16_t len;
+
+    ENABLE_RAM;
+    p[0] = 0;
+    len = mrbz_vm_snapshot(vm, p + 3, SRAM_SAVE_SIZE - 5 - SAVE_TILES);
+    if (len) {
+        p[1] = len & 0xFF;
+        p[2] = len >> 8;
+        p[3 + len] = rand_state & 0xFF;
+        p[4 + len] = rand_state >> 8;
+        get_bkg_tiles(0, 0, 20, 18, p + 5 + len);
+        p[0] = SAVE_MARK;
+    }
+}
+
+// Restore the saved game into a loaded VM; returns 0 if there is none
+uint8_t gb_restore_state(mrbz_vm* vm) {
+    uint8_t* p = SRAM_SAVE_BASE;
+    uint16_t len;
+
+    ENABLE_RAM;
+    if (p[0] != SAVE_MARK) {
+        return 0;
+    }
+    len = p[1] | ((uint16_t)p[2] << 8);
+    if (len > SRAM_SAVE_SIZE - 5 - SAVE_TILES || !mrbz_vm_restore(vm, p + 3, len)) {
+        return 0;
+    }
+    rand_state = p[3 + len] | ((uint16_t)p[4 + len] << 8);
+    set_bkg_tiles(0, 0, 20, 18, p + 5 + len);
+    return 1;
+}
+#endif
 
 // Read joypad and return direction as symbol
 // Returns: :up, :down, :left, :right, or nil for no input
 void gb_read_joypad(mrbz_vm* vm, mrbz_value* ret) {
-    uint8_t j;
-    uint8_t sym_idx;
+    uint8_t j, dir;
 
     j = joypad();
 
     // Priority: up > down > left > right
     if (j & J_UP) {
-        sym_idx = mrbz_find_symbol(vm, "up");
-        MRBZ_SET_SYM(*ret, sym_idx);
+        dir = SYM_UP;
     } else if (j & J_DOWN) {
-        sym_idx = mrbz_find_symbol(vm, "down");
-        MRBZ_SET_SYM(*ret, sym_idx);
+        dir = SYM_DOWN;
     } else if (j & J_LEFT) {
-        sym_idx = mrbz_find_symbol(vm, "left");
-        MRBZ_SET_SYM(*ret, sym_idx);
+        dir = SYM_LEFT;
     } else if (j & J_RIGHT) {
-        sym_idx = mrbz_find_symbol(vm, "right");
-        MRBZ_SET_SYM(*ret, sym_idx);
+        dir = SYM_RIGHT;
     } else {
+        dir = SYM_NONE;
+    }
+#if MRBZ_RECORD
+    replay_record_input(&input_log, dir);
+#endif
+
+    if (dir == SYM_NONE) {
         MRBZ_SET_NIL(*ret);
+    } else {
+        MRBZ_SET_SYM(*ret, mrbz_find_symbol(vm, dir_names[dir]));
     }
 }
 
@@ -53,48 +180,116 @@ void gb_clear_tile(mrbz_vm* vm, int16_t x, int16_t y, mrbz_value* ret) {
     gb_draw_tile(vm, x, y, TILE_EMPTY, ret);
 }
 
-// Wait for vertical blank
+// Wait for vertical blank, then stream the world into the ring while
+// VRAM is free and scroll to the camera
 void gb_wait_vbl(mrbz_vm* vm, mrbz_value* ret) {
     (void)vm;
     wait_vbl_done();
+#if MRBZ_WORLD
+    world_stream(&world, 0, world_put);
+    move_bkg((uint8_t)world.cam_x, (uint8_t)world.cam_y);
+#endif
     MRBZ_SET_NIL(*ret);
 }
 
-// Simple LCG random number generator
-void gb_rand(mrbz_vm* vm, int16_t max, mrbz_value* ret) {
+// Move the world camera to pixel x,y (applied at the next VBlank)
+void gb_scroll_to(mrbz_vm* vm, int16_t x, int16_t y, mrbz_value* ret) {
     (void)vm;
+#if MRBZ_WORLD
+    world_scroll(&world, x, y);
+#else
+    (void)x;
+    (void)y;
+#endif
+    MRBZ_SET_NIL(*ret);
+}
 
-    if (max <= 0) {
-        MRBZ_SET_INT(*ret, 0);
-        return;
-    }
+// World tile at x,y, or nil off the map
+void gb_map_tile(mrbz_vm* vm, int16_t x, int16_t y, mrbz_value* ret) {
+    int16_t tile = -1;
 
-    // LCG: seed = seed * 25173 + 13849
-    rand_seed = rand_seed * 25173 + 13849;
+    (void)vm;
+#if MRBZ_WORLD
+    tile = world_tile(&world, x, y);
+#else
+    (void)x;
+    (void)y;
+#endif
+    if (tile < 0) {
+        MRBZ_SET_NIL(*ret);
+    } else {
+        MRBZ_SET_INT(*ret, tile);
+    }
+}
 
-    MRBZ_SET_INT(*ret, rand_seed % max);
+// Random number in 0...max
+void gb_rand(mrbz_vm* vm, int16_t max, mrbz_value* ret) {
+    (void)vm;
+    MRBZ_SET_INT(*ret, rand_int(&rand_state, max));
 }
 
-// Game over - display score and halt
-void gb_game_over(mrbz_vm* vm, int16_t score, mrbz_value* ret) {
-    uint8_t x, y;
+// Seed the generator with a value, or stir in DIV register jitter
+// DIV ticks at 16 kHz (32 kHz in double speed), so its value when the
+// player acts is unpredictable.
+void gb_srand(mrbz_vm* vm, uint8_t argc, int16_t seed, mrbz_value* ret) {
+    uint8_t entropy;
 
     (void)vm;
 
-    // Clear screen with space character (0x00) for printf to work
-    for (y = 0; y < 18; y++) {
-        for (x = 0; x < 20; x++) {
-            set_bkg_tile_xy(x, y, 0);
-        }
+    if (argc >= 1) {
+        rand_seed(&rand_state, seed);
+    } else {
+        entropy = DIV_REG;
+        rand_stir(&rand_state, entropy);
+#if MRBZ_RECORD
+        replay_record_stir(&input_log, entropy);
+#endif
     }
+    MRBZ_SET_NIL(*ret);
+}
 
-    // Display "GAME OVER" using printf
-    printf("\n\n\n   GAME OVER\n\n   Score: %d\n", score);
+// Random position packed as (y << 8) | x, with x in 0...w and y in 0...h
+void gb_rand_pos(mrbz_vm* vm, int16_t w, int16_t h, mrbz_value* ret) {
+    (void)vm;
+    MRBZ_SET_INT(*ret, rand_pos(&rand_state, w, h));
+}
 
-    MRBZ_SET_NIL(*ret);
+// Write a run of tiles to one row of the visible area
+static void draw_run(int16_t x, int16_t y, uint8_t* tiles, uint8_t len) {
+    uint8_t skip;
 
-    // Halt forever
-    while (1) {
-        wait_vbl_done();
+    len = text_clip(&x, y, len, &skip);
+    if (len) {
+        set_bkg_tiles((uint8_t)x, (uint8_t)y, len, 1, tiles + skip);
     }
 }
+
+// Draw n at x,y, zero-padded to width tiles
+void gb_draw_number(mrbz_vm* vm, int16_t x, int16_t y, int16_t n, uint8_t width, mrbz_value* ret) {
+    uint8_t tiles[TEXT_MAX];
+
+    (void)vm;
+    draw_run(x, y, tiles, text_number(n, width, tiles));
+    MRBZ_SET_NIL(*ret);
+}
+
+// Draw a symbol's name at x,y
+void gb_draw_text(mrbz_vm* vm, int16_t x, int16_t y, const char* text, mrbz_value* ret) {
+    uint8_t tiles[TEXT_MAX];
+
+    (void)vm;
+    draw_run(x, y, tiles, text_symbol(text, tiles));
+    MRBZ_SET_NIL(*ret);
+}
+
+// Game over - display score and stop the VM
+void gb_game_over(mrbz_vm* vm, int16_t score, mrbz_value* ret) {
+    fill_bkg_rect(0, 0, 20, 18, TILE_EMPTY);
+    gb_draw_text(vm, 5, 6, "GAME OVER", ret);
+    gb_draw_text(vm, 5, 8, "SCORE", ret);
+    gb_draw_number(vm, 11, 8, score, 0, ret);
+
+    // Stop the VM; main() keeps the screen up
+    vm->running = 0;
+    MRBZ_SET_NIL(*ret);
+}
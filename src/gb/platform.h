@@ -15,7 +15,7 @@
 #define SYM_LEFT  3
 #define SYM_RIGHT 4
 
-// Game tiles start at offset 128 to preserve font tiles for printf
+// Game tiles start at offset 128, clear of the GBDK font
 #define TILE_OFFSET 128
 
 // Tile IDs (add TILE_OFFSET when using)
@@ -24,6 +24,14 @@
 #define TILE_BODY  (TILE_OFFSET + 2)
 #define TILE_FOOD  (TILE_OFFSET + 3)
 
+// Text tiles: digits 0-9, letters A-Z, then a minus sign
+#define TILE_DIGIT0   (TILE_OFFSET + 4)
+#define TILE_LETTER_A (TILE_OFFSET + 14)
+#define TILE_MINUS    (TILE_OFFSET + 40)
+
+// Longest run draw_number and draw_text write (one screen row)
+#define TEXT_MAX 20
+
 // Built-in functions (called from builtins.c)
 // Using output parameter instead of return value for SDCC compatibility
 void gb_read_joypad(mrbz_vm* vm, mrbz_value* ret);
@@ -31,6 +39,152 @@ void gb_draw_tile(mrbz_vm* vm, int16_t x, int16_t y, int16_t tile, mrbz_value* r
 void gb_clear_tile(mrbz_vm* vm, int16_t x, int16_t y, mrbz_value* ret);
 void gb_wait_vbl(mrbz_vm* vm, mrbz_value* ret);
 void gb_rand(mrbz_vm* vm, int16_t max, mrbz_value* ret);
+void gb_srand(mrbz_vm* vm, uint8_t argc, int16_t seed, mrbz_value* ret);
+void gb_rand_pos(mrbz_vm* vm, int16_t w, int16_t h, mrbz_value* ret);
 void gb_game_over(mrbz_vm* vm, int16_t score, mrbz_value* ret);
+void gb_draw_number(mrbz_vm* vm, int16_t x, int16_t y, int16_t n, uint8_t width, mrbz_value* ret);
+void gb_draw_text(mrbz_vm* vm, int16_t x, int16_t y, const char* text, mrbz_value* ret);
+void gb_scroll_to(mrbz_vm* vm, int16_t x, int16_t y, mrbz_value* ret);
+void gb_map_tile(mrbz_vm* vm, int16_t x, int16_t y, mrbz_value* ret);
+
+// Numbers and text as tile runs (text.c)
+uint8_t text_number(int16_t n, uint8_t width, uint8_t* tiles);
+uint8_t text_symbol(const char* name, uint8_t* tiles);
+uint8_t text_clip(int16_t* x, int16_t y, uint8_t len, uint8_t* skip);
+
+// Random number generator (rand.c), state owned by the caller (never zero)
+void rand_seed(uint16_t* state, uint16_t seed);
+void rand_stir(uint16_t* state, uint8_t entropy);
+uint16_t rand_next(uint16_t* state);
+uint16_t rand_range(uint16_t* state, uint16_t max);
+int16_t rand_int(uint16_t* state, int16_t max);
+int16_t rand_pos(uint16_t* state, int16_t w, int16_t h);
+
+// Scrolling world maps (world.c); see world.c for the packed format
+#define WORLD_SEG    16     // Tiles per run-length coded row segment
+#define WORLD_MAX    4095   // Largest width or height (pixels fit an int16)
+#define WORLD_RING   32     // Hardware background map size
+#define WORLD_VIEW_W 21     // Columns on screen with a sub-tile scroll
+#define WORLD_VIEW_H 19     // Rows on screen with a sub-tile scroll
+
+typedef struct {
+    const uint8_t* data;    // Packed map (NULL = no world)
+    uint16_t w, h;          // Size in tiles
+    uint8_t segs;           // Segments per row
+    int16_t cam_x, cam_y;   // Camera (top-left pixel of the screen)
+    int16_t tx, ty;         // Top-left tile of the window held in the ring
+    uint8_t loaded;         // Ring holds the window at tx,ty
+} world_map;
+
+// Writes a w x h block of tiles at x,y of the background ring
+typedef void (*world_put_fn)(void* ctx, uint8_t x, uint8_t y, uint8_t w, uint8_t h, const uint8_t* tiles);
+
+uint8_t world_open(world_map* m, const uint8_t* data);
+void world_row(const world_map* m, int16_t x, int16_t y, uint8_t len, uint8_t* tiles);
+int16_t world_tile(const world_map* m, int16_t x, int16_t y);
+void world_scroll(world_map* m, int16_t x, int16_t y);
+void world_stream(world_map* m, void* ctx, world_put_fn put);
+
+// Input recording and replay (replay.c)
+typedef struct {
+    uint8_t* buf;
+    uint16_t cap;       // Buffer size
+    uint16_t pos;       // Current run (recording) / next event (replaying)
+    uint16_t run;       // Reads in the current run / reads left in it
+    uint8_t dir;        // Direction of the current run (SYM_*)
+} replay_log;
+
+void replay_record_start(replay_log* log, uint8_t* buf, uint16_t cap, uint16_t seed);
+void replay_record_input(replay_log* log, uint8_t dir);
+void replay_record_stir(replay_log* log, uint8_t entropy);
+uint16_t replay_size(const replay_log* log);
+uint8_t replay_start(replay_log* log, uint8_t* buf, uint16_t len, uint16_t* seed);
+uint8_t replay_read_input(replay_log* log, uint8_t* dir);
+uint8_t replay_read_stir(replay_log* log, uint8_t* entropy);
+
+// Sampling profile histogram (profile.c)
+#define PROFILE_HEADER   12
+#define PROFILE_BUILTINS 256    // Builtin counters, one per symbol index
+
+typedef struct {
+    uint8_t* buf;
+    uint16_t buckets;   // pc buckets after the builtin counters
+    uint8_t shift;      // pc >> shift is the bucket
+} profile_log;
+
+uint16_t profile_fingerprint(const uint8_t* bytecode);
+void profile_start(profile_log* log, uint8_t* buf, uint16_t cap, const uint8_t* bytecode, uint16_t rate);
+void profile_sample(profile_log* log, uint16_t pc, uint8_t sym);
+uint8_t profile_open(profile_log* log, uint8_t* buf, uint16_t cap, uint32_t* samples, uint16_t* rate);
+uint16_t profile_fingerprint_of(const profile_log* log);
+uint16_t profile_builtin_count(const profile_log* log, uint8_t sym);
+uint16_t profile_bucket_count(const profile_log* log, uint16_t idx);
+
+// Cartridge SRAM: input log (or profile) in the first half, save slot in
+// the second
+#define SRAM_LOG_BASE  ((uint8_t*)0xA000)
+#define SRAM_LOG_SIZE  0x1000
+#define SRAM_SAVE_BASE ((uint8_t*)0xB000)
+#define SRAM_SAVE_SIZE 0x1000
+
+// Record input to cartridge SRAM (build with MRBZ_RECORD=1, see Makefile)
+#ifndef MRBZ_RECORD
+#define MRBZ_RECORD 0
+#endif
+#if MRBZ_RECORD
+void gb_record_start(void);
+#endif
+
+// Sample the VM from the timer interrupt into cartridge SRAM (build with
+// MRBZ_PROFILE=1, see Makefile); the profile takes the input log's half
+#if MRBZ_PROFILE
+#if MRBZ_RECORD
+#error "MRBZ_PROFILE and MRBZ_RECORD both use the first half of SRAM"
+#endif
+#define PROFILE_TMA  0xFC   // 4096 Hz timer clock / 4
+#define PROFILE_TMA_FAST 0xF8   // Same clock doubled by double speed / 8
+#define PROFILE_RATE 1024   // Samples per second
+void gb_profile_start(mrbz_vm* vm, const uint8_t* bytecode);
+void gb_profile_stop(void);
+#endif
+
+// Save and restore the game in cartridge SRAM (build with MRBZ_SAVE=1)
+#ifndef MRBZ_SAVE
+#define MRBZ_SAVE 0
+#endif
+#if MRBZ_SAVE
+void gb_save_state(mrbz_vm* vm);
+uint8_t gb_restore_state(mrbz_vm* vm);
+#endif
+
+// Scrolling world map in ROM (build with MRBZ_WORLD=1, see Makefile)
+#ifndef MRBZ_WORLD
+#define MRBZ_WORLD 0
+#endif
+#if MRBZ_WORLD
+uint8_t gb_world_open(const uint8_t* map);
+#endif
+
+// CPU cycles per frame at normal speed (4.19 MHz / 59.7 Hz); double
+// speed fits twice as many into the same frame
+#define GB_FRAME_CYCLES 70224UL
+
+// Game Boy Color double speed (build with MRBZ_CGB=1, see Makefile): on a
+// CGB the CPU switches to 8.4 MHz at boot, on a DMG it stays at normal
+// speed. Frames stay VBlank-paced either way; DIV and the timer tick twice
+// as fast in double speed, which the profiler compensates for.
+#ifndef MRBZ_CGB
+#define MRBZ_CGB 0
+#endif
+#if MRBZ_CGB
+extern uint8_t gb_double_speed;     // Set once the switch happened
+void gb_speed_init(void);
+#endif
+
+// Instruction trace (build with MRBZ_TRACE=1): main.c writes it to the
+// input log's half of SRAM when the VM stops, for mrbz-host --decode-trace
+#if MRBZ_TRACE && (MRBZ_RECORD || MRBZ_PROFILE)
+#error "MRBZ_TRACE shares the first half of SRAM with MRBZ_RECORD and MRBZ_PROFILE"
+#endif
 
 #endif // MRBZ_PLATFORM_H
@@ -0,0 +1,119 @@
+/**
+ * mrbz - Minimal Ruby for Game Boy
+ * Sampling profile histogram (filled on the Game Boy, read by mrbz-prof)
+ *
+ * A timer interrupt samples where the VM is: the instruction it is running
+ * (vm->prof_pc) and the builtin it is inside (vm->prof_sym). Each sample
+ * bumps one counter, so the histogram is a flat self-time profile: time in
+ * a builtin counts against the builtin, not the call site.
+ *
+ * Layout (little endian):
+ *   'P' 'F' u16 fingerprint          sum of the IREP section (see below)
+ *   u8 shift, u8 0, u16 rate         pc >> shift is the bucket; samples/s
+ *   u32 samples                      all samples taken
+ *   u16 builtins[256]                samples inside a builtin, by symbol
+ *   u16 buckets[...]                 samples interpreting, by pc bucket
+ * Counters stop at 0xFFFF rather than wrapping. The fingerprint lets
+ * mrbz-prof refuse a histogram taken with a different build of the game.
+ */
+
+#include "platform.h"
+
+#define U32_AT(p) ((uint32_t)(p)[0] | ((uint32_t)(p)[1] << 8) | \
+                   ((uint32_t)(p)[2] << 16) | ((uint32_t)(p)[3] << 24))
+
+// Bump a saturating little-endian counter
+static void bump(uint8_t* p) {
+    if (++p[0] == 0 && ++p[1] == 0) {
+        p[0] = 0xFF;
+        p[1] = 0xFF;
+    }
+}
+
+// Sum of the IREP section, which the pcs in a histogram index into
+uint16_t profile_fingerprint(const uint8_t* bytecode) {
+    uint16_t len, sum, i;
+
+    len = ((uint16_t)bytecode[26] << 8) | bytecode[27];
+    sum = 0;
+    for (i = 0; i < len; i++) {
+        sum = (uint16_t)((sum << 1) | (sum >> 15)) + bytecode[20 + i];
+    }
+    return sum;
+}
+
+// Start an empty histogram in buf for the program in bytecode
+void profile_start(profile_log* log, uint8_t* buf, uint16_t cap, const uint8_t* bytecode, uint16_t rate) {
+    uint16_t end, i, fp;
+
+    log->buf = buf;
+    log->buckets = (cap - PROFILE_HEADER - PROFILE_BUILTINS * 2) / 2;
+    log->shift = 0;
+
+    // Buckets as fine as the buffer allows for the whole IREP section
+    end = 20 + (((uint16_t)bytecode[26] << 8) | bytecode[27]);
+    while ((end >> log->shift) >= log->buckets) {
+        log->shift++;
+    }
+
+    for (i = 0; i < cap; i++) {
+        buf[i] = 0;
+    }
+    fp = profile_fingerprint(bytecode);
+    buf[0] = 'P';
+    buf[1] = 'F';
+    buf[2] = fp & 0xFF;
+    buf[3] = fp >> 8;
+    buf[4] = log->shift;
+    buf[6] = rate & 0xFF;
+    buf[7] = rate >> 8;
+}
+
+// Count one sample (called from the timer interrupt)
+// A pc torn by the interrupt landing between its two byte writes may fall
+// outside the buckets; such samples only count towards the total.
+void profile_sample(profile_log* log, uint16_t pc, uint8_t sym) {
+    uint8_t* p = log->buf;
+    uint16_t bucket;
+
+    if (++p[8] == 0 && ++p[9] == 0 && ++p[10] == 0) {
+        p[11]++;
+    }
+    if (sym != MRBZ_PROF_VM) {
+        bump(p + PROFILE_HEADER + 2 * sym);
+        return;
+    }
+    bucket = pc >> log->shift;
+    if (bucket < log->buckets) {
+        bump(p + PROFILE_HEADER + PROFILE_BUILTINS * 2 + 2 * bucket);
+    }
+}
+
+// Open a histogram for reading; returns 0 if buf doesn't hold one
+uint8_t profile_open(profile_log* log, uint8_t* buf, uint16_t cap, uint32_t* samples, uint16_t* rate) {
+    if (cap < PROFILE_HEADER + PROFILE_BUILTINS * 2 || buf[0] != 'P' || buf[1] != 'F') {
+        return 0;
+    }
+    log->buf = buf;
+    log->buckets = (cap - PROFILE_HEADER - PROFILE_BUILTINS * 2) / 2;
+    log->shift = buf[4];
+    *rate = buf[6] | ((uint16_t)buf[7] << 8);
+    *samples = U32_AT(buf + 8);
+    return 1;
+}
+
+// Fingerprint a histogram was taken with
+uint16_t profile_fingerprint_of(const profile_log* log) {
+    return log->buf[2] | ((uint16_t)log->buf[3] << 8);
+}
+
+// Samples in builtin sym, or in pc bucket idx
+uint16_t profile_builtin_count(const profile_log* log, uint8_t sym) {
+    const uint8_t* p = log->buf + PROFILE_HEADER + 2 * sym;
+    return p[0] | ((uint16_t)p[1] << 8);
+}
+
+uint16_t profile_bucket_count(const profile_log* log, uint16_t idx) {
+    const uint8_t* p = log->buf + PROFILE_HEADER + PROFILE_BUILTINS * 2 + 2 * idx;
+    return p[0] | ((uint16_t)p[1] << 8);
+}
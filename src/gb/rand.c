@@ -0,0 +1,55 @@
+/**
+ * mrbz - Minimal Ruby for Game Boy
+ * Random number generator (shared by the Game Boy and host builds)
+ *
+ * The caller owns the generator state, so each VM on the host can have
+ * its own stream.
+ */
+
+#include "platform.h"
+
+// Seed the generator; zero would lock xorshift at zero so it is remapped
+void rand_seed(uint16_t* state, uint16_t seed) {
+    *state = seed ? seed : 0xACE1;
+}
+
+// Mix extra entropy into the current state (e.g. DIV register jitter)
+void rand_stir(uint16_t* state, uint8_t entropy) {
+    rand_seed(state, *state ^ ((uint16_t)entropy << 8) ^ entropy);
+    rand_next(state);
+}
+
+// Advance the generator
+// 16-bit xorshift (7, 9, 8): full 65535 period, shifts and xors only
+uint16_t rand_next(uint16_t* state) {
+    uint16_t x = *state;
+    x ^= x << 7;
+    x ^= x >> 9;
+    x ^= x << 8;
+    *state = x;
+    return x;
+}
+
+// Uniform value in 0...max using multiply-shift instead of a modulo
+// The high byte drives small ranges so the multiply stays 8x8 bits.
+uint16_t rand_range(uint16_t* state, uint16_t max) {
+    uint16_t x = rand_next(state);
+    if (max <= 0xFF) {
+        return ((x >> 8) * (uint8_t)max) >> 8;
+    }
+    return (uint16_t)(((uint32_t)x * max) >> 16);
+}
+
+// rand(max): 0...max, or 0 for an empty range
+int16_t rand_int(uint16_t* state, int16_t max) {
+    return max > 0 ? (int16_t)rand_range(state, max) : 0;
+}
+
+// rand_pos(w, h): (y << 8) | x with x in 0...w and y in 0...h
+int16_t rand_pos(uint16_t* state, int16_t w, int16_t h) {
+    uint8_t x, y;
+
+    x = w > 0 ? (uint8_t)rand_range(state, w) : 0;
+    y = h > 0 ? (uint8_t)rand_range(state, h) : 0;
+    return ((int16_t)y << 8) | x;
+}
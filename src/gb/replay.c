@@ -0,0 +1,150 @@
+/**
+ * mrbz - Minimal Ruby for Game Boy
+ * Input recording and replay (shared by the Game Boy and host builds)
+ *
+ * A log holds everything that makes a run non-deterministic: the initial
+ * random seed, the direction each read_joypad call returned and the
+ * entropy each argument-less srand stirred in. Replaying it reproduces the
+ * run exactly.
+ *
+ * Layout: 'M' 'R' seed(u16 LE), then events, then REPLAY_EOF
+ *   ddd nnnnn       input run: direction ddd (SYM_*) for n+1 reads
+ *   ddd 11111 u16   input run of 32..65535 reads (LE count follows)
+ *   111 00000 e     srand stirred in entropy byte e
+ *   111 11111       end of log
+ * The recorder keeps the end marker written after every event, so a log
+ * cut short by power-off still replays up to that point.
+ */
+
+#include "platform.h"
+
+#define EV_STIR    0xE0
+#define EV_EOF     0xFF
+#define RUN_LONG   31
+#define HEADER_LEN 4
+
+// Encoded size of an input run
+static uint8_t run_size(uint16_t run) {
+    return run > RUN_LONG ? 3 : 1;
+}
+
+// Write the current run and the end marker after it
+static void write_run(replay_log* log) {
+    uint8_t* p = log->buf + log->pos;
+
+    if (log->run > RUN_LONG) {
+        p[0] = (log->dir << 5) | RUN_LONG;
+        p[1] = log->run & 0xFF;
+        p[2] = log->run >> 8;
+        p[3] = EV_EOF;
+    } else {
+        p[0] = (log->dir << 5) | (log->run - 1);
+        p[1] = EV_EOF;
+    }
+}
+
+// Start recording into buf
+void replay_record_start(replay_log* log, uint8_t* buf, uint16_t cap, uint16_t seed) {
+    log->buf = buf;
+    log->cap = cap;
+    log->pos = HEADER_LEN;
+    log->run = 0;
+    log->dir = SYM_NONE;
+    buf[0] = 'M';
+    buf[1] = 'R';
+    buf[2] = seed & 0xFF;
+    buf[3] = seed >> 8;
+    buf[HEADER_LEN] = EV_EOF;
+}
+
+// Record the direction one read_joypad call returned
+// Recording stops quietly once the buffer is full.
+void replay_record_input(replay_log* log, uint8_t dir) {
+    uint16_t pos = log->pos;
+
+    if (log->run && dir == log->dir && log->run < 0xFFFF) {
+        // Growing past RUN_LONG switches to the 3-byte form
+        if (log->run == RUN_LONG && pos + 4 > log->cap) return;
+        log->run++;
+    } else {
+        if (log->run) {
+            pos += run_size(log->run);
+        }
+        if (pos + 2 > log->cap) return;
+        log->pos = pos;
+        log->run = 1;
+        log->dir = dir;
+    }
+    write_run(log);
+}
+
+// Record the entropy an argument-less srand stirred in
+void replay_record_stir(replay_log* log, uint8_t entropy) {
+    uint16_t pos = log->pos;
+
+    if (log->run) {
+        pos += run_size(log->run);
+    }
+    if (pos + 3 > log->cap) return;
+
+    log->buf[pos] = EV_STIR;
+    log->buf[pos + 1] = entropy;
+    log->buf[pos + 2] = EV_EOF;
+    log->pos = pos + 2;
+    log->run = 0;
+}
+
+// Bytes of buf in use, including the end marker
+uint16_t replay_size(const replay_log* log) {
+    return log->pos + (log->run ? run_size(log->run) : 0) + 1;
+}
+
+// Start replaying a log; returns 0 if buf does not hold one
+uint8_t replay_start(replay_log* log, uint8_t* buf, uint16_t len, uint16_t* seed) {
+    if (len < HEADER_LEN + 1 || buf[0] != 'M' || buf[1] != 'R') {
+        return 0;
+    }
+    log->buf = buf;
+    log->cap = len;
+    log->pos = HEADER_LEN;
+    log->run = 0;
+    log->dir = SYM_NONE;
+    *seed = buf[2] | ((uint16_t)buf[3] << 8);
+    return 1;
+}
+
+// Next recorded read_joypad direction; returns 0 at the end of the log
+// (or if the program asks for input where the log has an srand)
+uint8_t replay_read_input(replay_log* log, uint8_t* dir) {
+    uint8_t ev;
+
+    if (log->run == 0) {
+        if (log->pos >= log->cap) return 0;
+        ev = log->buf[log->pos];
+        if ((ev >> 5) > SYM_RIGHT) return 0;
+
+        log->dir = ev >> 5;
+        if ((ev & RUN_LONG) == RUN_LONG) {
+            if (log->pos + 3 > log->cap) return 0;
+            log->run = log->buf[log->pos + 1] | ((uint16_t)log->buf[log->pos + 2] << 8);
+            log->pos += 3;
+        } else {
+            log->run = (ev & RUN_LONG) + 1;
+            log->pos++;
+        }
+    }
+    log->run--;
+    *dir = log->dir;
+    return 1;
+}
+
+// Next recorded srand entropy; returns 0 at the end of the log or if the
+// log has input reads first
+uint8_t replay_read_stir(replay_log* log, uint8_t* entropy) {
+    if (log->run != 0 || log->pos + 2 > log->cap || log->buf[log->pos] != EV_STIR) {
+        return 0;
+    }
+    *entropy = log->buf[log->pos + 1];
+    log->pos += 2;
+    return 1;
+}
@@ -0,0 +1,92 @@
+/**
+ * mrbz - Minimal Ruby for Game Boy
+ * Numbers and text as tile runs (draw_number, draw_text)
+ *
+ * Digits and letters are tiles of their own (tiles.c), so drawing text is
+ * a row of tile writes; no printf, no font in VRAM. Numbers are converted
+ * by subtracting powers of ten, since the Game Boy has no divide
+ * instruction: a 5-digit number takes at most 45 subtractions.
+ */
+
+#include "platform.h"
+
+// Powers of ten for the digits of an int16
+static const int16_t powers[] = { 10000, 1000, 100, 10, 1 };
+
+// Tiles for n, right-aligned and zero-padded to width (which includes the
+// minus sign); returns the number of tiles written, at most TEXT_MAX
+uint8_t text_number(int16_t n, uint8_t width, uint8_t* tiles) {
+    uint8_t digits[5];
+    uint16_t u;
+    uint8_t i, d, count, len, neg;
+
+    neg = n < 0;
+    u = neg ? (uint16_t)(-(int32_t)n) : (uint16_t)n;
+
+    // Digits, most significant first, without leading zeros
+    count = 0;
+    for (i = 0; i < 5; i++) {
+        d = 0;
+        while (u >= (uint16_t)powers[i]) {
+            u -= powers[i];
+            d++;
+        }
+        if (d || count || i == 4) {
+            digits[count++] = d;
+        }
+    }
+
+    if (width > TEXT_MAX) width = TEXT_MAX;
+    len = 0;
+    if (neg) {
+        tiles[len++] = TILE_MINUS;
+    }
+    for (i = count + neg; i < width; i++) {
+        tiles[len++] = TILE_DIGIT0;
+    }
+    for (i = 0; i < count; i++) {
+        tiles[len++] = TILE_DIGIT0 + digits[i];
+    }
+    return len;
+}
+
+// Tiles for a symbol name: letters (either case), digits and '-'; anything
+// else is a blank. Returns the number of tiles written, at most TEXT_MAX.
+uint8_t text_symbol(const char* name, uint8_t* tiles) {
+    uint8_t len;
+    char c;
+
+    for (len = 0; len < TEXT_MAX && name[len]; len++) {
+        c = name[len];
+        if (c >= 'a' && c <= 'z') {
+            tiles[len] = TILE_LETTER_A + (c - 'a');
+        } else if (c >= 'A' && c <= 'Z') {
+            tiles[len] = TILE_LETTER_A + (c - 'A');
+        } else if (c >= '0' && c <= '9') {
+            tiles[len] = TILE_DIGIT0 + (c - '0');
+        } else if (c == '-') {
+            tiles[len] = TILE_MINUS;
+        } else {
+            tiles[len] = TILE_EMPTY;
+        }
+    }
+    return len;
+}
+
+// Clip a run of len tiles at x,y to the visible 20x18 area; returns the
+// tiles left, with *x and *skip (tiles cut off the left) adjusted
+uint8_t text_clip(int16_t* x, int16_t y, uint8_t len, uint8_t* skip) {
+    *skip = 0;
+    if (y < 0 || y >= 18 || *x >= 20 || *x + len <= 0) {
+        return 0;
+    }
+    if (*x < 0) {
+        *skip = (uint8_t)-*x;
+        len -= *skip;
+        *x = 0;
+    }
+    if (*x + len > 20) {
+        len = (uint8_t)(20 - *x);
+    }
+    return len;
+}
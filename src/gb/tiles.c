@@ -2,7 +2,8 @@
  * mrbz - Minimal Ruby for Game Boy
  * Tile graphics data
  *
- * Simple 8x8 tiles for Snake game
+ * Simple 8x8 tiles for Snake game, plus the digits and letters
+ * draw_number and draw_text use (see text.c)
  * Each tile is 16 bytes (2 bits per pixel, 8x8 = 64 pixels = 128 bits)
  */
 
@@ -77,14 +78,98 @@ const uint8_t tile_data[] = {
     // Digit 9
     0x3C, 0x3C, 0x66, 0x66, 0x66, 0x66, 0x3E, 0x3E,
     0x06, 0x06, 0x0C, 0x0C, 0x38, 0x38, 0x00, 0x00,
+
+    // Tiles 14-39: Letters A-Z (same style as the digits)
+    // Letter A
+    0x18, 0x18, 0x3C, 0x3C, 0x66, 0x66, 0x66, 0x66,
+    0x7E, 0x7E, 0x66, 0x66, 0x66, 0x66, 0x00, 0x00,
+    // Letter B
+    0x7C, 0x7C, 0x66, 0x66, 0x66, 0x66, 0x7C, 0x7C,
+    0x66, 0x66, 0x66, 0x66, 0x7C, 0x7C, 0x00, 0x00,
+    // Letter C
+    0x3C, 0x3C, 0x66, 0x66, 0x60, 0x60, 0x60, 0x60,
+    0x60, 0x60, 0x66, 0x66, 0x3C, 0x3C, 0x00, 0x00,
+    // Letter D
+    0x78, 0x78, 0x6C, 0x6C, 0x66, 0x66, 0x66, 0x66,
+    0x66, 0x66, 0x6C, 0x6C, 0x78, 0x78, 0x00, 0x00,
+    // Letter E
+    0x7E, 0x7E, 0x60, 0x60, 0x60, 0x60, 0x7C, 0x7C,
+    0x60, 0x60, 0x60, 0x60, 0x7E, 0x7E, 0x00, 0x00,
+    // Letter F
+    0x7E, 0x7E, 0x60, 0x60, 0x60, 0x60, 0x7C, 0x7C,
+    0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x00, 0x00,
+    // Letter G
+    0x3C, 0x3C, 0x66, 0x66, 0x60, 0x60, 0x6E, 0x6E,
+    0x66, 0x66, 0x66, 0x66, 0x3E, 0x3E, 0x00, 0x00,
+    // Letter H
+    0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x7E, 0x7E,
+    0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x00, 0x00,
+    // Letter I
+    0x7E, 0x7E, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18,
+    0x18, 0x18, 0x18, 0x18, 0x7E, 0x7E, 0x00, 0x00,
+    // Letter J
+    0x0E, 0x0E, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06,
+    0x66, 0x66, 0x66, 0x66, 0x3C, 0x3C, 0x00, 0x00,
+    // Letter K
+    0x66, 0x66, 0x6C, 0x6C, 0x78, 0x78, 0x70, 0x70,
+    0x78, 0x78, 0x6C, 0x6C, 0x66, 0x66, 0x00, 0x00,
+    // Letter L
+    0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60,
+    0x60, 0x60, 0x60, 0x60, 0x7E, 0x7E, 0x00, 0x00,
+    // Letter M
+    0xC6, 0xC6, 0xEE, 0xEE, 0xFE, 0xFE, 0xD6, 0xD6,
+    0xC6, 0xC6, 0xC6, 0xC6, 0xC6, 0xC6, 0x00, 0x00,
+    // Letter N
+    0x66, 0x66, 0x76, 0x76, 0x7E, 0x7E, 0x6E, 0x6E,
+    0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x00, 0x00,
+    // Letter O
+    0x3C, 0x3C, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+    0x66, 0x66, 0x66, 0x66, 0x3C, 0x3C, 0x00, 0x00,
+    // Letter P
+    0x7C, 0x7C, 0x66, 0x66, 0x66, 0x66, 0x7C, 0x7C,
+    0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x00, 0x00,
+    // Letter Q
+    0x3C, 0x3C, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+    0x6E, 0x6E, 0x6C, 0x6C, 0x36, 0x36, 0x00, 0x00,
+    // Letter R
+    0x7C, 0x7C, 0x66, 0x66, 0x66, 0x66, 0x7C, 0x7C,
+    0x78, 0x78, 0x6C, 0x6C, 0x66, 0x66, 0x00, 0x00,
+    // Letter S
+    0x3C, 0x3C, 0x66, 0x66, 0x60, 0x60, 0x3C, 0x3C,
+    0x06, 0x06, 0x66, 0x66, 0x3C, 0x3C, 0x00, 0x00,
+    // Letter T
+    0x7E, 0x7E, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18,
+    0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00,
+    // Letter U
+    0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+    0x66, 0x66, 0x66, 0x66, 0x3C, 0x3C, 0x00, 0x00,
+    // Letter V
+    0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+    0x66, 0x66, 0x3C, 0x3C, 0x18, 0x18, 0x00, 0x00,
+    // Letter W
+    0xC6, 0xC6, 0xC6, 0xC6, 0xC6, 0xC6, 0xD6, 0xD6,
+    0xFE, 0xFE, 0xEE, 0xEE, 0xC6, 0xC6, 0x00, 0x00,
+    // Letter X
+    0x66, 0x66, 0x66, 0x66, 0x3C, 0x3C, 0x18, 0x18,
+    0x3C, 0x3C, 0x66, 0x66, 0x66, 0x66, 0x00, 0x00,
+    // Letter Y
+    0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x3C, 0x3C,
+    0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00,
+    // Letter Z
+    0x7E, 0x7E, 0x06, 0x06, 0x0C, 0x0C, 0x18, 0x18,
+    0x30, 0x30, 0x60, 0x60, 0x7E, 0x7E, 0x00, 0x00,
+
+    // Tile 40: Minus sign
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x7E, 0x7E,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
 };
 
-const uint8_t num_tiles = 14;  // 0-13
+const uint8_t num_tiles = 41;  // 0-40
 
-// Game tiles start at offset 128 to avoid overwriting font tiles
+// Game tiles start at offset 128 (see TILE_OFFSET in platform.h)
 #define GAME_TILE_OFFSET 128
 
-// Load tiles into VRAM (at offset to preserve font)
+// Load tiles into VRAM
 void load_game_tiles(void) {
     set_bkg_data(GAME_TILE_OFFSET, num_tiles, tile_data);
 }
@@ -0,0 +1,206 @@
+/**
+ * mrbz - Minimal Ruby for Game Boy
+ * Scrolling world maps larger than the background map
+ *
+ * The hardware background is a 32x32 ring of tiles; the screen shows a
+ * 21x19 window of it (20x18 plus the column and row a sub-tile scroll
+ * brings in). A world keeps the ring holding the tiles under the camera:
+ * when the camera moves, only the columns and rows it exposes are decoded
+ * and written, at VBlank, and SCX/SCY take the rest. Any frame writes at
+ * most one window's worth of tiles, however large the map is.
+ *
+ * Packed map (little endian):
+ *   u16 width, u16 height          in tiles
+ *   u16 offsets[height * segs]     start of each row segment from the
+ *                                  start of the map; segs = width / 16
+ *                                  rounded up
+ *   segments                       16 tiles each (the last of a row may
+ *                                  be shorter), run-length coded:
+ *                                    0x00-0x7F n: n + 1 tiles follow
+ *                                    0x80-0xFF n: next tile n - 0x7F times
+ *
+ * Segments keep any tile a short decode away, so streaming a column costs
+ * the same on a 4000-tile-wide map as on a 40-tile one.
+ */
+
+#include "platform.h"
+
+#define U16(p) ((uint16_t)(p)[0] | ((uint16_t)(p)[1] << 8))
+
+// Open a packed map; returns 0 if the header doesn't describe one
+uint8_t world_open(world_map* m, const uint8_t* data) {
+    m->data = 0;
+    m->w = U16(data);
+    m->h = U16(data + 2);
+    if (m->w == 0 || m->h == 0 || m->w > WORLD_MAX || m->h > WORLD_MAX) {
+        return 0;
+    }
+    m->segs = (uint8_t)((m->w + WORLD_SEG - 1) / WORLD_SEG);
+    m->data = data;
+    m->cam_x = 0;
+    m->cam_y = 0;
+    m->loaded = 0;
+    return 1;
+}
+
+// Decode len tiles of row y from column x; tiles off the map are empty
+void world_row(const world_map* m, int16_t x, int16_t y, uint8_t len, uint8_t* tiles) {
+    const uint8_t* p;
+    uint8_t skip, n, ctl, run, tile;
+
+    while (len) {
+        if (y < 0 || y >= (int16_t)m->h || x < 0 || x >= (int16_t)m->w) {
+            *tiles++ = TILE_EMPTY;
+            x++;
+            len--;
+            continue;
+        }
+
+        // Tiles wanted from the segment holding x
+        p = m->data + U16(m->data + 4 + 2 * ((uint16_t)y * m->segs + (uint16_t)x / WORLD_SEG));
+        skip = (uint8_t)x & (WORLD_SEG - 1);
+        n = WORLD_SEG - skip;
+        if (x + n > (int16_t)m->w) {
+            n = (uint8_t)(m->w - x);
+        }
+        if (n > len) {
+            n = len;
+        }
+        x += n;
+        len -= n;
+
+        // Walk the runs up to x, then copy out
+        while (n) {
+            ctl = *p++;
+            run = ctl < 0x80 ? ctl + 1 : ctl - 0x7F;
+            if (skip >= run) {
+                skip -= run;
+                p += ctl < 0x80 ? run : 1;
+                continue;
+            }
+            if (ctl < 0x80) {
+                p += skip;
+            }
+            run -= skip;
+            skip = 0;
+            if (run > n) {
+                run = n;
+            }
+            n -= run;
+            if (ctl < 0x80) {
+                while (run--) {
+                    *tiles++ = *p++;
+                }
+            } else {
+                tile = *p++;
+                while (run--) {
+                    *tiles++ = tile;
+                }
+            }
+        }
+    }
+}
+
+// Tile at x,y, or -1 off the map
+int16_t world_tile(const world_map* m, int16_t x, int16_t y) {
+    uint8_t tile;
+
+    if (!m->data || y < 0 || y >= (int16_t)m->h || x < 0 || x >= (int16_t)m->w) {
+        return -1;
+    }
+    world_row(m, x, y, 1, &tile);
+    return tile;
+}
+
+// Move the camera (pixels, clamped to the map); the ring follows at the
+// next world_stream
+void world_scroll(world_map* m, int16_t x, int16_t y) {
+    int16_t max_x = (int16_t)(m->w * 8) - 160;
+    int16_t max_y = (int16_t)(m->h * 8) - 144;
+
+    if (x > max_x) x = max_x;
+    if (y > max_y) y = max_y;
+    if (x < 0) x = 0;
+    if (y < 0) y = 0;
+    m->cam_x = x;
+    m->cam_y = y;
+}
+
+// Write rows [y0, y0 + count) of the window at column tx into the ring
+static void stream_rows(const world_map* m, int16_t y0, uint8_t count, void* ctx, world_put_fn put) {
+    uint8_t tiles[WORLD_VIEW_W];
+    uint8_t rx, first;
+
+    rx = (uint8_t)(m->tx & (WORLD_RING - 1));
+    first = WORLD_RING - rx;  // Columns before the ring wraps
+    for (; count; count--, y0++) {
+        world_row(m, m->tx, y0, WORLD_VIEW_W, tiles);
+        if (first >= WORLD_VIEW_W) {
+            put(ctx, rx, y0 & (WORLD_RING - 1), WORLD_VIEW_W, 1, tiles);
+        } else {
+            put(ctx, rx, y0 & (WORLD_RING - 1), first, 1, tiles);
+            put(ctx, 0, y0 & (WORLD_RING - 1), WORLD_VIEW_W - first, 1, tiles + first);
+        }
+    }
+}
+
+// Write columns [x0, x0 + count) of the window at row ty into the ring
+static void stream_cols(const world_map* m, int16_t x0, uint8_t count, void* ctx, world_put_fn put) {
+    uint8_t tiles[WORLD_VIEW_H];
+    uint8_t ry, first, i;
+
+    ry = (uint8_t)(m->ty & (WORLD_RING - 1));
+    first = WORLD_RING - ry;  // Rows before the ring wraps
+    for (; count; count--, x0++) {
+        for (i = 0; i < WORLD_VIEW_H; i++) {
+            world_row(m, x0, m->ty + i, 1, &tiles[i]);
+        }
+        if (first >= WORLD_VIEW_H) {
+            put(ctx, x0 & (WORLD_RING - 1), ry, 1, WORLD_VIEW_H, tiles);
+        } else {
+            put(ctx, x0 & (WORLD_RING - 1), ry, 1, first, tiles);
+            put(ctx, x0 & (WORLD_RING - 1), 0, 1, WORLD_VIEW_H - first, tiles + first);
+        }
+    }
+}
+
+// Bring the ring up to the camera (call at VBlank, then set SCX/SCY to
+// the low byte of cam_x/cam_y)
+// Columns the camera exposed are written for the rows already held, then
+// rows for the new columns; a move that would cost more than the whole
+// window reloads it instead.
+void world_stream(world_map* m, void* ctx, world_put_fn put) {
+    int16_t tx, ty, dx, dy, adx, ady;
+
+    if (!m->data) {
+        return;
+    }
+    tx = m->cam_x >> 3;
+    ty = m->cam_y >> 3;
+    dx = tx - m->tx;
+    dy = ty - m->ty;
+    adx = dx < 0 ? -dx : dx;
+    ady = dy < 0 ? -dy : dy;
+
+    if (!m->loaded || adx >= WORLD_VIEW_W || ady >= WORLD_VIEW_H ||
+        adx * WORLD_VIEW_H + ady * WORLD_VIEW_W > WORLD_VIEW_W * WORLD_VIEW_H) {
+        m->tx = tx;
+        m->ty = ty;
+        stream_rows(m, ty, WORLD_VIEW_H, ctx, put);
+        m->loaded = 1;
+        return;
+    }
+
+    if (dx > 0) {
+        stream_cols(m, m->tx + WORLD_VIEW_W, (uint8_t)dx, ctx, put);
+    } else if (dx < 0) {
+        stream_cols(m, tx, (uint8_t)-dx, ctx, put);
+    }
+    m->tx = tx;
+    if (dy > 0) {
+        stream_rows(m, m->ty + WORLD_VIEW_H, (uint8_t)dy, ctx, put);
+    } else if (dy < 0) {
+        stream_rows(m, ty, (uint8_t)-dy, ctx, put);
+    }
+    m->ty = ty;
+}
@@ -0,0 +1,345 @@
+/**
+ * mrbz - Minimal Ruby for Game Boy
+ * Host batch runner: plays many headless games across all cores
+ *
+ * Usage: mrbz-batch [options] program.mrb
+ *   --runs N       games to play (default 1000)
+ *   --seed N       random seed of the first game; game i uses seed + i
+ *   --frames N     frame limit per game (default 3600)
+ *   --scripts FILE input scripts, one per line; game i uses line i % count
+ *   --threads N    worker threads (default: one per online CPU)
+ *   --csv          print one line per game
+ *
+ * Every game gets its own VM and simulated machine, so runs share nothing
+ * but the read-only bytecode. Games are split into one contiguous block per
+ * worker; a worker takes games from the back of its own block and, once it
+ * runs dry, steals from the front of the others, so uneven game lengths
+ * still keep every core busy.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "host.h"
+#include "../gb/platform.h"
+#include "../mrbz/vm.h"
+
+// Opcodes listed in the summary
+#define TOP_OPS 10
+
+// Outcome of one game
+typedef struct {
+    int16_t score;
+    uint8_t game_over;
+    uint8_t error;
+    uint32_t frames;
+} run_result;
+
+// Per-thread state; games [head, tail) are still to be played
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t steals;                 // Games taken from other workers
+    mrbz_vm vm;
+    host_ctx machine;
+#if MRBZ_STATS
+    uint64_t ops[MRBZ_OP_COUNT];     // Instructions executed, all games
+#endif
+} worker;
+
+// Batch configuration, shared read-only by the workers
+static const uint8_t* bytecode;
+static uint32_t frame_limit = 3600;
+static uint16_t first_seed = 1;
+static char** scripts;
+static uint32_t script_count;
+static run_result* results;
+static worker** workers;
+static uint32_t worker_count;
+
+// Read a whole file into memory, NUL-terminated (caller frees)
+static char* read_file(const char* path, long* size) {
+    FILE* f;
+    char* buf;
+
+    f = fopen(path, "rb");
+    if (!f) {
+        return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(*size + 1);
+    if (buf && fread(buf, 1, *size, f) != (size_t)*size) {
+        free(buf);
+        buf = 0;
+    }
+    if (buf) {
+        buf[*size] = 0;
+    }
+    fclose(f);
+    return buf;
+}
+
+// Split a scripts file into lines in place
+static void split_scripts(char* text) {
+    char* line = text;
+    char* nl;
+
+    while (*line) {
+        nl = strchr(line, '\n');
+        if (nl) {
+            *nl = 0;
+        }
+        scripts = realloc(scripts, (script_count + 1) * sizeof(char*));
+        scripts[script_count++] = line;
+        if (!nl) {
+            break;
+        }
+        line = nl + 1;
+    }
+}
+
+// Take the next game from the back of our own block
+static int take_own(worker* w, uint32_t* run) {
+    int ok = 0;
+
+    pthread_mutex_lock(&w->lock);
+    if (w->head < w->tail) {
+        *run = --w->tail;
+        ok = 1;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return ok;
+}
+
+// Steal a game from the front of another worker's block
+static int steal(worker* self, uint32_t* run) {
+    uint32_t i;
+    worker* victim;
+    int ok;
+
+    for (i = 0; i < worker_count; i++) {
+        victim = workers[i];
+        if (victim == self) {
+            continue;
+        }
+        ok = 0;
+        pthread_mutex_lock(&victim->lock);
+        if (victim->head < victim->tail) {
+            *run = victim->head++;
+            ok = 1;
+        }
+        pthread_mutex_unlock(&victim->lock);
+        if (ok) {
+            self->steals++;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Play one game on a worker's VM
+static void play(worker* w, uint32_t run) {
+    mrbz_value result;
+    run_result* r = &results[run];
+    uint8_t i;
+
+    mrbz_vm_init(&w->vm);
+    host_reset(&w->machine, &w->vm);
+    w->machine.frame_limit = frame_limit;
+    w->machine.script = script_count ? scripts[run % script_count] : 0;
+    rand_seed(&w->machine.rand_state, (uint16_t)(first_seed + run));
+
+    mrbz_vm_run(&w->vm, &result, bytecode);
+
+    r->score = w->machine.score;
+    r->game_over = w->machine.game_over;
+    r->error = w->vm.error;
+    r->frames = w->machine.frames;
+#if MRBZ_STATS
+    for (i = 0; i < MRBZ_OP_COUNT; i++) {
+        w->ops[i] += w->vm.stats.ops[i];
+    }
+#else
+    (void)i;
+#endif
+}
+
+// Worker thread: drain our own block, then help the others
+static void* worker_main(void* arg) {
+    worker* w = arg;
+    uint32_t run;
+
+    while (take_own(w, &run) || steal(w, &run)) {
+        play(w, run);
+    }
+    return 0;
+}
+
+// Wall-clock seconds
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Print totals over all games
+static void report(uint32_t runs, double secs) {
+    uint64_t frames = 0, steals = 0;
+    int64_t score_sum = 0;
+    int16_t score_min = 0x7FFF, score_max = -0x8000;
+    uint32_t game_overs = 0, errors = 0;
+    uint32_t i;
+#if MRBZ_STATS
+    uint64_t ops[MRBZ_OP_COUNT];
+    uint64_t total_ops = 0;
+    uint32_t j, best;
+#endif
+
+    for (i = 0; i < runs; i++) {
+        frames += results[i].frames;
+        score_sum += results[i].score;
+        if (results[i].score < score_min) score_min = results[i].score;
+        if (results[i].score > score_max) score_max = results[i].score;
+        game_overs += results[i].game_over;
+        errors += results[i].error != MRBZ_ERR_NONE;
+    }
+    for (i = 0; i < worker_count; i++) {
+        steals += workers[i]->steals;
+    }
+
+    printf("runs: %u  threads: %u  time: %.3fs  (%.1f runs/s, %.2f Mframes/s)\n",
+           runs, worker_count, secs, runs / secs, frames / secs / 1e6);
+    printf("score: mean %.2f  min %d  max %d  game_over: %u  errors: %u\n",
+           (double)score_sum / runs, score_min, score_max, game_overs, errors);
+    printf("frames: %llu  mean %.1f  steals: %llu\n",
+           (unsigned long long)frames, (double)frames / runs, (unsigned long long)steals);
+
+#if MRBZ_STATS
+    memset(ops, 0, sizeof(ops));
+    for (i = 0; i < worker_count; i++) {
+        for (j = 0; j < MRBZ_OP_COUNT; j++) {
+            ops[j] += workers[i]->ops[j];
+        }
+    }
+    for (j = 0; j < MRBZ_OP_COUNT; j++) {
+        total_ops += ops[j];
+    }
+    printf("instructions: %llu (%.1f M/s)\n",
+           (unsigned long long)total_ops, total_ops / secs / 1e6);
+    for (i = 0; i < TOP_OPS; i++) {
+        best = 0;
+        for (j = 1; j < MRBZ_OP_COUNT; j++) {
+            if (ops[j] > ops[best]) best = j;
+        }
+        if (!ops[best]) break;
+        printf("  %-10s  %12llu  %5.1f%%\n", host_op_name((uint8_t)best),
+               (unsigned long long)ops[best], 100.0 * ops[best] / total_ops);
+        ops[best] = 0;
+    }
+#endif
+}
+
+int main(int argc, char** argv) {
+    const char* path = 0;
+    const char* scripts_path = 0;
+    char* text = 0;
+    uint32_t runs = 1000;
+    uint32_t i;
+    uint8_t csv = 0;
+    long size;
+    double start, secs;
+    int n;
+
+    worker_count = 0;
+    for (n = 1; n < argc; n++) {
+        if (!strcmp(argv[n], "--runs") && n + 1 < argc) {
+            runs = strtoul(argv[++n], 0, 0);
+        } else if (!strcmp(argv[n], "--seed") && n + 1 < argc) {
+            first_seed = (uint16_t)strtoul(argv[++n], 0, 0);
+        } else if (!strcmp(argv[n], "--frames") && n + 1 < argc) {
+            frame_limit = strtoul(argv[++n], 0, 0);
+        } else if (!strcmp(argv[n], "--scripts") && n + 1 < argc) {
+            scripts_path = argv[++n];
+        } else if (!strcmp(argv[n], "--threads") && n + 1 < argc) {
+            worker_count = strtoul(argv[++n], 0, 0);
+        } else if (!strcmp(argv[n], "--csv")) {
+            csv = 1;
+        } else {
+            path = argv[n];
+        }
+    }
+    if (!path || runs == 0) {
+        fprintf(stderr, "usage: %s [--runs N] [--seed N] [--frames N] [--scripts FILE] "
+                        "[--threads N] [--csv] program.mrb\n", argv[0]);
+        return 2;
+    }
+
+    bytecode = (const uint8_t*)read_file(path, &size);
+    if (!bytecode) {
+        fprintf(stderr, "%s: cannot read %s\n", argv[0], path);
+        return 1;
+    }
+    if (scripts_path) {
+        text = read_file(scripts_path, &size);
+        if (!text) {
+            fprintf(stderr, "%s: cannot read %s\n", argv[0], scripts_path);
+            return 1;
+        }
+        split_scripts(text);
+    }
+
+    if (worker_count == 0) {
+        n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = n > 0 ? n : 1;
+    }
+    if (worker_count > runs) {
+        worker_count = runs;
+    }
+
+    results = calloc(runs, sizeof(run_result));
+    workers = calloc(worker_count, sizeof(worker*));
+    for (i = 0; i < worker_count; i++) {
+        // Separate allocations keep each worker's hot state apart
+        workers[i] = calloc(1, sizeof(worker));
+        pthread_mutex_init(&workers[i]->lock, 0);
+        workers[i]->head = (uint32_t)((uint64_t)runs * i / worker_count);
+        workers[i]->tail = (uint32_t)((uint64_t)runs * (i + 1) / worker_count);
+    }
+
+    start = now();
+    for (i = 0; i < worker_count; i++) {
+        pthread_create(&workers[i]->thread, 0, worker_main, workers[i]);
+    }
+    for (i = 0; i < worker_count; i++) {
+        pthread_join(workers[i]->thread, 0);
+    }
+    secs = now() - start;
+
+    if (csv) {
+        printf("run,seed,score,frames,game_over,error\n");
+        for (i = 0; i < runs; i++) {
+            printf("%u,%u,%d,%u,%u,%u\n", i, (uint16_t)(first_seed + i),
+                   results[i].score, results[i].frames,
+                   results[i].game_over, results[i].error);
+        }
+    }
+    report(runs, secs);
+
+    for (i = 0; i < worker_count; i++) {
+        pthread_mutex_destroy(&workers[i]->lock);
+        free(workers[i]);
+    }
+    free(workers);
+    free(results);
+    free(scripts);
+    free(text);
+    free((void*)bytecode);
+    return 0;
+}
@@ -0,0 +1,496 @@
+/**
+ * mrbz - Minimal Ruby for Game Boy
+ * Bytecode checker: lists instructions the VM does not implement
+ *
+ * Usage: mrbz-check [--coverage] [--config FILE] program.mrb...
+ *   --coverage     also print every opcode the program uses, with counts,
+ *                  the global variables and the lowered compare chains
+ *   --config FILE  write a VM configuration header sized for the program
+ *                  (with several programs, big enough for all of them)
+ *                  that also strips the opcode handlers and builtins no
+ *                  program uses
+ *
+ * Prints one line per unsupported instruction with its IREP, bytecode
+ * offset, symbol operand and the next method called near it, so the
+ * Ruby line is easy to find. Exits with status 1 if any program fails;
+ * the ROM targets in the Makefile run this (writing the ROM's
+ * mrbz_config.h) before linking.
+ *
+ * The Makefile builds this tool with roomy tables, so it loads programs
+ * that outgrow the default sizes and can size a header for them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host.h"
+#include "../mrbz/opcodes.h"
+#include "../mrbz/vm.h"
+
+// Read a whole file into memory (caller frees)
+static uint8_t* read_file(const char* path, long* size) {
+    FILE* f;
+    uint8_t* buf;
+
+    f = fopen(path, "rb");
+    if (!f) {
+        return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(*size);
+    if (buf && fread(buf, 1, *size, f) != (size_t)*size) {
+        free(buf);
+        buf = 0;
+    }
+    fclose(f);
+    return buf;
+}
+
+// mrbz_vm_verify callback: one diagnostic line per instruction
+static void print_bad(mrbz_vm* vm, const mrbz_bad_op* bad, void* user) {
+    const char* path = user;
+    const mrbz_irep* irep = &vm->ireps[bad->irep];
+
+    printf("%s: irep %u pc %u (+%u): unsupported OP_%s", path, bad->irep,
+           bad->pc, bad->pc - irep->insns, host_op_name(bad->op));
+    if (bad->op >= MRBZ_OP_COUNT) {
+        printf(" (0x%02X)", bad->op);
+    }
+    if (bad->sym != 0xFF) {
+        printf(" %s", mrbz_get_symbol(vm, bad->sym));
+    }
+    if (bad->call != 0xFF) {
+        printf(", before call to '%s'", mrbz_get_symbol(vm, bad->call));
+    }
+    printf("\n");
+}
+
+// Count the opcodes used by a loaded program and print them
+static void print_coverage(mrbz_vm* vm, const char* path) {
+    uint32_t counts[MRBZ_OP_COUNT];
+    const mrbz_irep* irep;
+    uint16_t pc;
+    uint8_t i, op, len;
+    int op_i;
+
+    memset(counts, 0, sizeof(counts));
+    for (i = 0; i < vm->irep_count; i++) {
+        irep = &vm->ireps[i];
+        for (pc = irep->insns; pc < irep->end; pc += len) {
+            op = vm->bytecode[pc];
+            len = mrbz_op_length(op);
+            if (len == 0) break;
+            counts[op]++;
+        }
+    }
+
+    printf("%s: opcodes used\n", path);
+    for (op_i = 0; op_i < MRBZ_OP_COUNT; op_i++) {
+        if (counts[op_i]) {
+            printf("  %-12s %6u%s\n", host_op_name((uint8_t)op_i), counts[op_i],
+                   mrbz_op_supported((uint8_t)op_i) ? "" : "  unsupported");
+        }
+    }
+
+    // Compare chains dispatched through a table
+    for (i = 0; i < vm->switch_count; i++) {
+        printf("  jump table at pc %u: %u %s tests%s\n", vm->switches[i].test_pc[0],
+               vm->switches[i].count, vm->switches[i].type == MRBZ_T_SYMBOL ? "Symbol" : "Integer",
+               vm->switches[i].eqq ? " (case/when)" : "");
+    }
+
+    // Globals the optimizer may treat as constants after startup
+    for (i = 0; i < vm->sym_count; i++) {
+        if (vm->sym_global[i] != MRBZ_GLOBAL_NONE) {
+            printf("  global %-12s slot %2u%s\n", mrbz_get_symbol(vm, i), vm->sym_global[i],
+                   (vm->global_flags[vm->sym_global[i]] & MRBZ_GV_CONST) ? "  constant" : "");
+        }
+    }
+}
+
+// Table sizes a program needs, accumulated over every checked program
+// (0 for sizes kept at their vm.h default)
+typedef struct {
+    unsigned regs, symbols, irep_syms, ireps, pool;
+    unsigned ivars, consts, globals, scratch, switches;
+    unsigned fibers, fiber_regs, block_regs, array_len;
+    uint8_t array_len_known;    // Every Array.new has a literal size
+} vm_sizes;
+
+static vm_sizes sizes = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 };
+
+// Opcodes and builtins some checked program uses (everything else is
+// stripped from the ROM's interpreter)
+static uint8_t ops_used[MRBZ_OP_COUNT];
+static uint8_t builtins_used[256];
+
+static void grow(unsigned* size, unsigned need) {
+    if (need > *size) {
+        *size = need;
+    }
+}
+
+// True if symbol idx is name
+static uint8_t sym_is(mrbz_vm* vm, uint8_t idx, const char* name) {
+    return idx < vm->sym_count && !strcmp(mrbz_get_symbol(vm, idx), name);
+}
+
+// Registers blocks need when nested as deep as the IREP tree allows
+// (Range#each inside Range#each takes the next register window up)
+static unsigned block_depth_regs(mrbz_vm* vm, uint8_t idx) {
+    const mrbz_irep* irep = &vm->ireps[idx];
+    const uint8_t* ip;
+    unsigned deepest = 0;
+    uint16_t pc, len;
+
+    for (pc = irep->insns; pc < irep->end; pc += len) {
+        ip = vm->bytecode + pc;
+        len = mrbz_op_length(ip[0]);
+        if (len == 0) break;
+        if (ip[0] == OP_BLOCK || ip[0] == OP_LAMBDA) {
+            grow(&deepest, block_depth_regs(vm, vm->irep_kids[irep->kids + ip[2]]));
+        }
+    }
+    return (idx ? irep->nregs : 0) + deepest;
+}
+
+// What scan_irep knows a register holds, besides an Integer literal
+#define KIND_NONE        0
+#define KIND_ARRAY_CLASS 1
+#define KIND_HASH_CLASS  2
+#define KIND_HASH        3
+#define KIND_SYMBOL      4
+
+// Scan an IREP for the table sizes it needs: instance variables and
+// constants it names, and the length of every array it builds
+// Array.new sizes and the indexes arrays are stored at count when they are
+// Integer literals loaded in the same basic block; anything else keeps the
+// default array length. A store past the end grows an array (up to its
+// capacity), so a[5] = x needs room for six values whatever a started as.
+static void scan_irep(mrbz_vm* vm, uint8_t idx, uint8_t* ivar_syms, uint8_t* const_syms) {
+    const mrbz_irep* irep = &vm->ireps[idx];
+    const uint8_t* syms = &vm->irep_syms[irep->syms];
+    const uint8_t* ip;
+    uint8_t* target;
+    int32_t known[256];         // Integer literal in each register, or -1
+    uint8_t kind[256];          // What else is known of each register (KIND_*)
+    uint16_t pc, len, dest;
+    uint8_t op, a, argc;
+    int n;
+
+    // Basic blocks start at jump targets
+    target = calloc(irep->end + 4, 1);
+    for (pc = irep->insns; pc < irep->end; pc += len) {
+        ip = vm->bytecode + pc;
+        len = mrbz_op_length(ip[0]);
+        if (len == 0) break;
+        if (ip[0] == OP_JMP) {
+            dest = pc + len + (int16_t)((ip[1] << 8) | ip[2]);
+        } else if (ip[0] == OP_JMPIF || ip[0] == OP_JMPNOT || ip[0] == OP_JMPNIL) {
+            dest = pc + len + (int16_t)((ip[2] << 8) | ip[3]);
+        } else {
+            continue;
+        }
+        if (dest < irep->end) target[dest] = 1;
+    }
+
+    for (n = 0; n < 256; n++) {
+        known[n] = -1;
+        kind[n] = KIND_NONE;
+    }
+    for (pc = irep->insns; pc < irep->end; pc += len) {
+        ip = vm->bytecode + pc;
+        op = ip[0];
+        a = ip[1];
+        len = mrbz_op_length(op);
+        if (len == 0) break;
+        if (target[pc]) {
+            for (n = 0; n < 256; n++) {
+                known[n] = -1;
+                kind[n] = KIND_NONE;
+            }
+        }
+
+        if (mrbz_op_supported(op)) {
+            ops_used[op] = 1;
+        }
+
+        switch (op) {
+            case OP_GETIV:
+            case OP_SETIV:
+                ivar_syms[syms[ip[2]]] = 1;
+                break;
+            case OP_SETCONST:
+                const_syms[syms[ip[2]]] = 1;
+                break;
+            case OP_ARRAY:
+                grow(&sizes.array_len, ip[2]);
+                break;
+            case OP_ARRAY2:
+                grow(&sizes.array_len, ip[3]);
+                break;
+            case OP_HASH:
+                grow(&sizes.array_len, MRBZ_HASH_SLOTS * 2);
+                break;
+            case OP_ASET:
+                grow(&sizes.array_len, ip[3] + 1u);
+                break;
+            case OP_SETIDX:
+                // A Hash has fixed slots, and only a Hash takes Symbol keys
+                if (kind[a] == KIND_HASH || kind[a + 1] == KIND_SYMBOL) {
+                    break;
+                }
+                if (known[a + 1] >= 0) {
+                    grow(&sizes.array_len, (unsigned)known[a + 1] + 1);
+                } else {
+                    sizes.array_len_known = 0;
+                }
+                break;
+            case OP_SEND:
+            case OP_SSEND:
+                argc = ip[3] & 0x0F;
+                if (kind[a] == KIND_ARRAY_CLASS && sym_is(vm, syms[ip[2]], "new")) {
+                    if (argc >= 1 && argc != 15 && known[a + 1] >= 0) {
+                        grow(&sizes.array_len, (unsigned)known[a + 1]);
+                    } else {
+                        sizes.array_len_known = 0;
+                    }
+                }
+                break;
+            default:
+                break;
+        }
+
+        // Track Integer literals, Symbols, Hashes and the Array and Hash
+        // classes through registers
+        n = -1;
+        switch (op) {
+            case OP_LOADI_0: case OP_LOADI_1: case OP_LOADI_2: case OP_LOADI_3:
+            case OP_LOADI_4: case OP_LOADI_5: case OP_LOADI_6: case OP_LOADI_7:
+                n = op - OP_LOADI_0;
+                break;
+            case OP_LOADI:
+                n = ip[2];
+                break;
+            case OP_LOADI16:
+                n = (int16_t)((ip[2] << 8) | ip[3]);
+                break;
+            case OP_MOVE:
+                known[a] = known[ip[2]];
+                kind[a] = kind[ip[2]];
+                continue;
+            case OP_GETCONST:
+                known[a] = -1;
+                kind[a] = sym_is(vm, syms[ip[2]], "Array") ? KIND_ARRAY_CLASS :
+                          sym_is(vm, syms[ip[2]], "Hash") ? KIND_HASH_CLASS : KIND_NONE;
+                continue;
+            case OP_LOADSYM:
+                known[a] = -1;
+                kind[a] = KIND_SYMBOL;
+                continue;
+            case OP_HASH:
+                known[a] = -1;
+                kind[a] = KIND_HASH;
+                continue;
+            case OP_SEND:
+            case OP_SSEND:
+                known[a] = -1;
+                kind[a] = kind[a] == KIND_HASH_CLASS && sym_is(vm, syms[ip[2]], "new") ? KIND_HASH : KIND_NONE;
+                continue;
+            default:
+                break;
+        }
+        known[a] = n;
+        kind[a] = KIND_NONE;
+    }
+    free(target);
+}
+
+// Work out the table sizes a loaded program needs
+static void measure(mrbz_vm* vm) {
+    uint8_t ivar_syms[256], const_syms[256];
+    unsigned count, regs;
+    uint8_t i;
+
+    memset(ivar_syms, 0, sizeof(ivar_syms));
+    memset(const_syms, 0, sizeof(const_syms));
+    for (i = 0; i < vm->const_count; i++) {
+        const_syms[vm->const_syms[i]] = 1;  // Built-in classes it names
+    }
+    for (i = 0; i < vm->irep_count; i++) {
+        scan_irep(vm, i, ivar_syms, const_syms);
+    }
+
+    grow(&sizes.regs, vm->ireps[0].nregs);
+    grow(&sizes.symbols, vm->sym_count);
+    grow(&sizes.irep_syms, vm->irep_sym_count);
+    grow(&sizes.ireps, vm->irep_count);
+    grow(&sizes.pool, vm->pool_count);
+    grow(&sizes.globals, vm->global_count);
+    grow(&sizes.scratch, vm->scratch_count);
+    grow(&sizes.switches, vm->switch_count);
+    for (count = 0, i = 0; i < vm->sym_count; i++) {
+        count += ivar_syms[i];
+    }
+    grow(&sizes.ivars, count);
+    for (count = 0, i = 0; i < vm->sym_count; i++) {
+        count += const_syms[i];
+    }
+    grow(&sizes.consts, count);
+
+    if (mrbz_find_symbol(vm, "Hash") != 0xFF) {
+        grow(&sizes.array_len, MRBZ_HASH_SLOTS * 2);  // Hash.new
+    }
+
+    // Builtins resolved for the program's symbols
+    for (i = 0; i < vm->sym_count; i++) {
+        if (vm->sym_builtin[i] != MRBZ_BUILTIN_NONE) {
+            builtins_used[vm->sym_builtin[i]] = 1;
+        }
+    }
+
+    // Fibers can run any block; without Fiber there are none
+    if (mrbz_find_symbol(vm, "Fiber") != 0xFF) {
+        sizes.fibers = MRBZ_FIBER_NONE;  // Marks "keep the default count"
+        for (regs = 0, i = 1; i < vm->irep_count; i++) {
+            grow(&regs, vm->ireps[i].nregs);
+        }
+        grow(&sizes.fiber_regs, regs);
+    }
+    if (mrbz_find_symbol(vm, "each") != 0xFF || mrbz_find_symbol(vm, "step") != 0xFF ||
+        mrbz_find_symbol(vm, "reverse_each") != 0xFF) {
+        grow(&sizes.block_regs, block_depth_regs(vm, 0));
+    }
+}
+
+// One configuration line; tables never get fewer than one entry
+static void config_line(FILE* f, const char* name, unsigned n, const char* what) {
+    fprintf(f, "#define %-18s %-5u // %s\n", name, n ? n : 1, what);
+}
+
+// Write the configuration header for everything measured so far
+static int write_config(const char* path, const char* programs) {
+    FILE* f = fopen(path, "w");
+    uint8_t bitmap[(MRBZ_OP_COUNT + 7) / 8];
+    int op;
+
+    if (!f) {
+        fprintf(stderr, "mrbz-check: cannot write %s\n", path);
+        return 1;
+    }
+    fprintf(f, "/**\n * mrbz - Minimal Ruby for Game Boy\n"
+               " * VM table sizes and opcodes for %s\n *\n"
+               " * Generated by mrbz-check --config; do not edit.\n */\n\n", programs);
+    fprintf(f, "#ifndef MRBZ_CONFIG_H\n#define MRBZ_CONFIG_H\n\n");
+    config_line(f, "MRBZ_MAX_REGS", sizes.regs, "Top-level registers");
+    config_line(f, "MRBZ_MAX_SYMBOLS", sizes.symbols, "Symbols");
+    config_line(f, "MRBZ_MAX_IREP_SYMS", sizes.irep_syms, "Symbol slots summed over all IREPs");
+    config_line(f, "MRBZ_MAX_IREPS", sizes.ireps, "Top level + blocks");
+    config_line(f, "MRBZ_MAX_POOL", sizes.pool, "Literal pool entries");
+    config_line(f, "MRBZ_MAX_IVARS", sizes.ivars, "Instance variables named");
+    config_line(f, "MRBZ_MAX_CONSTS", sizes.consts, "Constants assigned or built-in classes named");
+    config_line(f, "MRBZ_MAX_GLOBALS", sizes.globals, "Global variables");
+    config_line(f, "MRBZ_MAX_SCRATCH", sizes.scratch, "Non-escaping array literal sites");
+    config_line(f, "MRBZ_MAX_SWITCHES", sizes.switches, "Compare chains lowered to jump tables");
+    if (sizes.fibers == 0) {
+        config_line(f, "MRBZ_MAX_FIBERS", 1, "No Fiber.new");
+    }
+    config_line(f, "MRBZ_FIBER_REGS", sizes.fiber_regs, "Registers of the largest block");
+    config_line(f, "MRBZ_BLOCK_REGS", sizes.block_regs, "Registers of the deepest Range block nesting");
+    if (sizes.array_len_known) {
+        config_line(f, "MRBZ_MAX_ARRAY_LEN", sizes.array_len, "Longest array built");
+    } else {
+        fprintf(f, "// MRBZ_MAX_ARRAY_LEN: default, an Array.new size or a stored index isn't a literal\n");
+    }
+
+    // Dead-code stripping: only what the programs use is compiled in
+    fprintf(f, "\n#define MRBZ_STRIP 1\n");
+    memset(bitmap, 0, sizeof(bitmap));
+    for (op = 0; op < MRBZ_OP_COUNT; op++) {
+        if (ops_used[op]) {
+            fprintf(f, "#define MRBZ_USE_OP_%s 1\n", host_op_name((uint8_t)op));
+            bitmap[op >> 3] |= (uint8_t)(1 << (op & 7));
+        }
+    }
+    fprintf(f, "#define MRBZ_OPS_USED {");
+    for (op = 0; op < (int)sizeof(bitmap); op++) {
+        fprintf(f, "%s0x%02X", op ? ", " : " ", bitmap[op]);
+    }
+    fprintf(f, " }\n");
+    for (op = 0; op < mrbz_builtin_count(); op++) {
+        if (builtins_used[op]) {
+            fprintf(f, "#define MRBZ_USE_BI_%s 1\n", mrbz_builtin_key((uint8_t)op));
+        }
+    }
+    fprintf(f, "\n#endif // MRBZ_CONFIG_H\n");
+    fclose(f);
+    return 0;
+}
+
+// Check one program; returns the number of unsupported instructions
+static int check_file(const char* path, uint8_t coverage) {
+    static mrbz_vm vm;
+    uint8_t* bytecode;
+    long size;
+    int bad;
+
+    bytecode = read_file(path, &size);
+    if (!bytecode) {
+        fprintf(stderr, "mrbz-check: cannot read %s\n", path);
+        return 1;
+    }
+    if (size < 32 || memcmp(bytecode, "RITE0300", 8) != 0) {
+        fprintf(stderr, "mrbz-check: %s is not RITE0300 bytecode\n", path);
+        free(bytecode);
+        return 1;
+    }
+
+    mrbz_vm_init(&vm);
+    mrbz_vm_load(&vm, bytecode);
+    bad = mrbz_vm_verify(&vm, print_bad, (void*)path);
+    if (coverage) {
+        print_coverage(&vm, path);
+    }
+    if (bad) {
+        printf("%s: %d unsupported instruction%s\n", path, bad, bad == 1 ? "" : "s");
+    }
+    if (vm.error == MRBZ_ERR_LIMIT) {
+        printf("%s: program outgrows the tables of this build\n", path);
+        bad++;
+    }
+    measure(&vm);
+
+    free(bytecode);
+    return bad;
+}
+
+int main(int argc, char** argv) {
+    const char* config = 0;
+    const char* programs = 0;
+    uint8_t coverage = 0;
+    int files = 0, failed = 0;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--coverage")) {
+            coverage = 1;
+        } else if (!strcmp(argv[i], "--config") && i + 1 < argc) {
+            config = argv[++i];
+        } else {
+            files++;
+            programs = files == 1 ? argv[i] : "several programs";
+            failed += check_file(argv[i], coverage) != 0;
+        }
+    }
+    if (!files) {
+        fprintf(stderr, "usage: %s [--coverage] [--config FILE] program.mrb...\n", argv[0]);
+        return 2;
+    }
+    // No header for a program that can't run: the ROM build stops here
+    if (config && !failed) {
+        failed += write_config(config, programs);
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,613 @@
+/**
+ * mrbz - Minimal Ruby for Game Boy
+ * Differential fuzzer: mrbz against reference mruby
+ *
+ * Each input is turned into a small Ruby program within the supported
+ * subset (integer locals, arithmetic and bit operators, comparisons,
+ * if/else, bounded while loops, a three-element array). The program is
+ * compiled with mrbc and run on mrbz, and run on mruby with a line
+ * printing its results appended; the two outputs must match. A mismatch
+ * saves the program as a regression case and aborts, which is how both
+ * libFuzzer and AFL recognize a finding.
+ *
+ * Two differences are by design and kept out of the programs, so that a
+ * mismatch is always news:
+ *   - mrbz Integers are 16 bits and wrap. The copy of the program mruby
+ *     runs wraps every result that can leave that range (+, -, *, <<,
+ *     negation, abs) back into it, the same way.
+ *   - mrbz division truncates and doesn't raise. Dividends are masked
+ *     non-negative and divisors are literals from 1 to 15, where
+ *     truncating and flooring agree and nothing divides by zero.
+ * A saved case is the mrbz program (case-N.rb) and mruby's copy
+ * (case-N.ref.rb); a case without a .ref.rb runs unchanged on both.
+ *
+ * Builds:
+ *   make fuzz                       standalone / AFL (HOST_CC=afl-clang-fast)
+ *   make fuzz-libfuzzer             clang -fsanitize=fuzzer
+ *
+ * Standalone usage: mrbz-fuzz [options] [input]
+ *   input           fuzz input file (default: stdin), one program per run
+ *   --gen FILE      print the program generated from FILE and exit
+ *   --gen-ref FILE  print mruby's copy of it and exit
+ *   --random N      run N programs from random inputs
+ *   --check DIR     rerun every saved case in DIR, exit 1 on any mismatch
+ *
+ * Environment: MRBC and MRUBY name the reference tools (default mrbc and
+ * mruby), MRBZ_FUZZ_CASES the directory for new cases (default fuzz-cases).
+ */
+
+#include <dirent.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "host.h"
+#include "../mrbz/vm.h"
+
+// Generator limits
+#define PROG_MAX    8192
+#define MAX_STMTS   12
+#define MAX_DEPTH   3
+#define LOOP_MAX    8
+#define NUM_VARS    4
+#define NUM_RESULTS 6
+
+// Instruction budget per program (generated loops are bounded, so running
+// out means mrbz is stuck)
+#define RUN_BUDGET  50000
+
+// Result line length
+#define OUT_MAX     256
+
+static const char* const var_names[NUM_VARS] = { "a", "b", "c", "d" };
+static const char* const bin_ops[] = { "+", "-", "*", "/", "%", "&", "|", "^" };
+
+// Operators whose result can leave 16 bits (see bin_ops)
+#define WRAPS(op) ((op) < 3)
+#define DIVIDES(op) ((op) == 3 || (op) == 4)
+static const char* const cmp_ops[] = { "==", "!=", "<", ">", "<=", ">=" };
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+// Input bytes consumed by the generator (zeros once exhausted)
+typedef struct {
+    const uint8_t* data;
+    size_t size;
+    size_t pos;
+} byte_src;
+
+// Program text under construction
+typedef struct {
+    char text[PROG_MAX];
+    size_t len;
+    uint8_t loops;      // Loop counters used so far
+    uint8_t reference;  // mruby's copy: wrap results to 16 bits
+} prog;
+
+static uint8_t next_byte(byte_src* in) {
+    return in->pos < in->size ? in->data[in->pos++] : 0;
+}
+
+static void emit(prog* p, const char* fmt, ...) {
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(p->text + p->len, PROG_MAX - p->len, fmt, ap);
+    va_end(ap);
+    if (n > 0) {
+        p->len += (size_t)n;
+        if (p->len >= PROG_MAX) {
+            p->len = PROG_MAX - 1;
+        }
+    }
+}
+
+// Bracket an expression that can overflow; mruby's copy brings it back
+// into 16 bits as mrbz's arithmetic does
+static void wrap_open(prog* p) {
+    if (p->reference) {
+        emit(p, "(((");
+    }
+}
+
+static void wrap_close(prog* p) {
+    if (p->reference) {
+        emit(p, " + 32768) & 65535) - 32768)");
+    }
+}
+
+static void indent(prog* p, uint8_t depth) {
+    uint8_t i;
+    for (i = 0; i < depth; i++) {
+        emit(p, "  ");
+    }
+}
+
+static void gen_expr(byte_src* in, prog* p, uint8_t depth);
+
+// Leaf: small literal, local or array element
+static void gen_leaf(byte_src* in, prog* p) {
+    uint8_t b = next_byte(in);
+
+    switch (b % 4) {
+        case 0:
+            emit(p, "%d", (int)(next_byte(in) % 120) - 20);
+            break;
+        case 1:
+        case 2:
+            emit(p, "%s", var_names[next_byte(in) % NUM_VARS]);
+            break;
+        default:
+            emit(p, "arr[%d]", next_byte(in) % 3);
+            break;
+    }
+}
+
+static void gen_expr(byte_src* in, prog* p, uint8_t depth) {
+    uint8_t b = next_byte(in);
+    uint8_t op;
+
+    if (depth >= MAX_DEPTH || b < 96) {
+        gen_leaf(in, p);
+        return;
+    }
+    switch (b % 6) {
+        case 0:
+            wrap_open(p);
+            emit(p, "(-");
+            gen_expr(in, p, depth + 1);
+            emit(p, ")");
+            wrap_close(p);
+            break;
+        case 1:
+            wrap_open(p);
+            emit(p, "(");
+            gen_expr(in, p, depth + 1);
+            emit(p, ").abs");
+            wrap_close(p);
+            break;
+        case 2:
+            if (next_byte(in) & 1) {
+                wrap_open(p);
+                emit(p, "(");
+                gen_expr(in, p, depth + 1);
+                emit(p, " << %d)", next_byte(in) % 8);
+                wrap_close(p);
+            } else {
+                emit(p, "(");
+                gen_expr(in, p, depth + 1);
+                emit(p, " >> %d)", next_byte(in) % 8);
+            }
+            break;
+        default:
+            op = next_byte(in) % COUNT(bin_ops);
+            if (DIVIDES(op)) {
+                emit(p, "((");
+                gen_expr(in, p, depth + 1);
+                emit(p, " & 32767) %s %d)", bin_ops[op], next_byte(in) % 15 + 1);
+                break;
+            }
+            if (WRAPS(op)) {
+                wrap_open(p);
+            }
+            emit(p, "(");
+            gen_expr(in, p, depth + 1);
+            emit(p, " %s ", bin_ops[op]);
+            gen_expr(in, p, depth + 1);
+            emit(p, ")");
+            if (WRAPS(op)) {
+                wrap_close(p);
+            }
+            break;
+    }
+}
+
+static void gen_cond(byte_src* in, prog* p) {
+    gen_expr(in, p, 1);
+    emit(p, " %s ", cmp_ops[next_byte(in) % COUNT(cmp_ops)]);
+    gen_expr(in, p, 1);
+}
+
+static void gen_block(byte_src* in, prog* p, uint8_t depth);
+
+static void gen_stmt(byte_src* in, prog* p, uint8_t depth) {
+    uint8_t b = next_byte(in);
+    uint8_t k;
+
+    indent(p, depth);
+    if (depth < 3 && b >= 224) {
+        emit(p, "if ");
+        gen_cond(in, p);
+        emit(p, "\n");
+        gen_block(in, p, depth + 1);
+        indent(p, depth);
+        emit(p, "else\n");
+        gen_block(in, p, depth + 1);
+        indent(p, depth);
+        emit(p, "end\n");
+    } else if (depth < 2 && b >= 200) {
+        // Counters are never assigned in the body, so loops always end
+        k = p->loops++;
+        emit(p, "i%u = 0\n", k);
+        indent(p, depth);
+        emit(p, "while i%u < %d\n", k, next_byte(in) % LOOP_MAX + 1);
+        gen_block(in, p, depth + 1);
+        indent(p, depth + 1);
+        emit(p, "i%u += 1\n", k);
+        indent(p, depth);
+        emit(p, "end\n");
+    } else if (b >= 176) {
+        emit(p, "arr[%d] = ", next_byte(in) % 3);
+        gen_expr(in, p, 0);
+        emit(p, "\n");
+    } else {
+        emit(p, "%s = ", var_names[b % NUM_VARS]);
+        gen_expr(in, p, 0);
+        emit(p, "\n");
+    }
+}
+
+static void gen_block(byte_src* in, prog* p, uint8_t depth) {
+    uint8_t n = next_byte(in) % 3 + 1;
+    while (n--) {
+        gen_stmt(in, p, depth);
+    }
+}
+
+// Generate a program from fuzz input (mruby's copy if reference is set);
+// results end up in @r0..@r5
+static void generate(const uint8_t* data, size_t size, prog* p, uint8_t reference) {
+    byte_src in;
+    uint8_t i, n;
+
+    in.data = data;
+    in.size = size;
+    in.pos = 0;
+    p->len = 0;
+    p->loops = 0;
+    p->reference = reference;
+    p->text[0] = 0;
+
+    for (i = 0; i < NUM_VARS; i++) {
+        emit(p, "%s = %d\n", var_names[i], (int)(next_byte(&in) % 100));
+    }
+    emit(p, "arr = [a, b, c]\n");
+    n = next_byte(&in) % MAX_STMTS + 1;
+    while (n-- && in.pos < in.size) {
+        gen_stmt(&in, p, 0);
+    }
+    for (i = 0; i < NUM_VARS; i++) {
+        emit(p, "@r%u = %s\n", i, var_names[i]);
+    }
+    emit(p, "@r4 = ");
+    wrap_open(p);
+    emit(p, "arr[0] + arr[1] + arr[2]");
+    wrap_close(p);
+    emit(p, "\n");
+    emit(p, "@r5 = a < b\n");
+}
+
+// Scratch files for one process
+static char work_dir[64];
+static const char* const work_files[] = { "prog.rb", "prog.mrb", "ref.rb" };
+
+static void remove_work_dir(void) {
+    char path[128];
+    size_t i;
+
+    for (i = 0; i < COUNT(work_files); i++) {
+        snprintf(path, sizeof(path), "%s/%s", work_dir, work_files[i]);
+        unlink(path);
+    }
+    rmdir(work_dir);
+}
+
+static int ensure_work_dir(void) {
+    if (work_dir[0]) {
+        return 1;
+    }
+    snprintf(work_dir, sizeof(work_dir), "/tmp/mrbz-fuzz-XXXXXX");
+    if (!mkdtemp(work_dir)) {
+        work_dir[0] = 0;
+        return 0;
+    }
+    atexit(remove_work_dir);
+    return 1;
+}
+
+static const char* tool(const char* env, const char* def) {
+    const char* v = getenv(env);
+    return v && *v ? v : def;
+}
+
+// Read a whole file, NUL-terminated (caller frees)
+static char* read_file(const char* path, long* size) {
+    FILE* f;
+    char* buf;
+
+    f = fopen(path, "rb");
+    if (!f) {
+        return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(*size + 1);
+    if (buf && fread(buf, 1, *size, f) != (size_t)*size) {
+        free(buf);
+        buf = 0;
+    }
+    if (buf) {
+        buf[*size] = 0;
+    }
+    fclose(f);
+    return buf;
+}
+
+static int write_file(const char* path, const char* text) {
+    FILE* f = fopen(path, "w");
+    int ok;
+
+    if (!f) {
+        return 0;
+    }
+    ok = fputs(text, f) >= 0;
+    return fclose(f) == 0 && ok;
+}
+
+// Format a value the way Ruby's inspect does
+static void inspect(const mrbz_value* v, char* out, size_t cap) {
+    if (!v) {
+        snprintf(out, cap, "nil");
+        return;
+    }
+    switch (v->type) {
+        case MRBZ_T_NIL:   snprintf(out, cap, "nil"); break;
+        case MRBZ_T_TRUE:  snprintf(out, cap, "true"); break;
+        case MRBZ_T_FALSE: snprintf(out, cap, "false"); break;
+        case MRBZ_T_INT:   snprintf(out, cap, "%d", v->v.i); break;
+        case MRBZ_T_FIXED: snprintf(out, cap, "%g", v->v.i / (double)MRBZ_FIXED_ONE); break;
+        default:           snprintf(out, cap, "#<type %u>", v->type); break;
+    }
+}
+
+// Instance variable by name (NULL if never assigned)
+static const mrbz_value* ivar(mrbz_vm* vm, const char* name) {
+    uint8_t sym = mrbz_find_symbol(vm, name);
+    uint8_t i;
+
+    for (i = 0; i < vm->ivar_count; i++) {
+        if (vm->ivar_syms[i] == sym) {
+            return &vm->ivars[i];
+        }
+    }
+    return 0;
+}
+
+// Run a program through mrbc + mrbz; out gets "[r0, ..., r5]" or an error
+static void run_mrbz(const char* src, char* out) {
+    static mrbz_vm vm;
+    static host_ctx machine;
+    char rb[96], mrb[96], cmd[512], item[32];
+    uint8_t* bytecode;
+    long size;
+    uint8_t status, i;
+
+    snprintf(rb, sizeof(rb), "%s/prog.rb", work_dir);
+    snprintf(mrb, sizeof(mrb), "%s/prog.mrb", work_dir);
+    write_file(rb, src);
+    snprintf(cmd, sizeof(cmd), "%s -o %s %s 2>/dev/null", tool("MRBC", "mrbc"), mrb, rb);
+    if (system(cmd) != 0 || !(bytecode = (uint8_t*)read_file(mrb, &size))) {
+        snprintf(out, OUT_MAX, "mrbc failed");
+        return;
+    }
+
+    mrbz_vm_init(&vm);
+    host_reset(&machine, &vm);
+    mrbz_vm_load(&vm, bytecode);
+    status = mrbz_vm_step(&vm, RUN_BUDGET);
+    if (status == MRBZ_STEP_ERROR) {
+        snprintf(out, OUT_MAX, "mrbz error %u at pc %u", vm.error, vm.root.pc);
+    } else if (status != MRBZ_STEP_FINISHED) {
+        snprintf(out, OUT_MAX, "mrbz did not finish");
+    } else {
+        out[0] = 0;
+        strcat(out, "[");
+        for (i = 0; i < NUM_RESULTS; i++) {
+            snprintf(item, sizeof(item), "@r%u", i);
+            inspect(ivar(&vm, item), item, sizeof(item));
+            strcat(out, i ? ", " : "");
+            strcat(out, item);
+        }
+        strcat(out, "]");
+    }
+    free(bytecode);
+}
+
+// Run a program on reference mruby
+static void run_mruby(const char* src, char* out) {
+    char rb[96], cmd[512];
+    char* text;
+    FILE* f;
+    size_t n;
+
+    snprintf(rb, sizeof(rb), "%s/ref.rb", work_dir);
+    text = malloc(strlen(src) + 64);
+    sprintf(text, "%sp [@r0, @r1, @r2, @r3, @r4, @r5]\n", src);
+    write_file(rb, text);
+    free(text);
+
+    snprintf(cmd, sizeof(cmd), "%s %s 2>&1", tool("MRUBY", "mruby"), rb);
+    f = popen(cmd, "r");
+    if (!f) {
+        snprintf(out, OUT_MAX, "mruby failed");
+        return;
+    }
+    n = fread(out, 1, OUT_MAX - 1, f);
+    out[n] = 0;
+    pclose(f);
+    while (n && (out[n - 1] == '\n' || out[n - 1] == '\r')) {
+        out[--n] = 0;
+    }
+}
+
+// Run a program on mrbz and its reference copy on mruby; returns 1 if the
+// results match
+static int compare(const char* src, const char* ref, int verbose) {
+    char got[OUT_MAX], want[OUT_MAX];
+
+    run_mrbz(src, got);
+    run_mruby(ref, want);
+    if (strcmp(got, want) == 0) {
+        return 1;
+    }
+    if (verbose) {
+        fprintf(stderr, "mismatch\n  mruby: %s\n  mrbz:  %s\n", want, got);
+    }
+    return 0;
+}
+
+// Keep a mismatching program and its reference copy as a regression case
+static void save_case(const char* src, const char* ref) {
+    const char* dir = tool("MRBZ_FUZZ_CASES", "fuzz-cases");
+    char path[512];
+    uint32_t h = 2166136261u;
+    const char* c;
+
+    for (c = src; *c; c++) {
+        h = (h ^ (uint8_t)*c) * 16777619u;  // FNV-1a names the case
+    }
+    mkdir(dir, 0755);
+    snprintf(path, sizeof(path), "%s/case-%08x.ref.rb", dir, h);
+    write_file(path, ref);
+    snprintf(path, sizeof(path), "%s/case-%08x.rb", dir, h);
+    if (write_file(path, src)) {
+        fprintf(stderr, "saved %s\n", path);
+    }
+}
+
+// Fuzz one input: generate, compare, abort on a mismatch
+static void fuzz_one(const uint8_t* data, size_t size) {
+    static prog p, ref;
+
+    if (!ensure_work_dir()) {
+        return;
+    }
+    generate(data, size, &p, 0);
+    generate(data, size, &ref, 1);
+    if (!compare(p.text, ref.text, 1)) {
+        fprintf(stderr, "program:\n%s", p.text);
+        save_case(p.text, ref.text);
+        // abort skips atexit; clean up here so crashes do not litter /tmp
+        remove_work_dir();
+        abort();
+    }
+}
+
+#ifdef MRBZ_LIBFUZZER
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    fuzz_one(data, size);
+    return 0;
+}
+
+#else
+
+// Rerun every saved case in a directory
+static int check_dir(const char* path) {
+    DIR* dir;
+    struct dirent* e;
+    char file[1024];
+    char* src;
+    char* ref;
+    long size;
+    size_t len;
+    int failed = 0, total = 0;
+
+    dir = opendir(path);
+    if (!dir || !ensure_work_dir()) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return 2;
+    }
+    while ((e = readdir(dir)) != 0) {
+        len = strlen(e->d_name);
+        if (len < 3 || strcmp(e->d_name + len - 3, ".rb") != 0) continue;
+        if (len >= 7 && strcmp(e->d_name + len - 7, ".ref.rb") == 0) continue;
+        snprintf(file, sizeof(file), "%s/%s", path, e->d_name);
+        src = read_file(file, &size);
+        if (!src) continue;
+        snprintf(file, sizeof(file), "%s/%.*s.ref.rb", path, (int)(len - 3), e->d_name);
+        ref = read_file(file, &size);
+        total++;
+        if (compare(src, ref ? ref : src, 0)) {
+            printf("PASS %s\n", e->d_name);
+        } else {
+            printf("FAIL %s\n", e->d_name);
+            failed++;
+        }
+        free(ref);
+        free(src);
+    }
+    closedir(dir);
+    printf("%d of %d cases match mruby\n", total - failed, total);
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+    static uint8_t buf[4096];
+    static prog p;
+    const char* input = 0;
+    uint8_t* data;
+    long size = 0;
+    unsigned long runs, r;
+    size_t i;
+    FILE* f;
+
+    if (argc == 3 && !strcmp(argv[1], "--check")) {
+        return check_dir(argv[2]);
+    }
+    if (argc == 3 && (!strcmp(argv[1], "--gen") || !strcmp(argv[1], "--gen-ref"))) {
+        data = (uint8_t*)read_file(argv[2], &size);
+        if (!data) return 2;
+        generate(data, size, &p, !strcmp(argv[1], "--gen-ref"));
+        fputs(p.text, stdout);
+        free(data);
+        return 0;
+    }
+    if (argc == 3 && !strcmp(argv[1], "--random")) {
+        runs = strtoul(argv[2], 0, 0);
+        srand((unsigned)getpid());
+        for (r = 0; r < runs; r++) {
+            for (i = 0; i < 64; i++) {
+                buf[i] = (uint8_t)rand();
+            }
+            fuzz_one(buf, 64);
+        }
+        printf("%lu programs match mruby\n", runs);
+        return 0;
+    }
+    if (argc == 2) {
+        input = argv[1];
+    } else if (argc != 1) {
+        fprintf(stderr, "usage: %s [--gen FILE | --gen-ref FILE | --random N | --check DIR | input]\n", argv[0]);
+        return 2;
+    }
+
+    // One input per run, as AFL drives it
+    if (input) {
+        data = (uint8_t*)read_file(input, &size);
+        if (!data) return 2;
+        fuzz_one(data, size);
+        free(data);
+    } else {
+        f = stdin;
+        size = (long)fread(buf, 1, sizeof(buf), f);
+        fuzz_one(buf, size);
+    }
+    return 0;
+}
+
+#endif // MRBZ_LIBFUZZER
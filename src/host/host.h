@@ -0,0 +1,96 @@
+/**
+ * mrbz - Minimal Ruby for Game Boy
+ * Host platform layer header (runs programs on a PC for testing and benchmarks)
+ */
+
+#ifndef MRBZ_HOST_H
+#define MRBZ_HOST_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "../mrbz/vm.h"
+#include "../gb/platform.h"
+
+// Background map size (matches the Game Boy's 32x32 tile map)
+#define HOST_MAP_W 32
+#define HOST_MAP_H 32
+
+// Joypad bits (same values as GBDK's J_* constants)
+#define HOST_J_RIGHT 0x01
+#define HOST_J_LEFT  0x02
+#define HOST_J_UP    0x04
+#define HOST_J_DOWN  0x08
+
+// Simulated machine, one per VM (attached through vm->platform)
+typedef struct {
+    uint8_t tilemap[HOST_MAP_H][HOST_MAP_W];
+    uint8_t joypad;          // Buttons held for the current frame
+    const char* script;      // Input script (NULL = leave joypad alone)
+    const char* script_pos;  // Next script frame
+    uint32_t frames;         // Frames elapsed (wait_vbl calls)
+    uint32_t frame_limit;    // Stop the VM after this many frames (0 = no limit)
+    uint16_t rand_state;     // Random generator state
+    int16_t score;           // Score passed to game_over
+    uint8_t game_over;       // Set once game_over was called
+    uint8_t headless;        // Skip drawing (fast replay)
+    replay_log* record;      // Log input here (NULL = off)
+    replay_log* replay;      // Take input from here; the VM stops at its end
+    world_map world;         // Scrolling world (world.data NULL = none)
+    uint8_t scx, scy;        // Background scroll registers
+    uint8_t check_world;     // Compare the ring with the map every frame
+    uint8_t double_speed;    // Game Boy Color in double speed (MRBZ_CGB ROM)
+    uint16_t op_cycles;      // Estimated CPU cycles per VM instruction
+    uint32_t frame_ops;      // Instructions run when the last frame ended
+    uint32_t budget_frames;  // Frames charged to the budget (this run's)
+    uint32_t busiest_ops;    // Most instructions run in one frame
+    uint32_t busiest_frame;  // ... and the frame that was
+    uint32_t frames_over;    // Frames over the budget (would drop a VBlank)
+} host_ctx;
+
+// Rough cost of one interpreted instruction on the Game Boy CPU (the
+// SDCC-compiled dispatch, operand decode and register copies); calibrate
+// with mrbz-host --op-cycles against a snake-prof.gb run
+#define HOST_OP_CYCLES 300
+
+// Input scripts hold one character per frame - U, D, L, R, or anything
+// else for no buttons - and repeat from the start when they run out.
+
+// Machine a VM runs on
+#define HOST_CTX(vm) ((host_ctx*)(vm)->platform)
+
+// Monotonic clock in microseconds (MRBZ_STATS pause timing)
+uint32_t mrbz_stats_clock(void);
+
+// Reset a machine and attach it to a VM (call after mrbz_vm_init)
+void host_reset(host_ctx* ctx, mrbz_vm* vm);
+
+// CPU cycles in one frame of the simulated machine
+uint32_t host_frame_cycles(const host_ctx* ctx);
+
+// Print how much of the frame budget the run used, at both speeds
+// (MRBZ_STATS; builtins' own work such as drawing isn't counted)
+void host_budget_report(const host_ctx* ctx);
+
+// Print the visible 20x18 area as ASCII
+void host_dump_screen(const host_ctx* ctx);
+
+// Save a VM and its machine to a file / restore them into a VM that has
+// loaded the same program (return 0 on failure)
+int host_save(const char* path, mrbz_vm* vm);
+int host_restore(const char* path, mrbz_vm* vm);
+
+// Read a text map - one row per line, tiles as host_dump_screen prints
+// them - into w x h tiles (caller frees; NULL on error)
+uint8_t* host_world_read(const char* path, uint16_t* w, uint16_t* h);
+
+// Pack a w x h tile map for world_open (caller frees; NULL if too large)
+uint8_t* host_world_pack(const uint8_t* tiles, uint16_t w, uint16_t h, uint32_t* size);
+
+// Name of an opcode without the OP_ prefix (for reports)
+const char* host_op_name(uint8_t op);
+
+// Print a trace (mrbz_trace_dump format) with the operands and names of
+// the program vm has loaded; returns 0 if dump isn't a trace
+int host_trace_print(FILE* out, mrbz_vm* vm, const uint8_t* dump, long len);
+
+#endif // MRBZ_HOST_H
@@ -0,0 +1,379 @@
+/**
+ * mrbz - Minimal Ruby for Game Boy
+ * Host entry point: runs a compiled .mrb program on a PC
+ *
+ * Usage: mrbz-host [options] program.mrb
+ *   --frames N     stop after N frames (wait_vbl calls)
+ *   --seed N       seed the random number generator
+ *   --script S     input script, one character per frame (see host.h)
+ *   --record FILE  write an input log of the run
+ *   --replay FILE  replay an input log as fast as possible (no drawing
+ *                  unless --screen); stops where the log ends
+ *   --save FILE    save the VM and machine at the end of the run
+ *   --restore FILE start from a saved state instead of the beginning
+ *                  (--frames then counts from the restored frame)
+ *   --map FILE     scrolling world from a text map (format in host.h);
+ *                  the streamed background is checked against it every
+ *                  frame and the run stops at the first difference
+ *   --screen       print the final screen
+ *   --slice N      drive the VM with mrbz_vm_step, N instructions at a time
+ *   --cgb          simulate a Game Boy Color in double speed (an MRBZ_CGB=1
+ *                  ROM): twice the cycles per frame in the budget report
+ *   --op-cycles N  CPU cycles one VM instruction is estimated to take
+ *   --trace FILE   write the instruction trace at the end of the run
+ *   --decode-trace FILE
+ *                  print a trace written by --trace or a MRBZ_TRACE=1 ROM
+ *                  (its SRAM) for program.mrb, without running it
+ *   --bench-rand   report random number generator throughput and exit
+ *
+ * Built as mrbz-host-jit (MRBZ_JIT=1), hot loops run as x86-64 code from
+ * the same templates the ROM's JIT uses.
+ *
+ * Built with MRBZ_TRACE=1 (the Makefile's host builds are), a run that
+ * stops on a VM error prints its last instructions.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if MRBZ_JIT
+#include <sys/mman.h>
+
+#define HOST_JIT_CODE (4 * MRBZ_JIT_CODE)
+#endif
+#include "host.h"
+#include "../gb/platform.h"
+#include "../mrbz/vm.h"
+
+// Calls per benchmark round
+#define BENCH_CALLS 10000000UL
+
+// Largest input log
+#define LOG_MAX 0xFFFF
+
+#if MRBZ_TRACE
+// Largest trace dump
+#define TRACE_MAX (3 + 256 * MRBZ_TRACE_REC)
+#endif
+
+// Read a whole file into memory (caller frees)
+static uint8_t* read_file(const char* path, long* size) {
+    FILE* f;
+    uint8_t* buf;
+
+    f = fopen(path, "rb");
+    if (!f) {
+        return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(*size);
+    if (buf && fread(buf, 1, *size, f) != (size_t)*size) {
+        free(buf);
+        buf = 0;
+    }
+    fclose(f);
+    return buf;
+}
+
+// Seconds of CPU time since start
+static double elapsed(clock_t start) {
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+// Measure rand / rand_pos throughput through the builtin entry points
+static void bench_rand(void) {
+    static mrbz_vm vm;
+    static host_ctx machine;
+    mrbz_value ret;
+    uint32_t i, sum;
+    clock_t start;
+    double secs;
+
+    mrbz_vm_init(&vm);
+    host_reset(&machine, &vm);
+
+    sum = 0;
+    start = clock();
+    for (i = 0; i < BENCH_CALLS; i++) {
+        gb_rand(&vm, 20, &ret);
+        sum += ret.v.i;
+    }
+    secs = elapsed(start);
+    printf("rand(20):         %8.1f Mcalls/s (mean %.2f)\n",
+           BENCH_CALLS / secs / 1e6, (double)sum / BENCH_CALLS);
+
+    sum = 0;
+    start = clock();
+    for (i = 0; i < BENCH_CALLS; i++) {
+        gb_rand_pos(&vm, 20, 18, &ret);
+        sum += ret.v.i & 0xFF;
+    }
+    secs = elapsed(start);
+    printf("rand_pos(20, 18): %8.1f Mcalls/s (mean x %.2f)\n",
+           BENCH_CALLS / secs / 1e6, (double)sum / BENCH_CALLS);
+
+    sum = 0;
+    start = clock();
+    for (i = 0; i < BENCH_CALLS; i++) {
+        sum += rand_next(&machine.rand_state) & 1;
+    }
+    secs = elapsed(start);
+    printf("raw xorshift:     %8.1f Mcalls/s (low bit %.4f)\n",
+           BENCH_CALLS / secs / 1e6, (double)sum / BENCH_CALLS);
+}
+
+// Drive a loaded VM in time slices, doing the frame wait here
+// Returns the number of slices run.
+static unsigned long run_sliced(mrbz_vm* vm, uint16_t slice) {
+    unsigned long slices = 0;
+    mrbz_value ret;
+    uint8_t status;
+
+    do {
+        status = mrbz_vm_step(vm, slice);
+        slices++;
+        if (status == MRBZ_STEP_YIELDED) {
+            gb_wait_vbl(vm, &ret);
+        }
+    } while (status == MRBZ_STEP_YIELDED || status == MRBZ_STEP_BUDGET);
+
+    return slices;
+}
+
+int main(int argc, char** argv) {
+    static mrbz_vm vm;
+    static host_ctx machine;
+    mrbz_value result;
+    const char* path = 0;
+    const char* script = 0;
+    uint32_t frame_limit = 0;
+    uint16_t seed = 0;
+    uint8_t seeded = 0;
+    const char* record_path = 0;
+    const char* replay_path = 0;
+    const char* save_path = 0;
+    const char* restore_path = 0;
+    const char* map_path = 0;
+#if MRBZ_TRACE
+    const char* trace_path = 0;
+    const char* decode_path = 0;
+    static uint8_t trace_buf[TRACE_MAX];
+    uint8_t* dump;
+    uint16_t trace_len;
+#endif
+    uint8_t* map = 0;
+    uint8_t* map_tiles;
+    uint32_t map_size;
+    uint16_t map_w, map_h;
+#if MRBZ_JIT
+    uint8_t* jit_code;
+#endif
+    static uint8_t record_buf[LOG_MAX];
+    uint8_t* replay_buf = 0;
+    replay_log record, replay;
+    uint16_t replay_seed;
+    FILE* f;
+    uint8_t show_screen = 0;
+    uint16_t slice = 0;
+    uint8_t double_speed = 0;
+    uint16_t op_cycles = HOST_OP_CYCLES;
+    unsigned long slices = 0;
+    uint8_t* bytecode;
+    long size;
+    clock_t start;
+    double secs;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+            frame_limit = strtoul(argv[++i], 0, 0);
+        } else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+            seed = (uint16_t)strtoul(argv[++i], 0, 0);
+            seeded = 1;
+        } else if (!strcmp(argv[i], "--slice") && i + 1 < argc) {
+            slice = (uint16_t)strtoul(argv[++i], 0, 0);
+        } else if (!strcmp(argv[i], "--script") && i + 1 < argc) {
+            script = argv[++i];
+        } else if (!strcmp(argv[i], "--record") && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (!strcmp(argv[i], "--replay") && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (!strcmp(argv[i], "--save") && i + 1 < argc) {
+            save_path = argv[++i];
+        } else if (!strcmp(argv[i], "--restore") && i + 1 < argc) {
+            restore_path = argv[++i];
+        } else if (!strcmp(argv[i], "--map") && i + 1 < argc) {
+            map_path = argv[++i];
+#if MRBZ_TRACE
+        } else if (!strcmp(argv[i], "--trace") && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (!strcmp(argv[i], "--decode-trace") && i + 1 < argc) {
+            decode_path = argv[++i];
+#endif
+        } else if (!strcmp(argv[i], "--cgb")) {
+            double_speed = 1;
+        } else if (!strcmp(argv[i], "--op-cycles") && i + 1 < argc) {
+            op_cycles = (uint16_t)strtoul(argv[++i], 0, 0);
+        } else if (!strcmp(argv[i], "--screen")) {
+            show_screen = 1;
+        } else if (!strcmp(argv[i], "--bench-rand")) {
+            bench_rand();
+            return 0;
+        } else {
+            path = argv[i];
+        }
+    }
+    if (!path) {
+        fprintf(stderr, "usage: %s [--frames N] [--seed N] [--slice N] [--script S]\n"
+                        "       [--record FILE] [--replay FILE] [--save FILE] [--restore FILE] [--map FILE]\n"
+                        "       [--trace FILE] [--decode-trace FILE] [--cgb] [--op-cycles N] [--screen]\n"
+                        "       [--bench-rand] program.mrb\n", argv[0]);
+        return 2;
+    }
+
+    bytecode = read_file(path, &size);
+    if (!bytecode) {
+        fprintf(stderr, "%s: cannot read %s\n", argv[0], path);
+        return 1;
+    }
+
+    mrbz_vm_init(&vm);
+    host_reset(&machine, &vm);
+    machine.script = script;
+    machine.frame_limit = frame_limit;
+    machine.double_speed = double_speed;
+    machine.op_cycles = op_cycles;
+    if (seeded) {
+        rand_seed(&machine.rand_state, seed);
+    }
+    if (replay_path) {
+        replay_buf = read_file(replay_path, &size);
+        if (!replay_buf || !replay_start(&replay, replay_buf, size > LOG_MAX ? LOG_MAX : (uint16_t)size, &replay_seed)) {
+            fprintf(stderr, "%s: %s is not an input log\n", argv[0], replay_path);
+            return 1;
+        }
+        rand_seed(&machine.rand_state, replay_seed);
+        machine.replay = &replay;
+        machine.headless = !show_screen;
+    }
+    if (map_path) {
+        map_tiles = host_world_read(map_path, &map_w, &map_h);
+        map = map_tiles ? host_world_pack(map_tiles, map_w, map_h, &map_size) : 0;
+        free(map_tiles);
+        if (!map || !world_open(&machine.world, map)) {
+            fprintf(stderr, "%s: %s is not a map\n", argv[0], map_path);
+            return 1;
+        }
+        machine.check_world = 1;
+    }
+    if (record_path) {
+        replay_record_start(&record, record_buf, LOG_MAX, machine.rand_state);
+        machine.record = &record;
+    }
+
+    mrbz_vm_load(&vm, bytecode);
+#if MRBZ_TRACE
+    if (decode_path) {
+        dump = read_file(decode_path, &size);
+        if (!dump || !host_trace_print(stdout, &vm, dump, size)) {
+            fprintf(stderr, "%s: %s is not a trace\n", argv[0], decode_path);
+            return 1;
+        }
+        free(dump);
+        free(bytecode);
+        return 0;
+    }
+#endif
+#if MRBZ_JIT
+    // x86-64 templates are bigger than the Game Boy's; the larger buffer
+    // lets the host compile the same loops
+    jit_code = mmap(0, HOST_JIT_CODE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit_code == MAP_FAILED) {
+        fprintf(stderr, "%s: no executable memory, running without the JIT\n", argv[0]);
+    } else {
+        mrbz_jit_init(&vm, jit_code, HOST_JIT_CODE);
+    }
+#endif
+    if (restore_path) {
+        if (!host_restore(restore_path, &vm)) {
+            fprintf(stderr, "%s: cannot restore %s\n", argv[0], restore_path);
+            return 1;
+        }
+        if (frame_limit) {
+            machine.frame_limit = machine.frames + frame_limit;
+        }
+    }
+
+    start = clock();
+    if (slice) {
+        slices = run_sliced(&vm, slice);
+    } else if (restore_path) {
+        // Stepping picks up whatever the saved run was in the middle of
+        run_sliced(&vm, 0xFFFF);
+    } else {
+        mrbz_vm_exec(&vm, &vm.root, &result);
+    }
+    secs = elapsed(start);
+    if (vm.error != MRBZ_ERR_NONE) {
+        fprintf(stderr, "vm error %u at pc %u (run mrbz-check for details)\n",
+                vm.error, vm.error_pc);
+#if MRBZ_TRACE
+        trace_len = mrbz_trace_dump(&vm, trace_buf, TRACE_MAX);
+        if (trace_len > 3) {    // Empty if the program stopped at load
+            host_trace_print(stderr, &vm, trace_buf, trace_len);
+        }
+#endif
+    }
+#if MRBZ_TRACE
+    if (trace_path) {
+        trace_len = mrbz_trace_dump(&vm, trace_buf, TRACE_MAX);
+        f = fopen(trace_path, "wb");
+        if (!f || fwrite(trace_buf, 1, trace_len, f) != trace_len) {
+            fprintf(stderr, "%s: cannot write %s\n", argv[0], trace_path);
+        }
+        if (f) {
+            fclose(f);
+        }
+    }
+#endif
+
+    if (save_path && !host_save(save_path, &vm)) {
+        fprintf(stderr, "%s: cannot save %s\n", argv[0], save_path);
+    }
+    if (record_path) {
+        f = fopen(record_path, "wb");
+        if (!f || fwrite(record_buf, 1, replay_size(&record), f) != replay_size(&record)) {
+            fprintf(stderr, "%s: cannot write %s\n", argv[0], record_path);
+        }
+        if (f) {
+            fclose(f);
+        }
+    }
+    if (show_screen) {
+        host_dump_screen(&machine);
+    }
+    printf("frames: %lu  score: %d  game_over: %d  time: %.3fs\n",
+           (unsigned long)machine.frames, machine.score, machine.game_over, secs);
+    if (slice) {
+        printf("slices: %lu of %u instructions\n", slices, slice);
+    }
+#if MRBZ_STATS
+    host_budget_report(&machine);
+    printf("gc: %u runs, %u arrays freed, pause max %luus total %luus\n",
+           vm.stats.gc_runs, vm.stats.gc_freed,
+           (unsigned long)vm.stats.gc_time_max, (unsigned long)vm.stats.gc_time_total);
+#if MRBZ_JIT
+    printf("jit: %u loops compiled, %u bytes, %lu instructions run natively\n",
+           vm.stats.jit_compiled, vm.jit_used, (unsigned long)vm.stats.jit_ops);
+#endif
+#endif
+
+    free(map);
+    free(replay_buf);
+    free(bytecode);
+    return 0;
+}
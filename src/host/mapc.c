@@ -0,0 +1,91 @@
+/**
+ * mrbz - Minimal Ruby for Game Boy
+ * Map converter: packs a text world map into a C array for the ROM
+ *
+ * Usage: mrbz-map [-n NAME] [-o FILE] map.txt
+ *   -n NAME   array name (default world_map_data)
+ *   -o FILE   output file (default stdout)
+ *
+ * The map is one row per line, tiles written as host_dump_screen prints
+ * them. The packed map is decoded back and compared with the text before
+ * it is written, so a ROM never gets a map the streamer would misread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host.h"
+
+// Bytes per line of the generated array
+#define BYTES_PER_LINE 16
+
+int main(int argc, char** argv) {
+    const char* name = "world_map_data";
+    const char* out_path = 0;
+    const char* path = 0;
+    world_map m;
+    uint8_t* tiles;
+    uint8_t* packed;
+    uint8_t row[WORLD_SEG];
+    uint32_t size;
+    uint16_t w, h, x, y;
+    uint8_t len;
+    FILE* out;
+    int n;
+
+    for (n = 1; n < argc; n++) {
+        if (!strcmp(argv[n], "-n") && n + 1 < argc) {
+            name = argv[++n];
+        } else if (!strcmp(argv[n], "-o") && n + 1 < argc) {
+            out_path = argv[++n];
+        } else {
+            path = argv[n];
+        }
+    }
+    if (!path) {
+        fprintf(stderr, "usage: %s [-n NAME] [-o FILE] map.txt\n", argv[0]);
+        return 2;
+    }
+
+    tiles = host_world_read(path, &w, &h);
+    packed = tiles ? host_world_pack(tiles, w, h, &size) : 0;
+    if (!packed || !world_open(&m, packed)) {
+        fprintf(stderr, "%s: %s is not a map of at most %ux%u tiles packing to 64K\n",
+                argv[0], path, WORLD_MAX, WORLD_MAX);
+        return 1;
+    }
+
+    // Decode every row back in odd-sized pieces, so runs get entered
+    // part way as the streamer does
+    for (y = 0; y < h; y++) {
+        for (x = 0; x < w; x += len) {
+            len = (uint8_t)(w - x < 7 ? w - x : 7);
+            world_row(&m, (int16_t)x, (int16_t)y, len, row);
+            if (memcmp(row, tiles + (uint32_t)y * w + x, len)) {
+                fprintf(stderr, "%s: row %u does not decode back\n", argv[0], y);
+                return 1;
+            }
+        }
+    }
+    free(tiles);
+
+    out = out_path ? fopen(out_path, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "%s: cannot write %s\n", argv[0], out_path);
+        return 1;
+    }
+    fprintf(out, "// Generated by mrbz-map from %s: %ux%u tiles, %u bytes\n",
+            path, m.w, m.h, size);
+    fprintf(out, "const unsigned char %s[] = {", name);
+    for (n = 0; n < (int)size; n++) {
+        fprintf(out, "%s0x%02X,", n % BYTES_PER_LINE ? " " : "\n    ", packed[n]);
+    }
+    fprintf(out, "\n};\n");
+    if (out_path && fclose(out) != 0) {
+        fprintf(stderr, "%s: cannot write %s\n", argv[0], out_path);
+        return 1;
+    }
+    fprintf(stderr, "%s: %ux%u tiles packed to %u bytes\n", path, m.w, m.h, size);
+    free(packed);
+    return 0;
+}
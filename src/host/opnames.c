@@ -0,0 +1,34 @@
+/**
+ * mrbz - Minimal Ruby for Game Boy
+ * Opcode names for host-side reports
+ */
+
+#include "host.h"
+#include "../mrbz/opcodes.h"
+
+// Indexed by opcode, in the order of opcodes.h
+static const char* const op_names[MRBZ_OP_COUNT] = {
+    "NOP", "MOVE", "LOADL", "LOADI", "LOADINEG", "LOADI__1",
+    "LOADI_0", "LOADI_1", "LOADI_2", "LOADI_3", "LOADI_4", "LOADI_5",
+    "LOADI_6", "LOADI_7", "LOADI16", "LOADI32", "LOADSYM", "LOADNIL",
+    "LOADSELF", "LOADT", "LOADF", "GETGV", "SETGV", "GETSV",
+    "SETSV", "GETIV", "SETIV", "GETCV", "SETCV", "GETCONST",
+    "SETCONST", "GETMCNST", "SETMCNST", "GETUPVAR", "SETUPVAR", "GETIDX",
+    "SETIDX", "JMP", "JMPIF", "JMPNOT", "JMPNIL", "JMPUW",
+    "EXCEPT", "RESCUE", "RAISEIF", "SSEND", "SSENDB", "SEND",
+    "SENDB", "CALL", "SUPER", "ARGARY", "ENTER", "KEY_P",
+    "KEYEND", "KARG", "RETURN", "RETURN_BLK", "BREAK", "BLKPUSH",
+    "ADD", "ADDI", "SUB", "SUBI", "MUL", "DIV",
+    "EQ", "LT", "LE", "GT", "GE", "ARRAY",
+    "ARRAY2", "ARYCAT", "ARYPUSH", "ARYDUP", "AREF", "ASET",
+    "APOST", "INTERN", "SYMBOL", "STRING", "STRCAT", "HASH",
+    "HASHADD", "HASHCAT", "LAMBDA", "BLOCK", "METHOD", "RANGE_INC",
+    "RANGE_EXC", "OCLASS", "CLASS", "MODULE", "EXEC", "DEF",
+    "ALIAS", "UNDEF", "SCLASS", "TCLASS", "DEBUG", "ERR",
+    "EXT1", "EXT2", "EXT3", "STOP"
+};
+
+// Name of an opcode without the OP_ prefix ("?" if out of range)
+const char* host_op_name(uint8_t op) {
+    return op < MRBZ_OP_COUNT ? op_names[op] : "?";
+}
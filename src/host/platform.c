@@ -0,0 +1,401 @@
+/**
+ * mrbz - Minimal Ruby for Game Boy
+ * Host platform implementations (same API as src/gb/platform.c)
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "host.h"
+#include "../gb/platform.h"
+#include "../mrbz/vm.h"
+
+// Monotonic clock in microseconds for VM statistics
+uint32_t mrbz_stats_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000UL + ts.tv_nsec / 1000);
+}
+
+// Reset a machine and attach it to a VM
+void host_reset(host_ctx* ctx, mrbz_vm* vm) {
+    memset(ctx->tilemap, TILE_EMPTY, sizeof(ctx->tilemap));
+    ctx->joypad = 0;
+    ctx->script = 0;
+    ctx->script_pos = 0;
+    ctx->frames = 0;
+    ctx->frame_limit = 0;
+    ctx->rand_state = 12345;
+    ctx->score = 0;
+    ctx->game_over = 0;
+    ctx->headless = 0;
+    ctx->record = 0;
+    ctx->replay = 0;
+    ctx->world.data = 0;
+    ctx->scx = 0;
+    ctx->scy = 0;
+    ctx->check_world = 0;
+    ctx->double_speed = 0;
+    ctx->op_cycles = HOST_OP_CYCLES;
+    ctx->frame_ops = 0;
+    ctx->budget_frames = 0;
+    ctx->busiest_ops = 0;
+    ctx->busiest_frame = 0;
+    ctx->frames_over = 0;
+    vm->platform = ctx;
+}
+
+// Largest snapshot file
+#define SAVE_MAX 0x4000
+
+// Direction symbol names, indexed by SYM_*
+static const char* const dir_names[] = { 0, "up", "down", "left", "right" };
+
+// Joypad bits for one input script character
+static uint8_t script_buttons(char c) {
+    switch (c) {
+        case 'U': return HOST_J_UP;
+        case 'D': return HOST_J_DOWN;
+        case 'L': return HOST_J_LEFT;
+        case 'R': return HOST_J_RIGHT;
+        default:  return 0;
+    }
+}
+
+// Print the visible 20x18 area as ASCII (the tile under each cell's
+// top-left pixel when scrolled)
+void host_dump_screen(const host_ctx* ctx) {
+    uint8_t x, y, t;
+    char c;
+
+    for (y = 0; y < 18; y++) {
+        for (x = 0; x < 20; x++) {
+            t = ctx->tilemap[(y + (ctx->scy >> 3)) & (HOST_MAP_H - 1)][(x + (ctx->scx >> 3)) & (HOST_MAP_W - 1)];
+            switch (t) {
+                case TILE_EMPTY: c = '.'; break;
+                case TILE_HEAD:  c = '@'; break;
+                case TILE_BODY:  c = 'o'; break;
+                case TILE_FOOD:  c = '*'; break;
+                case TILE_MINUS: c = '-'; break;
+                default:         c = '?'; break;
+            }
+            if (t >= TILE_DIGIT0 && t < TILE_DIGIT0 + 10) {
+                c = '0' + (t - TILE_DIGIT0);
+            } else if (t >= TILE_LETTER_A && t < TILE_LETTER_A + 26) {
+                c = 'A' + (t - TILE_LETTER_A);
+            }
+            putchar(c);
+        }
+        putchar('\n');
+    }
+}
+
+// Save file: u16 LE VM snapshot length, the snapshot, then the machine
+// (tilemap, frame count, script position, random state, joypad, score,
+// game over flag)
+int host_save(const char* path, mrbz_vm* vm) {
+    static uint8_t buf[SAVE_MAX];
+    host_ctx* ctx = HOST_CTX(vm);
+    uint32_t script_at = ctx->script_pos ? (uint32_t)(ctx->script_pos - ctx->script) : 0;
+    uint16_t len;
+    FILE* f;
+    int ok;
+
+    len = mrbz_vm_snapshot(vm, buf + 2, SAVE_MAX - 2);
+    if (!len) {
+        return 0;
+    }
+    buf[0] = len & 0xFF;
+    buf[1] = len >> 8;
+
+    f = fopen(path, "wb");
+    if (!f) {
+        return 0;
+    }
+    ok = fwrite(buf, 1, len + 2, f) == (size_t)len + 2 &&
+         fwrite(ctx->tilemap, 1, sizeof(ctx->tilemap), f) == sizeof(ctx->tilemap) &&
+         fwrite(&ctx->frames, sizeof(ctx->frames), 1, f) == 1 &&
+         fwrite(&script_at, sizeof(script_at), 1, f) == 1 &&
+         fwrite(&ctx->rand_state, sizeof(ctx->rand_state), 1, f) == 1 &&
+         fwrite(&ctx->joypad, sizeof(ctx->joypad), 1, f) == 1 &&
+         fwrite(&ctx->score, sizeof(ctx->score), 1, f) == 1 &&
+         fwrite(&ctx->game_over, sizeof(ctx->game_over), 1, f) == 1;
+    return fclose(f) == 0 && ok;
+}
+
+int host_restore(const char* path, mrbz_vm* vm) {
+    static uint8_t buf[SAVE_MAX];
+    host_ctx* ctx = HOST_CTX(vm);
+    uint32_t script_at;
+    uint16_t len;
+    FILE* f;
+    int ok;
+
+    f = fopen(path, "rb");
+    if (!f) {
+        return 0;
+    }
+    ok = fread(buf, 1, 2, f) == 2;
+    len = buf[0] | ((uint16_t)buf[1] << 8);
+    ok = ok && len <= SAVE_MAX &&
+         fread(buf, 1, len, f) == len &&
+         fread(ctx->tilemap, 1, sizeof(ctx->tilemap), f) == sizeof(ctx->tilemap) &&
+         fread(&ctx->frames, sizeof(ctx->frames), 1, f) == 1 &&
+         fread(&script_at, sizeof(script_at), 1, f) == 1 &&
+         fread(&ctx->rand_state, sizeof(ctx->rand_state), 1, f) == 1 &&
+         fread(&ctx->joypad, sizeof(ctx->joypad), 1, f) == 1 &&
+         fread(&ctx->score, sizeof(ctx->score), 1, f) == 1 &&
+         fread(&ctx->game_over, sizeof(ctx->game_over), 1, f) == 1;
+    fclose(f);
+
+    // Continue the input script where the saved run was, if it is long enough
+    ctx->script_pos = 0;
+    if (ok && ctx->script && script_at && script_at <= strlen(ctx->script)) {
+        ctx->script_pos = ctx->script + script_at;
+    }
+    return ok && mrbz_vm_restore(vm, buf, len) != 0;
+}
+
+// Read joypad and return direction as symbol
+void gb_read_joypad(mrbz_vm* vm, mrbz_value* ret) {
+    host_ctx* ctx = HOST_CTX(vm);
+    uint8_t j = ctx->joypad;
+    uint8_t dir;
+
+    // Priority: up > down > left > right
+    if (j & HOST_J_UP) {
+        dir = SYM_UP;
+    } else if (j & HOST_J_DOWN) {
+        dir = SYM_DOWN;
+    } else if (j & HOST_J_LEFT) {
+        dir = SYM_LEFT;
+    } else if (j & HOST_J_RIGHT) {
+        dir = SYM_RIGHT;
+    } else {
+        dir = SYM_NONE;
+    }
+    if (ctx->replay && !replay_read_input(ctx->replay, &dir)) {
+        vm->running = 0;  // Log exhausted
+        dir = SYM_NONE;
+    }
+    if (ctx->record) {
+        replay_record_input(ctx->record, dir);
+    }
+
+    if (dir == SYM_NONE) {
+        MRBZ_SET_NIL(*ret);
+    } else {
+        MRBZ_SET_SYM(*ret, mrbz_find_symbol(vm, dir_names[dir]));
+    }
+}
+
+// Draw a tile at x,y position
+void gb_draw_tile(mrbz_vm* vm, int16_t x, int16_t y, int16_t tile, mrbz_value* ret) {
+    if (!HOST_CTX(vm)->headless && x >= 0 && x < 20 && y >= 0 && y < 18) {
+        HOST_CTX(vm)->tilemap[y][x] = (uint8_t)tile;
+    }
+
+    MRBZ_SET_NIL(*ret);
+}
+
+// Clear a tile (set to empty)
+void gb_clear_tile(mrbz_vm* vm, int16_t x, int16_t y, mrbz_value* ret) {
+    gb_draw_tile(vm, x, y, TILE_EMPTY, ret);
+}
+
+// Write a block of tiles into the background ring
+static void world_put(void* p, uint8_t x, uint8_t y, uint8_t w, uint8_t h, const uint8_t* tiles) {
+    host_ctx* ctx = p;
+    uint8_t i;
+
+    if (ctx->headless) {
+        return;
+    }
+    for (i = 0; i < h; i++) {
+        memcpy(&ctx->tilemap[y + i][x], tiles + i * w, w);
+    }
+}
+
+// Compare the window the ring holds with the map; returns the mismatches
+// and reports the first
+static uint16_t check_world(host_ctx* ctx) {
+    const world_map* m = &ctx->world;
+    uint8_t tiles[WORLD_VIEW_W];
+    uint16_t bad = 0;
+    uint8_t i, j, t;
+
+    for (i = 0; i < WORLD_VIEW_H; i++) {
+        world_row(m, m->tx, m->ty + i, WORLD_VIEW_W, tiles);
+        for (j = 0; j < WORLD_VIEW_W; j++) {
+            t = ctx->tilemap[(m->ty + i) & (HOST_MAP_H - 1)][(m->tx + j) & (HOST_MAP_W - 1)];
+            if (t != tiles[j] && !bad++) {
+                fprintf(stderr, "frame %lu: map tile %d,%d is %u in the ring, %u in the map\n",
+                        (unsigned long)ctx->frames, m->tx + j, m->ty + i, t, tiles[j]);
+            }
+        }
+    }
+    return bad;
+}
+
+uint32_t host_frame_cycles(const host_ctx* ctx) {
+    return ctx->double_speed ? 2 * GB_FRAME_CYCLES : GB_FRAME_CYCLES;
+}
+
+#if MRBZ_STATS
+// Charge the instructions run since the last frame against the budget
+static void frame_budget(host_ctx* ctx, const mrbz_vm* vm) {
+    uint32_t ops, n;
+    uint8_t i;
+
+    ops = 0;
+    for (i = 0; i < MRBZ_OP_COUNT; i++) {
+        ops += vm->stats.ops[i];
+    }
+    n = ops - ctx->frame_ops;
+    ctx->frame_ops = ops;
+    ctx->budget_frames++;
+    if (n > ctx->busiest_ops) {
+        ctx->busiest_ops = n;
+        ctx->busiest_frame = ctx->frames;
+    }
+    if ((uint64_t)n * ctx->op_cycles > host_frame_cycles(ctx)) {
+        ctx->frames_over++;
+    }
+}
+
+// Share of a frame at normal (speed 1) or double speed (2), in percent
+static double frame_share(const host_ctx* ctx, double ops, int speed) {
+    return 100.0 * ops * ctx->op_cycles / (speed * GB_FRAME_CYCLES);
+}
+
+void host_budget_report(const host_ctx* ctx) {
+    double mean;
+
+    if (!ctx->budget_frames) {
+        return;
+    }
+    mean = (double)ctx->frame_ops / ctx->budget_frames;
+    printf("frame budget: %lu cycles (%s) at ~%u cycles/instruction\n",
+           (unsigned long)host_frame_cycles(ctx), ctx->double_speed ? "CGB double speed" : "normal speed",
+           ctx->op_cycles);
+    printf("  busiest frame %lu: %lu instructions, %.0f%% of a normal-speed frame, %.0f%% in double speed\n",
+           (unsigned long)ctx->busiest_frame, (unsigned long)ctx->busiest_ops,
+           frame_share(ctx, ctx->busiest_ops, 1), frame_share(ctx, ctx->busiest_ops, 2));
+    printf("  mean %.0f instructions, %.0f%% of a normal-speed frame, %.0f%% in double speed\n",
+           mean, frame_share(ctx, mean, 1), frame_share(ctx, mean, 2));
+    printf("  %lu frames over budget\n", (unsigned long)ctx->frames_over);
+}
+#endif
+
+// Wait for vertical blank: count the frame, stream the world and scroll,
+// stop at the frame limit and latch the next frame of the input script
+void gb_wait_vbl(mrbz_vm* vm, mrbz_value* ret) {
+    host_ctx* ctx = HOST_CTX(vm);
+
+    ctx->frames++;
+#if MRBZ_STATS
+    frame_budget(ctx, vm);
+#endif
+    if (ctx->world.data) {
+        world_stream(&ctx->world, ctx, world_put);
+        ctx->scx = (uint8_t)ctx->world.cam_x;
+        ctx->scy = (uint8_t)ctx->world.cam_y;
+        if (ctx->check_world && !ctx->headless && check_world(ctx)) {
+            vm->running = 0;
+        }
+    }
+    if (ctx->frame_limit && ctx->frames >= ctx->frame_limit) {
+        vm->running = 0;
+    }
+    if (ctx->script && *ctx->script && !ctx->replay) {
+        if (!ctx->script_pos || !*ctx->script_pos) {
+            ctx->script_pos = ctx->script;
+        }
+        ctx->joypad = script_buttons(*ctx->script_pos++);
+    }
+    MRBZ_SET_NIL(*ret);
+}
+
+// Random number in 0...max
+void gb_rand(mrbz_vm* vm, int16_t max, mrbz_value* ret) {
+    MRBZ_SET_INT(*ret, rand_int(&HOST_CTX(vm)->rand_state, max));
+}
+
+// Seed the generator; without a seed stir in the frame counter
+// (stands in for DIV jitter and keeps host runs reproducible)
+void gb_srand(mrbz_vm* vm, uint8_t argc, int16_t seed, mrbz_value* ret) {
+    host_ctx* ctx = HOST_CTX(vm);
+    uint8_t entropy;
+
+    if (argc >= 1) {
+        rand_seed(&ctx->rand_state, seed);
+    } else {
+        entropy = (uint8_t)(ctx->frames * 0x9D);
+        if (ctx->replay && !replay_read_stir(ctx->replay, &entropy)) {
+            vm->running = 0;  // Log exhausted
+        }
+        rand_stir(&ctx->rand_state, entropy);
+        if (ctx->record) {
+            replay_record_stir(ctx->record, entropy);
+        }
+    }
+    MRBZ_SET_NIL(*ret);
+}
+
+// Random position packed as (y << 8) | x
+void gb_rand_pos(mrbz_vm* vm, int16_t w, int16_t h, mrbz_value* ret) {
+    MRBZ_SET_INT(*ret, rand_pos(&HOST_CTX(vm)->rand_state, w, h));
+}
+
+// Write a run of tiles to one row of the visible area
+static void draw_run(host_ctx* ctx, int16_t x, int16_t y, const uint8_t* tiles, uint8_t len) {
+    uint8_t skip;
+
+    len = text_clip(&x, y, len, &skip);
+    if (len && !ctx->headless) {
+        memcpy(&ctx->tilemap[y][x], tiles + skip, len);
+    }
+}
+
+// Draw n at x,y, zero-padded to width tiles
+void gb_draw_number(mrbz_vm* vm, int16_t x, int16_t y, int16_t n, uint8_t width, mrbz_value* ret) {
+    uint8_t tiles[TEXT_MAX];
+
+    draw_run(HOST_CTX(vm), x, y, tiles, text_number(n, width, tiles));
+    MRBZ_SET_NIL(*ret);
+}
+
+// Draw a symbol's name at x,y
+void gb_draw_text(mrbz_vm* vm, int16_t x, int16_t y, const char* text, mrbz_value* ret) {
+    uint8_t tiles[TEXT_MAX];
+
+    draw_run(HOST_CTX(vm), x, y, tiles, text_symbol(text, tiles));
+    MRBZ_SET_NIL(*ret);
+}
+
+// Move the world camera to pixel x,y (applied at the next wait_vbl)
+void gb_scroll_to(mrbz_vm* vm, int16_t x, int16_t y, mrbz_value* ret) {
+    if (HOST_CTX(vm)->world.data) {
+        world_scroll(&HOST_CTX(vm)->world, x, y);
+    }
+    MRBZ_SET_NIL(*ret);
+}
+
+// World tile at x,y, or nil off the map
+void gb_map_tile(mrbz_vm* vm, int16_t x, int16_t y, mrbz_value* ret) {
+    int16_t tile = world_tile(&HOST_CTX(vm)->world, x, y);
+
+    if (tile < 0) {
+        MRBZ_SET_NIL(*ret);
+    } else {
+        MRBZ_SET_INT(*ret, tile);
+    }
+}
+
+// Game over - record the score and stop the VM
+void gb_game_over(mrbz_vm* vm, int16_t score, mrbz_value* ret) {
+    HOST_CTX(vm)->score = score;
+    HOST_CTX(vm)->game_over = 1;
+    vm->running = 0;
+    MRBZ_SET_NIL(*ret);
+}
@@ -0,0 +1,362 @@
+/**
+ * mrbz - Minimal Ruby for Game Boy
+ * Profile reader: prints the histogram a MRBZ_PROFILE=1 ROM sampled
+ *
+ * Usage: mrbz-prof [--top N] program.mrb profile.sav
+ *   --top N   print the N busiest entries (default 30, 0 for all)
+ *
+ * The .sav is the cartridge SRAM (the emulator's save file or a dump of
+ * a real cartridge); the histogram sits at its start (format in
+ * src/gb/profile.c). program.mrb must be the program the ROM ran. Compile
+ * it with mrbc -g and samples are attributed to source lines, read from
+ * the debug section; without it they are attributed to IREP and pc.
+ * Debug info doesn't change the instructions, so a ROM built from the
+ * same source without -g matches.
+ *
+ * Every sample lands on one line of the profile: the source line being
+ * interpreted, or the builtin running (self time, not the caller's).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host.h"
+
+#define READ_U16(p) ((uint16_t)(((p)[0] << 8) | (p)[1]))
+#define READ_U32(p) (((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) | \
+                     ((uint32_t)(p)[2] << 8) | (p)[3])
+
+// Longest source line printed
+#define SOURCE_MAX 60
+
+// One line of the profile
+typedef struct {
+    int kind;               // ENTRY_*
+    unsigned file, line;    // ENTRY_LINE: debug filename index and line
+    unsigned irep, pc;      // ENTRY_PC: where, without debug info
+    unsigned sym;           // ENTRY_BUILTIN: symbol of the builtin
+    uint32_t samples;
+} entry;
+
+enum { ENTRY_LINE, ENTRY_PC, ENTRY_BUILTIN, ENTRY_OUTSIDE };
+
+// Debug info of the program (mrbc -g)
+typedef struct {
+    unsigned file_count;
+    char** files;
+    const uint8_t** records;    // Debug record per IREP, in IREP order
+    unsigned record_count;
+} debug_info;
+
+// Read a whole file into memory (caller frees)
+static uint8_t* read_file(const char* path, long* size) {
+    FILE* f;
+    uint8_t* buf;
+
+    f = fopen(path, "rb");
+    if (!f) {
+        return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(*size);
+    if (buf && fread(buf, 1, *size, f) != (size_t)*size) {
+        free(buf);
+        buf = 0;
+    }
+    fclose(f);
+    return buf;
+}
+
+// Find the debug section and index its records; returns 0 if there is none
+// Section: u16 filename count, filenames (u16 length, bytes), then one
+// record per IREP, depth first: u32 record size, u16 file count, files.
+static int read_debug(const uint8_t* bytecode, long size, unsigned ireps, debug_info* dbg) {
+    const uint8_t* p = bytecode + 20;
+    const uint8_t* end = bytecode + size;
+    unsigned i, len;
+
+    // Sections follow the header: "IREP", "LVAR", "DBG\0", "END\0"
+    while (p + 8 <= end && memcmp(p, "DBG\0", 4) != 0) {
+        if (!memcmp(p, "END\0", 4) || READ_U32(p + 4) < 8) {
+            return 0;
+        }
+        p += READ_U32(p + 4);
+    }
+    if (p + 10 > end) {
+        return 0;
+    }
+    end = p + READ_U32(p + 4) < end ? p + READ_U32(p + 4) : end;
+    p += 8;
+
+    dbg->file_count = READ_U16(p);
+    dbg->files = calloc(dbg->file_count + 1, sizeof(char*));
+    p += 2;
+    for (i = 0; i < dbg->file_count && p + 2 <= end; i++) {
+        len = READ_U16(p);
+        if (p + 2 + len > end) break;
+        dbg->files[i] = malloc(len + 1);
+        memcpy(dbg->files[i], p + 2, len);
+        dbg->files[i][len] = 0;
+        p += 2 + len;
+    }
+    dbg->records = calloc(ireps, sizeof(uint8_t*));
+    for (i = 0; i < ireps && p + 6 <= end; i++) {
+        dbg->records[i] = p;
+        if (READ_U32(p) < 6) break;
+        p += READ_U32(p);
+    }
+    dbg->record_count = i;
+    return 1;
+}
+
+// Decode a packed varint (mruby's debug line maps)
+static uint32_t packed_int(const uint8_t** p) {
+    uint32_t n = 0;
+    unsigned shift = 0;
+
+    do {
+        n |= (uint32_t)(**p & 0x7F) << shift;
+        shift += 7;
+    } while (*(*p)++ & 0x80 && shift < 32);
+    return n;
+}
+
+// Source line of the instruction at off in an IREP; 0 if unknown
+static unsigned debug_line(const uint8_t* rec, uint32_t off, unsigned* file) {
+    const uint8_t* p = rec + 6;
+    const uint8_t* lines;
+    const uint8_t* best = 0;
+    unsigned files = READ_U16(rec + 4);
+    uint32_t start, count, pos, line, i;
+    uint8_t type;
+
+    // File entries: u32 start, u16 filename, u32 count, u8 type, lines;
+    // the last one starting at or before off holds it
+    for (i = 0; i < files; i++) {
+        start = READ_U32(p);
+        count = READ_U32(p + 6);
+        type = p[10];
+        if (start <= off) best = p;
+        p += 11 + (type == 0 ? 2 * count : type == 1 ? 6 * count : count);
+    }
+    if (!best) {
+        return 0;
+    }
+
+    start = READ_U32(best);
+    *file = READ_U16(best + 4);
+    count = READ_U32(best + 6);
+    type = best[10];
+    lines = best + 11;
+    off -= start;
+    switch (type) {
+        case 0:     // One u16 line per instruction byte
+            return off < count ? READ_U16(lines + 2 * off) : 0;
+        case 1:     // (u32 pc, u16 line) pairs
+            for (line = 0, i = 0; i < count && READ_U32(lines + 6 * i) <= off; i++) {
+                line = READ_U16(lines + 6 * i + 4);
+            }
+            return line;
+        case 2:     // Varint (pc delta, line delta) pairs
+            p = lines;
+            pos = 0;
+            line = 0;
+            while (p < lines + count) {
+                pos += packed_int(&p);
+                i = packed_int(&p);
+                if (off < pos) break;
+                line += i;
+            }
+            return line;
+        default:
+            return 0;
+    }
+}
+
+// Text of a source line, trimmed; "" if the file can't be read
+static const char* source_line(const char* path, unsigned line) {
+    static char text[256];
+    static char last_path[256];
+    static FILE* f;
+    unsigned n;
+    char* s;
+
+    if (!f || strcmp(path, last_path) != 0) {
+        if (f) fclose(f);
+        f = fopen(path, "r");
+        snprintf(last_path, sizeof(last_path), "%s", path);
+    }
+    if (!f) {
+        return "";
+    }
+    rewind(f);
+    for (n = 0; n < line && fgets(text, sizeof(text), f); n++) {
+    }
+    if (n < line) {
+        return "";
+    }
+    for (s = text; *s == ' ' || *s == '\t'; s++) {
+    }
+    s[strcspn(s, "\r\n")] = 0;
+    if (strlen(s) > SOURCE_MAX) {
+        strcpy(s + SOURCE_MAX - 3, "...");
+    }
+    return s;
+}
+
+// Add samples to the entry matching e, or a new one
+static void count(entry* entries, unsigned* n, const entry* e) {
+    unsigned i;
+
+    for (i = 0; i < *n; i++) {
+        if (entries[i].kind == e->kind && entries[i].file == e->file && entries[i].line == e->line &&
+            entries[i].irep == e->irep && entries[i].pc == e->pc && entries[i].sym == e->sym) {
+            entries[i].samples += e->samples;
+            return;
+        }
+    }
+    entries[(*n)++] = *e;
+}
+
+static int by_samples(const void* a, const void* b) {
+    const entry* x = a;
+    const entry* y = b;
+    return x->samples < y->samples ? 1 : x->samples > y->samples ? -1 : 0;
+}
+
+int main(int argc, char** argv) {
+    static mrbz_vm vm;
+    const char* path = 0;
+    const char* sav_path = 0;
+    uint8_t* bytecode;
+    uint8_t* sav;
+    long size, sav_size;
+    profile_log log;
+    debug_info dbg;
+    int has_debug;
+    entry* entries;
+    entry e;
+    unsigned n, top = 30, i, j;
+    uint32_t samples, counted, pc;
+    uint16_t rate;
+    int a;
+
+    for (a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "--top") && a + 1 < argc) {
+            top = (unsigned)strtoul(argv[++a], 0, 0);
+        } else if (!path) {
+            path = argv[a];
+        } else {
+            sav_path = argv[a];
+        }
+    }
+    if (!path || !sav_path) {
+        fprintf(stderr, "usage: %s [--top N] program.mrb profile.sav\n", argv[0]);
+        return 2;
+    }
+
+    bytecode = read_file(path, &size);
+    if (!bytecode || size < 32 || memcmp(bytecode, "RITE0300", 8) != 0) {
+        fprintf(stderr, "%s: %s is not RITE0300 bytecode\n", argv[0], path);
+        return 1;
+    }
+    sav = read_file(sav_path, &sav_size);
+    if (!sav || !profile_open(&log, sav, sav_size > SRAM_LOG_SIZE ? SRAM_LOG_SIZE : (uint16_t)sav_size,
+                              &samples, &rate)) {
+        fprintf(stderr, "%s: %s holds no profile\n", argv[0], sav_path);
+        return 1;
+    }
+    if (profile_fingerprint_of(&log) != profile_fingerprint(bytecode)) {
+        fprintf(stderr, "%s: %s was not taken running %s\n", argv[0], sav_path, path);
+        return 1;
+    }
+
+    mrbz_vm_init(&vm);
+    mrbz_vm_load(&vm, bytecode);
+    if (vm.irep_count == 0) {
+        fprintf(stderr, "%s: cannot load %s\n", argv[0], path);
+        return 1;
+    }
+    memset(&dbg, 0, sizeof(dbg));
+    has_debug = read_debug(bytecode, size, vm.irep_count, &dbg);
+
+    // Builtins by symbol, then the interpreter by line (or pc)
+    entries = calloc(PROFILE_BUILTINS + log.buckets, sizeof(entry));
+    n = 0;
+    counted = 0;
+    for (i = 0; i < PROFILE_BUILTINS; i++) {
+        memset(&e, 0, sizeof(e));
+        e.samples = profile_builtin_count(&log, (uint8_t)i);
+        if (!e.samples) continue;
+        e.kind = ENTRY_BUILTIN;
+        e.sym = i;
+        count(entries, &n, &e);
+        counted += e.samples;
+    }
+    for (i = 0; i < log.buckets; i++) {
+        memset(&e, 0, sizeof(e));
+        e.samples = profile_bucket_count(&log, (uint16_t)i);
+        if (!e.samples) continue;
+        counted += e.samples;
+        pc = (uint32_t)i << log.shift;
+        e.kind = ENTRY_OUTSIDE;
+        for (j = 0; j < vm.irep_count; j++) {
+            if (pc >= vm.ireps[j].insns && pc < vm.ireps[j].end) break;
+        }
+        if (j < vm.irep_count) {
+            e.kind = ENTRY_PC;
+            e.irep = j;
+            e.pc = pc - vm.ireps[j].insns;
+            if (has_debug && j < dbg.record_count) {
+                e.line = debug_line(dbg.records[j], e.pc, &e.file);
+                if (e.line && e.file < dbg.file_count && dbg.files[e.file]) {
+                    e.kind = ENTRY_LINE;
+                    e.irep = 0;
+                    e.pc = 0;
+                }
+            }
+        }
+        count(entries, &n, &e);
+    }
+    qsort(entries, n, sizeof(entry), by_samples);
+
+    printf("%s: %u samples", sav_path, samples);
+    if (rate) {
+        printf(" at %u Hz (%.1f s)", rate, (double)samples / rate);
+    }
+    printf(", pc buckets of %u byte%s\n", 1u << log.shift, log.shift ? "s" : "");
+    if (counted < samples) {
+        printf("  %u samples saturated a counter or caught a torn pc\n", samples - counted);
+    }
+    if (!has_debug) {
+        printf("  no debug info in %s (compile with mrbc -g for source lines)\n", path);
+    }
+    printf("  samples      %%  where\n");
+    for (i = 0; i < n && (top == 0 || i < top); i++) {
+        printf("  %7u  %5.1f%%  ", entries[i].samples,
+               counted ? 100.0 * entries[i].samples / counted : 0.0);
+        switch (entries[i].kind) {
+            case ENTRY_BUILTIN:
+                printf("%s (builtin)\n", entries[i].sym < vm.sym_count ?
+                       mrbz_get_symbol(&vm, (uint8_t)entries[i].sym) : "?");
+                break;
+            case ENTRY_LINE:
+                printf("%s:%u  %s\n", dbg.files[entries[i].file], entries[i].line,
+                       source_line(dbg.files[entries[i].file], entries[i].line));
+                break;
+            case ENTRY_PC:
+                printf("irep %u pc %u\n", entries[i].irep, entries[i].pc);
+                break;
+            default:
+                printf("(startup, outside any IREP)\n");
+                break;
+        }
+    }
+
+    free(entries);
+    free(sav);
+    free(bytecode);
+    return 0;
+}
@@ -0,0 +1,96 @@
+/**
+ * mrbz - Minimal Ruby for Game Boy
+ * Trace decoder: prints an mrbz_trace_dump with the program's names
+ *
+ * The dump holds only pcs, opcodes and one register value per
+ * instruction; the operands, symbol names and IREPs come from the loaded
+ * program, so the VM the dump is decoded with must have loaded the same
+ * bytecode as the one that was traced.
+ */
+
+#include <stdio.h>
+#include "host.h"
+
+// Print a traced value (type and the two value bytes as stored)
+static void print_value(FILE* out, mrbz_vm* vm, uint8_t type, const uint8_t* v) {
+    int16_t i = (int16_t)(v[0] | (v[1] << 8));
+
+    switch (type) {
+        case MRBZ_T_NIL:    fprintf(out, "nil"); break;
+        case MRBZ_T_FALSE:  fprintf(out, "false"); break;
+        case MRBZ_T_TRUE:   fprintf(out, "true"); break;
+        case MRBZ_T_INT:    fprintf(out, "%d", i); break;
+        case MRBZ_T_FIXED:  fprintf(out, "%.3f", i / (double)MRBZ_FIXED_ONE); break;
+        case MRBZ_T_SYMBOL:
+            fprintf(out, ":%s", v[0] < vm->sym_count ? mrbz_get_symbol(vm, v[0]) : "?");
+            break;
+        case MRBZ_T_ARRAY:  fprintf(out, "array #%u", v[0]); break;
+        case MRBZ_T_HASH:   fprintf(out, "hash #%u", v[0]); break;
+        case MRBZ_T_CLASS:  fprintf(out, "%s", v[0] < MRBZ_CLASS_COUNT ? mrbz_class_names[v[0]] : "?"); break;
+        case MRBZ_T_PROC:   fprintf(out, "block (irep %u)", v[0]); break;
+        case MRBZ_T_FIBER:  fprintf(out, "fiber #%u", v[0]); break;
+        case MRBZ_T_RANGE:  fprintf(out, "%d...%d", (int8_t)v[0], (int8_t)v[0] + v[1]); break;
+        default:            fprintf(out, "type %u", type); break;
+    }
+}
+
+int host_trace_print(FILE* out, mrbz_vm* vm, const uint8_t* dump, long len) {
+    const mrbz_irep* irep;
+    const uint8_t* rec;
+    const uint8_t* ip;
+    uint16_t pc;
+    uint8_t j, n;
+    long count, k;
+    uint8_t sym;
+
+    if (len < 3 || dump[0] != 'M' || dump[1] != 'T' || (len - 3) % MRBZ_TRACE_REC) {
+        return 0;
+    }
+    count = (len - 3) / MRBZ_TRACE_REC;
+    fprintf(out, "last %ld instructions, oldest first:\n", count);
+    for (k = 0; k < count; k++) {
+        rec = dump + 3 + k * MRBZ_TRACE_REC;
+        pc = rec[0] | (rec[1] << 8);
+
+        // The IREP holding pc gives the symbol table and register count
+        irep = 0;
+        for (j = 0; j < vm->irep_count; j++) {
+            if (pc >= vm->ireps[j].insns && pc < vm->ireps[j].end) {
+                irep = &vm->ireps[j];
+                break;
+            }
+        }
+        fprintf(out, "  %5u", pc);
+        if (irep) {
+            fprintf(out, "  irep %u +%-4u", j, pc - irep->insns);
+        } else {
+            fprintf(out, "  %-12s", "?");
+        }
+        fprintf(out, "  %-10s", host_op_name(rec[2]));
+
+        // Operands from the program, as far as they were traced right
+        ip = vm->bytecode + pc;
+        if (irep && ip[0] == rec[2]) {
+            for (n = 1; n < mrbz_op_length(ip[0]); n++) {
+                fprintf(out, " %3u", ip[n]);
+            }
+            for (; n < 5; n++) {
+                fprintf(out, "    ");
+            }
+            sym = mrbz_sym_operand(ip);
+            if (sym != 0xFF && irep->syms + sym < vm->irep_sym_count) {
+                fprintf(out, "  %-14s", mrbz_get_symbol(vm, vm->irep_syms[irep->syms + sym]));
+            } else {
+                fprintf(out, "  %-14s", "");
+            }
+            if (rec[3] < irep->nregs) {
+                fprintf(out, "  R%u = ", rec[3]);
+                print_value(out, vm, rec[4], rec + 5);
+            }
+        } else {
+            fprintf(out, "  (not this program's instruction)");
+        }
+        fprintf(out, "\n");
+    }
+    return 1;
+}
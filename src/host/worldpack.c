@@ -0,0 +1,136 @@
+/**
+ * mrbz - Minimal Ruby for Game Boy
+ * World map packing for the host tools (format in src/gb/world.c)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host.h"
+
+// Tile for a map character (the characters host_dump_screen prints);
+// returns 0 for characters that aren't tiles
+static uint8_t char_tile(char c, uint8_t* tile) {
+    switch (c) {
+        case '.': *tile = TILE_EMPTY; return 1;
+        case '@': *tile = TILE_HEAD;  return 1;
+        case 'o': *tile = TILE_BODY;  return 1;
+        case '*': *tile = TILE_FOOD;  return 1;
+        case '-': *tile = TILE_MINUS; return 1;
+        default:  break;
+    }
+    if (c >= '0' && c <= '9') {
+        *tile = TILE_DIGIT0 + (c - '0');
+        return 1;
+    }
+    if (c >= 'A' && c <= 'Z') {
+        *tile = TILE_LETTER_A + (c - 'A');
+        return 1;
+    }
+    return 0;
+}
+
+// Run-length code n tiles; returns bytes written to out (at most 2n)
+static uint32_t pack_segment(const uint8_t* t, uint8_t n, uint8_t* out) {
+    uint32_t len = 0;
+    uint8_t i = 0, run, lit;
+
+    while (i < n) {
+        for (run = 1; i + run < n && t[i + run] == t[i]; run++) {
+        }
+        if (run >= 2) {
+            out[len++] = 0x7F + run;
+            out[len++] = t[i];
+            i += run;
+            continue;
+        }
+        // Literals up to the next pair of equal tiles
+        for (lit = 1; i + lit < n && !(i + lit + 1 < n && t[i + lit] == t[i + lit + 1]); lit++) {
+        }
+        out[len++] = lit - 1;
+        memcpy(out + len, t + i, lit);
+        len += lit;
+        i += lit;
+    }
+    return len;
+}
+
+uint8_t* host_world_pack(const uint8_t* tiles, uint16_t w, uint16_t h, uint32_t* size) {
+    uint32_t segs, len, off, x, y;
+    uint8_t n;
+    uint8_t* out;
+
+    if (w == 0 || h == 0 || w > WORLD_MAX || h > WORLD_MAX) {
+        return 0;
+    }
+    segs = (w + WORLD_SEG - 1) / WORLD_SEG;
+
+    // Worst case: every segment all literals
+    out = malloc(4 + 2 * segs * h + (uint32_t)w * h + segs * h);
+    if (!out) {
+        return 0;
+    }
+    out[0] = w & 0xFF;
+    out[1] = w >> 8;
+    out[2] = h & 0xFF;
+    out[3] = h >> 8;
+    len = 4 + 2 * segs * h;
+    for (y = 0; y < h; y++) {
+        for (x = 0; x < w; x += WORLD_SEG) {
+            off = 4 + 2 * (y * segs + x / WORLD_SEG);
+            if (len > 0xFFFF) {
+                free(out);
+                return 0;
+            }
+            out[off] = len & 0xFF;
+            out[off + 1] = len >> 8;
+            n = (uint8_t)(w - x < WORLD_SEG ? w - x : WORLD_SEG);
+            len += pack_segment(tiles + y * w + x, n, out + len);
+        }
+    }
+    *size = len;
+    return out;
+}
+
+uint8_t* host_world_read(const char* path, uint16_t* w, uint16_t* h) {
+    FILE* f;
+    char line[WORLD_MAX + 2];
+    uint8_t* tiles;
+    uint32_t x, y, n;
+
+    f = fopen(path, "r");
+    if (!f) {
+        return 0;
+    }
+
+    // Width of the longest line
+    *w = 0;
+    *h = 0;
+    while (fgets(line, sizeof(line), f)) {
+        n = (uint32_t)strcspn(line, "\r\n");
+        if (n > *w) *w = (uint16_t)n;
+        if (++*h > WORLD_MAX) break;
+    }
+    if (*w == 0 || *w > WORLD_MAX || *h > WORLD_MAX) {
+        fclose(f);
+        return 0;
+    }
+
+    // Short lines are padded with empty tiles
+    tiles = malloc((uint32_t)*w * *h);
+    memset(tiles, TILE_EMPTY, (uint32_t)*w * *h);
+    rewind(f);
+    for (y = 0; y < *h && fgets(line, sizeof(line), f); y++) {
+        n = (uint32_t)strcspn(line, "\r\n");
+        for (x = 0; x < n; x++) {
+            if (!char_tile(line[x], &tiles[y * *w + x])) {
+                fprintf(stderr, "%s:%u: '%c' is not a tile\n", path, y + 1, line[x]);
+                free(tiles);
+                fclose(f);
+                return 0;
+            }
+        }
+    }
+    fclose(f);
+    return tiles;
+}
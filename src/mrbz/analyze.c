@@ -0,0 +1,650 @@
+/**
+ * mrbz - Minimal Ruby for Game Boy
+ * Load-time bytecode analysis
+ */
+
+#include "vm.h"
+#include "opcodes.h"
+
+// Operand bytes per opcode (Z=0, B=1, BB=2, BBB=3, BS=3, BSS=5, S=2, W=3)
+static const uint8_t op_size[OP_STOP + 1] = {
+    0, 2,                               // NOP MOVE
+    2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, // LOADL..LOADI_7
+    3, 5, 2, 1, 1, 1, 1,                // LOADI16 LOADI32 LOADSYM LOADNIL LOADSELF LOADT LOADF
+    2, 2, 2, 2, 2, 2, 2, 2,             // GETGV..SETCV
+    2, 2, 2, 2,                         // GETCONST SETCONST GETMCNST SETMCNST
+    3, 3, 1, 1,                         // GETUPVAR SETUPVAR GETIDX SETIDX
+    2, 3, 3, 3, 2,                      // JMP JMPIF JMPNOT JMPNIL JMPUW
+    1, 2, 1,                            // EXCEPT RESCUE RAISEIF
+    3, 3, 3, 3, 0, 2, 3, 3, 2, 0, 2,    // SSEND..KARG
+    1, 1, 1, 3,                         // RETURN RETURN_BLK BREAK BLKPUSH
+    1, 2, 1, 2, 1, 1,                   // ADD ADDI SUB SUBI MUL DIV
+    1, 1, 1, 1, 1,                      // EQ LT LE GT GE
+    2, 3, 1, 2, 1, 3, 3, 3,             // ARRAY ARRAY2 ARYCAT ARYPUSH ARYDUP AREF ASET APOST
+    1, 2, 2, 1,                         // INTERN SYMBOL STRING STRCAT
+    2, 2, 1,                            // HASH HASHADD HASHCAT
+    2, 2, 2,                            // LAMBDA BLOCK METHOD
+    1, 1,                               // RANGE_INC RANGE_EXC
+    1, 2, 2, 2, 2, 2, 1, 1, 1,          // OCLASS CLASS MODULE EXEC DEF ALIAS UNDEF SCLASS TCLASS
+    3, 1,                               // DEBUG ERR
+    0, 0, 0, 0                          // EXT1 EXT2 EXT3 STOP
+};
+
+// Total instruction length in bytes (0 for an unknown opcode)
+uint8_t mrbz_op_length(uint8_t op) {
+    if (op > OP_STOP) {
+        return 0;
+    }
+    return op_size[op] + 1;
+}
+
+// Opcodes mrbz_vm_exec implements, one bit per opcode
+// Keep in sync with the switch in vm.c: anything missing here is rejected
+// at load time instead of stopping the program when it is reached.
+#define OPBIT(op) ((uint8_t)(1 << ((op) & 7)))
+static const uint8_t op_supported[(MRBZ_OP_COUNT + 7) / 8] = {
+    // 0x00-0x07: NOP MOVE LOADL LOADI LOADINEG LOADI__1 LOADI_0 LOADI_1
+    0xFF,
+    // 0x08-0x0F: LOADI_2..LOADI_7 LOADI16 (not LOADI32)
+    0x7F,
+    // 0x10-0x17: LOADSYM LOADNIL LOADSELF LOADT LOADF GETGV SETGV (not GETSV)
+    0x7F,
+    // 0x18-0x1F: GETIV SETIV GETCONST SETCONST (not SETSV GETCV SETCV GETMCNST)
+    0x66,
+    // 0x20-0x27: GETUPVAR SETUPVAR GETIDX SETIDX JMP JMPIF JMPNOT (not SETMCNST)
+    0xFE,
+    // 0x28-0x2F: JMPNIL SSEND SSENDB SEND
+    0xE1,
+    // 0x30-0x37: SENDB ENTER
+    0x11,
+    // 0x38-0x3F: RETURN RETURN_BLK ADD ADDI SUB SUBI
+    0xF3,
+    // 0x40-0x47: MUL DIV EQ LT LE GT GE ARRAY
+    0xFF,
+    // 0x48-0x4F: ARRAY2 AREF ASET
+    0x31,
+    // 0x50-0x57: HASH HASHADD LAMBDA BLOCK (not HASHCAT)
+    0xD8,
+    // 0x58-0x5F: RANGE_INC RANGE_EXC
+    0x06,
+    // 0x60-0x67: none
+    0x00,
+    // 0x68-0x69: STOP
+    0x02
+};
+
+#if MRBZ_STRIP
+// Opcodes left in this build (mrbz_config.h); the rest were compiled out
+static const uint8_t op_used[(MRBZ_OP_COUNT + 7) / 8] = MRBZ_OPS_USED;
+#endif
+
+// True if the VM implements an opcode
+uint8_t mrbz_op_supported(uint8_t op) {
+    if (op >= MRBZ_OP_COUNT) {
+        return 0;
+    }
+#if MRBZ_STRIP
+    if (!(op_used[op >> 3] & OPBIT(op))) {
+        return 0;
+    }
+#endif
+    return (op_supported[op >> 3] & OPBIT(op)) != 0;
+}
+
+// Symbol operand of an instruction (IREP-local index), or 0xFF
+uint8_t mrbz_sym_operand(const uint8_t* ip) {
+    switch (ip[0]) {
+        case OP_LOADSYM:
+        case OP_GETGV: case OP_SETGV: case OP_GETSV: case OP_SETSV:
+        case OP_GETIV: case OP_SETIV: case OP_GETCV: case OP_SETCV:
+        case OP_GETCONST: case OP_SETCONST: case OP_GETMCNST: case OP_SETMCNST:
+        case OP_SSEND: case OP_SSENDB: case OP_SEND: case OP_SENDB:
+        case OP_KEY_P: case OP_KARG:
+        case OP_CLASS: case OP_MODULE: case OP_DEF: case OP_ALIAS:
+            return ip[2];
+        case OP_UNDEF:
+            return ip[1];
+        default:
+            return 0xFF;
+    }
+}
+
+// Map an IREP-local symbol to the shared table (0xFF if there is none)
+static uint8_t irep_symbol(mrbz_vm* vm, const mrbz_irep* irep, uint8_t local) {
+    uint16_t i = (uint16_t)irep->syms + local;
+
+    if (local == 0xFF || i >= vm->irep_sym_count) {
+        return 0xFF;
+    }
+    return vm->irep_syms[i];
+}
+
+// Method called by the first send at or after pc in an IREP (0xFF if none)
+static uint8_t next_call(mrbz_vm* vm, const mrbz_irep* irep, uint16_t pc) {
+    const uint8_t* ip;
+    uint8_t len;
+
+    for (; pc < irep->end; pc += len) {
+        ip = vm->bytecode + pc;
+        len = mrbz_op_length(ip[0]);
+        if (len == 0) break;
+        switch (ip[0]) {
+            case OP_SSEND: case OP_SSENDB: case OP_SEND: case OP_SENDB:
+                return irep_symbol(vm, irep, ip[2]);
+            default:
+                break;
+        }
+    }
+    return 0xFF;
+}
+
+// True for a GETGV/SETGV whose global didn't get a slot (too many globals)
+static uint8_t global_missing(mrbz_vm* vm, const mrbz_irep* irep, const uint8_t* ip) {
+    uint8_t sym;
+
+    if (ip[0] != OP_GETGV && ip[0] != OP_SETGV) {
+        return 0;
+    }
+    sym = irep_symbol(vm, irep, ip[2]);
+    return sym >= vm->sym_count || vm->sym_global[sym] == MRBZ_GLOBAL_NONE;
+}
+
+// Scan every IREP for instructions the VM can't run
+// Returns how many were found; report (if set) is called for each one.
+uint16_t mrbz_vm_verify(mrbz_vm* vm, mrbz_verify_fn report, void* user) {
+    const mrbz_irep* irep;
+    const uint8_t* ip;
+    mrbz_bad_op bad;
+    uint16_t pc, count = 0;
+    uint8_t i, len, ext = 0;
+
+    for (i = 0; i < vm->irep_count; i++) {
+        irep = &vm->ireps[i];
+        for (pc = irep->insns; pc < irep->end; pc += len) {
+            ip = vm->bytecode + pc;
+            len = mrbz_op_length(ip[0]);
+            if (len != 0) {
+                // OP_EXTn widens the next instruction's operands
+                len += ext;
+                ext = ip[0] == OP_EXT3 ? 2 : (ip[0] == OP_EXT1 || ip[0] == OP_EXT2);
+            }
+            if (len != 0 && mrbz_op_supported(ip[0]) && !global_missing(vm, irep, ip)) continue;
+
+            count++;
+            if (report) {
+                bad.pc = pc;
+                bad.irep = i;
+                bad.op = ip[0];
+                bad.sym = len != 0 ? irep_symbol(vm, irep, mrbz_sym_operand(ip)) : 0xFF;
+                bad.call = len != 0 ? next_call(vm, irep, pc + len) : 0xFF;
+                report(vm, &bad, user);
+            }
+            // Unknown opcode: the rest of this IREP can't be decoded
+            if (len == 0) break;
+        }
+        ext = 0;
+    }
+    return count;
+}
+
+// Global variables
+//
+// Every symbol used by GETGV/SETGV gets the next slot of vm->globals, so the
+// instructions become a table index. A global is flagged MRBZ_GV_CONST when
+// all its writes are in the top level's opening straight-line code: before
+// the first jump (so they run exactly once, in order) and before the first
+// call that can run other Ruby code (so no fiber sees it change). After that
+// point its value never changes, and passes that know they run later (the
+// main loop) may treat reads of it like a constant: the JIT compiles them
+// as loads of the value. A global that is never written is constant too
+// (always nil).
+
+// Offset just past the top level's opening straight-line code: up to the
+// first jump, reentering call or jump target (a loop may start earlier
+// than its backward jump)
+static uint16_t straight_line_end(mrbz_vm* vm) {
+    const mrbz_irep* irep = &vm->ireps[0];
+    const uint8_t* syms = &vm->irep_syms[irep->syms];
+    const uint8_t* ip;
+    uint16_t pc, end, target;
+    uint8_t len, sym;
+
+    end = irep->end;
+    for (pc = irep->insns; pc < irep->end; pc += len) {
+        ip = vm->bytecode + pc;
+        len = mrbz_op_length(ip[0]);
+        if (len == 0) {
+            return pc < end ? pc : end;
+        }
+        switch (ip[0]) {
+            case OP_JMP:
+                target = pc + len + (int16_t)(((uint16_t)ip[1] << 8) | ip[2]);
+                break;
+            case OP_JMPIF: case OP_JMPNOT: case OP_JMPNIL:
+                target = pc + len + (int16_t)(((uint16_t)ip[2] << 8) | ip[3]);
+                break;
+            case OP_JMPUW: case OP_RETURN: case OP_STOP:
+                target = pc;
+                break;
+            case OP_SSEND: case OP_SSENDB: case OP_SEND: case OP_SENDB:
+                sym = syms[ip[2]];
+                if (sym < vm->sym_count &&
+                    !(mrbz_builtin_flags(vm->sym_builtin[sym]) & MRBZ_BF_REENTERS)) {
+                    continue;
+                }
+                target = pc;
+                break;
+            default:
+                continue;
+        }
+        // Stop at the jump itself and at wherever it lands
+        if (pc < end) end = pc;
+        if (target < end) end = target;
+    }
+    return end;
+}
+
+// Assign global slots in order of first use and flag the constant ones
+void mrbz_analyze_globals(mrbz_vm* vm) {
+    const mrbz_irep* irep;
+    const uint8_t* ip;
+    uint16_t pc, prologue;
+    uint8_t i, len, sym, slot;
+
+    prologue = vm->irep_count ? straight_line_end(vm) : 0;
+    for (i = 0; i < vm->irep_count; i++) {
+        irep = &vm->ireps[i];
+        for (pc = irep->insns; pc < irep->end; pc += len) {
+            ip = vm->bytecode + pc;
+            len = mrbz_op_length(ip[0]);
+            if (len == 0) break;
+            if (ip[0] != OP_GETGV && ip[0] != OP_SETGV) continue;
+
+            sym = irep_symbol(vm, irep, ip[2]);
+            if (sym >= vm->sym_count) continue;
+            slot = vm->sym_global[sym];
+            if (slot == MRBZ_GLOBAL_NONE) {
+                if (vm->global_count >= MRBZ_MAX_GLOBALS) continue;
+                slot = vm->global_count++;
+                vm->sym_global[sym] = slot;
+                MRBZ_SET_NIL(vm->globals[slot]);
+                vm->global_flags[slot] = MRBZ_GV_CONST;
+            }
+            // Only the top level's opening writes keep a global constant
+            if (ip[0] == OP_SETGV && (i != 0 || pc >= prologue)) {
+                vm->global_flags[slot] &= ~MRBZ_GV_CONST;
+            }
+        }
+    }
+}
+
+// Escape analysis for array literals
+//
+// An OP_ARRAY/OP_ARRAY2 result that is only indexed, compared, mutated or
+// handed to non-retaining builtins before its register is overwritten can
+// live in a fixed per-site scratch slot instead of the GC pool. The scan
+// follows every path from the literal with a small branch stack and a step
+// budget; anything it can't prove safe counts as an escape.
+
+#define ESC_STEPS  128   // Instructions examined per literal
+#define ESC_STACK  4     // Pending branch targets
+
+// What an instruction does with the tracked register
+#define USE_NONE    0    // Doesn't touch it
+#define USE_SAFE    1    // Reads it without storing it anywhere
+#define USE_KILL    2    // Overwrites it (the literal is dead)
+#define USE_ESCAPE  3    // Stores, copies or returns it (or unknown)
+
+// True if r falls in R[lo]..R[lo+count-1]
+#define IN_WINDOW(r, lo, count) ((r) >= (lo) && (r) < (lo) + (count))
+
+// Classify one instruction's use of register r
+static uint8_t classify_use(mrbz_vm* vm, const uint8_t* syms, const uint8_t* ip, uint8_t r) {
+    uint8_t a = ip[1], b = ip[2], c = ip[3];
+    uint8_t argc, flags;
+
+    switch (ip[0]) {
+        case OP_NOP:
+        case OP_ENTER:
+        case OP_JMP:
+            return USE_NONE;
+
+        case OP_LOADL: case OP_LOADI: case OP_LOADINEG: case OP_LOADI__1:
+        case OP_LOADI_0: case OP_LOADI_1: case OP_LOADI_2: case OP_LOADI_3:
+        case OP_LOADI_4: case OP_LOADI_5: case OP_LOADI_6: case OP_LOADI_7:
+        case OP_LOADI16: case OP_LOADSYM: case OP_LOADNIL: case OP_LOADSELF:
+        case OP_LOADT: case OP_LOADF: case OP_GETIV: case OP_GETCONST:
+        case OP_GETUPVAR: case OP_BLOCK: case OP_LAMBDA: case OP_GETGV:
+            return a == r ? USE_KILL : USE_NONE;
+
+        case OP_MOVE:
+            if (b == r) return USE_ESCAPE;  // Aliases are not tracked
+            return a == r ? USE_KILL : USE_NONE;
+
+        case OP_SETIV:
+        case OP_SETGV:
+        case OP_SETCONST:
+        case OP_SETUPVAR:
+        case OP_RETURN:
+        case OP_RETURN_BLK:
+            return a == r ? USE_ESCAPE : USE_NONE;
+
+        // Binary ops read R[a], R[a+1] and overwrite R[a]
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+        case OP_EQ: case OP_LT: case OP_LE: case OP_GT: case OP_GE:
+        case OP_GETIDX: case OP_RANGE_INC: case OP_RANGE_EXC:
+            if (a == r) return USE_KILL;
+            return a + 1 == r ? USE_SAFE : USE_NONE;
+
+        case OP_ADDI:
+        case OP_SUBI:
+            return a == r ? USE_KILL : USE_NONE;
+
+        case OP_JMPIF:
+        case OP_JMPNOT:
+        case OP_JMPNIL:
+            return a == r ? USE_SAFE : USE_NONE;
+
+        case OP_AREF:
+            if (a == r) return USE_KILL;
+            return b == r ? USE_SAFE : USE_NONE;
+
+        case OP_ASET:
+            if (a == r) return USE_ESCAPE;
+            return b == r ? USE_SAFE : USE_NONE;
+
+        case OP_SETIDX:
+            if (a + 2 == r) return USE_ESCAPE;
+            return IN_WINDOW(r, a, 2) ? USE_SAFE : USE_NONE;
+
+        case OP_ARRAY:
+            if (IN_WINDOW(r, a, b)) return USE_ESCAPE;
+            return a == r ? USE_KILL : USE_NONE;
+
+        case OP_ARRAY2:
+            if (IN_WINDOW(r, b, c)) return USE_ESCAPE;
+            return a == r ? USE_KILL : USE_NONE;
+
+        case OP_HASH:
+            if (IN_WINDOW(r, a, b * 2)) return USE_ESCAPE;
+            return a == r ? USE_KILL : USE_NONE;
+
+        case OP_HASHADD:
+            if (IN_WINDOW(r, a + 1, b * 2)) return USE_ESCAPE;
+            return a == r ? USE_SAFE : USE_NONE;
+
+        case OP_SEND:
+        case OP_SSEND:
+            argc = c & 0x0F;
+            if (argc == 15) argc = 1;      // Splat: one array, unpacked by the VM
+            if (c >> 4) argc = 0xF0;       // Keyword args: be conservative
+            b = syms[b];
+            if (b >= vm->sym_count) return USE_ESCAPE;
+            flags = mrbz_builtin_flags(vm->sym_builtin[b]);
+            // Ruby code run from the builtin (a fiber body) could reach the
+            // literal through an upvar, wherever it sits - only possible
+            // when the program has blocks at all
+            if ((flags & MRBZ_BF_REENTERS) && vm->irep_count > 1) return USE_ESCAPE;
+            if (!IN_WINDOW(r, a, argc + 1)) return USE_NONE;
+            if (flags & MRBZ_BF_RETAINS) return USE_ESCAPE;
+            return a == r ? USE_KILL : USE_SAFE;
+
+        default:
+            return USE_ESCAPE;
+    }
+}
+
+// Check whether the literal built at pc into R[r] can stay in scratch storage
+static uint8_t literal_escapes(mrbz_vm* vm, const mrbz_irep* irep, uint16_t pc, uint8_t r) {
+    const uint8_t* syms = &vm->irep_syms[irep->syms];
+    uint16_t start = irep->insns;
+    uint16_t end = irep->end;
+    uint16_t stack[ESC_STACK];
+    uint8_t sp = 0;
+    uint8_t steps = ESC_STEPS;
+    const uint8_t* ip;
+    uint8_t len;
+    int16_t offset;
+
+    pc += mrbz_op_length(vm->bytecode[pc]);
+    for (;;) {
+        if (pc >= end) {
+            // Fell off the end of the program: this path is done
+            if (sp == 0) return 0;
+            pc = stack[--sp];
+            continue;
+        }
+        if (steps-- == 0) return 1;
+
+        ip = vm->bytecode + pc;
+        len = mrbz_op_length(ip[0]);
+        if (len == 0) return 1;
+
+        switch (classify_use(vm, syms, ip, r)) {
+            case USE_ESCAPE:
+                return 1;
+            case USE_KILL:
+                // Literal is dead on this path
+                if (sp == 0) return 0;
+                pc = stack[--sp];
+                continue;
+            default:
+                break;
+        }
+
+        switch (ip[0]) {
+            case OP_JMP:
+                offset = (int16_t)(((uint16_t)ip[1] << 8) | ip[2]);
+                pc = pc + len + offset;
+                break;
+            case OP_JMPIF:
+            case OP_JMPNOT:
+            case OP_JMPNIL:
+                if (sp == ESC_STACK) return 1;
+                offset = (int16_t)(((uint16_t)ip[2] << 8) | ip[3]);
+                stack[sp++] = pc + len + offset;
+                pc += len;
+                break;
+            case OP_RETURN:
+            case OP_STOP:
+                if (sp == 0) return 0;
+                pc = stack[--sp];
+                break;
+            default:
+                pc += len;
+                break;
+        }
+        if (pc < start) return 1;
+    }
+}
+
+// Find array literals in an IREP that never escape and assign them
+// scratch slots (sites are bytecode offsets, unique across IREPs)
+void mrbz_analyze_escapes(mrbz_vm* vm, uint8_t irep_idx) {
+    const mrbz_irep* irep = &vm->ireps[irep_idx];
+    uint16_t pc;
+    uint8_t op, len, count, r;
+
+    for (pc = irep->insns; pc < irep->end; pc += len) {
+        op = vm->bytecode[pc];
+        len = mrbz_op_length(op);
+        if (len == 0) break;
+
+        if (op != OP_ARRAY && op != OP_ARRAY2) continue;
+        r = vm->bytecode[pc + 1];
+        count = vm->bytecode[pc + (op == OP_ARRAY ? 2 : 3)];
+        if (count > MRBZ_SCRATCH_LEN || vm->scratch_count >= MRBZ_MAX_SCRATCH) continue;
+
+        if (!literal_escapes(vm, irep, pc, r)) {
+            vm->scratch_pc[vm->scratch_count] = pc;
+            vm->scratch_count++;
+        }
+    }
+}
+
+// Jump tables for compare chains
+//
+// `if x == :up ... elsif x == :down ...` (and a run of `... if x == k`
+// statements) compiles to one test per key:
+//   MOVE/GETIV/GETGV R[t], x;  LOADSYM/LOADI R[t+1], key;  EQ R[t];  JMPNOT R[t], next
+// and `case x when :up ...` to:
+//   LOADSYM/LOADI R[t], key;  MOVE R[t+1], x;  SEND R[t], :===, 1;  JMPIF R[t], arm
+// A chain of such tests on the same subject gets a table from key to test,
+// and the compare instruction of every test dispatches through it: one
+// lookup replaces the rest of the chain. Only the compare registers are
+// written along the failing tests, so dispatch leaves them as the chain
+// would and the lowering is invisible to the program.
+
+#define SWITCH_MIN 3     // Shorter chains are not worth a table
+
+// One recognized test
+typedef struct {
+    uint16_t compare_pc;    // EQ or SEND
+    uint16_t next_pc;       // Next test (if it is one)
+    uint16_t arm_pc;        // Taken on a match
+    uint16_t source;        // Subject load, as op << 8 | operand
+    int16_t key;
+    uint8_t type;
+    uint8_t reg;
+    uint8_t eqq;
+} switch_test;
+
+// Immediate Symbol or Integer loaded into reg by the instruction at ip
+static uint8_t immediate_key(mrbz_vm* vm, const mrbz_irep* irep, const uint8_t* ip,
+                             uint8_t reg, switch_test* t) {
+    if (ip[1] != reg) return 0;
+    t->type = MRBZ_T_INT;
+    switch (ip[0]) {
+        case OP_LOADI__1: t->key = -1; return 1;
+        case OP_LOADI_0: case OP_LOADI_1: case OP_LOADI_2: case OP_LOADI_3:
+        case OP_LOADI_4: case OP_LOADI_5: case OP_LOADI_6: case OP_LOADI_7:
+            t->key = ip[0] - OP_LOADI_0;
+            return 1;
+        case OP_LOADI:    t->key = ip[2]; return 1;
+        case OP_LOADINEG: t->key = -(int16_t)ip[2]; return 1;
+        case OP_LOADI16:  t->key = (int16_t)(((uint16_t)ip[2] << 8) | ip[3]); return 1;
+        case OP_LOADSYM:
+            t->type = MRBZ_T_SYMBOL;
+            t->key = irep_symbol(vm, irep, ip[2]);
+            return t->key != 0xFF;
+        default:
+            return 0;
+    }
+}
+
+// Subject load into reg: a local, instance variable or global
+static uint8_t subject_load(const uint8_t* ip, uint8_t reg, switch_test* t) {
+    if (ip[1] != reg) return 0;
+    switch (ip[0]) {
+        case OP_MOVE: case OP_GETIV: case OP_GETGV:
+            t->source = ((uint16_t)ip[0] << 8) | ip[2];
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Recognize a test starting at pc
+static uint8_t match_test(mrbz_vm* vm, const mrbz_irep* irep, uint16_t pc, uint8_t eqq_sym,
+                          switch_test* t) {
+    const uint8_t* ip[4];
+    uint8_t i, len, r;
+
+    // Four instructions, all inside the IREP
+    for (i = 0; i < 4; i++) {
+        if (pc >= irep->end) return 0;
+        ip[i] = vm->bytecode + pc;
+        len = mrbz_op_length(ip[i][0]);
+        if (len == 0) return 0;
+        if (i == 2) t->compare_pc = pc;
+        pc += len;
+    }
+    r = ip[0][1];
+    t->reg = r;
+
+    if (ip[2][0] == OP_EQ && ip[2][1] == r && ip[3][0] == OP_JMPNOT && ip[3][1] == r &&
+        subject_load(ip[0], r, t) && immediate_key(vm, irep, ip[1], r + 1, t)) {
+        t->eqq = 0;
+        t->arm_pc = pc;
+        t->next_pc = pc + (int16_t)(((uint16_t)ip[3][2] << 8) | ip[3][3]);
+        return 1;
+    }
+    if (eqq_sym != 0xFF && ip[2][0] == OP_SEND && ip[2][1] == r && ip[2][3] == 1 &&
+        irep_symbol(vm, irep, ip[2][2]) == eqq_sym &&
+        ip[3][0] == OP_JMPIF && ip[3][1] == r &&
+        subject_load(ip[1], r + 1, t) && ip[1][0] == OP_MOVE &&
+        immediate_key(vm, irep, ip[0], r, t)) {
+        t->eqq = 1;
+        t->next_pc = pc;
+        t->arm_pc = pc + (int16_t)(((uint16_t)ip[3][2] << 8) | ip[3][3]);
+        return 1;
+    }
+    return 0;
+}
+
+// True if pc holds the compare of a test already in a table
+static uint8_t in_switch(mrbz_vm* vm, uint16_t compare_pc) {
+    uint8_t i, j;
+
+    for (i = 0; i < vm->switch_count; i++) {
+        for (j = 0; j < vm->switches[i].count; j++) {
+            if (vm->switches[i].test_pc[j] == compare_pc) return 1;
+        }
+    }
+    return 0;
+}
+
+// Build tables for the chains in an IREP (longest first from each start)
+void mrbz_analyze_switches(mrbz_vm* vm, uint8_t irep_idx) {
+    const mrbz_irep* irep = &vm->ireps[irep_idx];
+    mrbz_switch* sw;
+    switch_test first, t;
+    switch_test tests[MRBZ_SWITCH_CASES];
+    uint16_t pc, next;
+    int16_t lo, hi;
+    uint8_t i, j, n, len, eqq_sym;
+
+    eqq_sym = mrbz_find_symbol(vm, "===");
+    for (pc = irep->insns; pc < irep->end; pc += len) {
+        len = mrbz_op_length(vm->bytecode[pc]);
+        if (len == 0) break;
+        if (vm->switch_count >= MRBZ_MAX_SWITCHES) return;
+        if (!match_test(vm, irep, pc, eqq_sym, &first) || in_switch(vm, first.compare_pc)) continue;
+
+        // Follow the chain while tests share the subject, register and key
+        // type, and keys stay distinct and within the table span
+        tests[0] = first;
+        lo = hi = first.key;
+        n = 1;
+        next = first.next_pc;
+        while (n < MRBZ_SWITCH_CASES && match_test(vm, irep, next, eqq_sym, &t) &&
+               t.eqq == first.eqq && t.source == first.source && t.reg == first.reg &&
+               t.type == first.type) {
+            for (j = 0; j < n && tests[j].key != t.key; j++) {}
+            if (j < n) break;
+            if ((int32_t)(t.key > hi ? t.key : hi) - (t.key < lo ? t.key : lo) >= MRBZ_SWITCH_SPAN) break;
+            if (t.key < lo) lo = t.key;
+            if (t.key > hi) hi = t.key;
+            tests[n++] = t;
+            next = t.next_pc;
+        }
+        if (n < SWITCH_MIN) continue;
+
+        sw = &vm->switches[vm->switch_count++];
+        sw->count = n;
+        sw->type = first.type;
+        sw->reg = first.reg;
+        sw->eqq = first.eqq;
+        sw->base = lo;
+        sw->last_key = tests[n - 1].key;
+        sw->default_pc = tests[n - 1].next_pc;
+        for (i = 0; i < MRBZ_SWITCH_SPAN; i++) {
+            sw->case_of[i] = 0xFF;
+        }
+        for (i = 0; i < n; i++) {
+            sw->test_pc[i] = tests[i].compare_pc;
+            sw->arm_pc[i] = tests[i].arm_pc;
+            sw->case_of[tests[i].key - lo] = i;
+        }
+    }
+}
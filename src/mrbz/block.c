@@ -0,0 +1,88 @@
+/**
+ * mrbz - Minimal Ruby for Game Boy
+ * Blocks run to completion by builtins
+ *
+ * Range#each and friends call their block once per element from a native
+ * loop. The block runs in its own context whose registers are taken from
+ * vm->block_regs like a stack, so a block calling another iterator just
+ * takes the next window up. Because the loop lives on the C stack, the
+ * block can't be suspended halfway: the step budget doesn't preempt it,
+ * and wait_vbl or Fiber.yield inside it stops the VM with MRBZ_ERR_BLOCK.
+ * So does Fiber.new, since the block's context lives on the C stack and
+ * can't be a fiber's enclosing scope.
+ */
+
+#include "vm.h"
+
+// Required, optional, rest and post arguments in an ENTER aspec
+#define ASPEC_ARGS 0x7FFF80UL
+
+// Stop the VM with MRBZ_ERR_BLOCK at the call that was running
+void mrbz_block_fail(mrbz_vm* vm) {
+    vm->running = 0;
+    vm->error = MRBZ_ERR_BLOCK;
+    vm->error_pc = vm->ctx->pc - 4;  // Every send is 4 bytes; pc is past it
+}
+
+// True if the running context is a block called by a builtin
+uint8_t mrbz_block_active(mrbz_vm* vm) {
+    return vm->ctx->regs >= vm->block_regs &&
+           vm->ctx->regs < vm->block_regs + MRBZ_BLOCK_REGS;
+}
+
+// Set up a block for calling
+uint8_t mrbz_block_begin(mrbz_vm* vm, mrbz_block* blk, mrbz_value proc) {
+    const mrbz_irep* irep;
+    const uint8_t* ip;
+    uint32_t aspec;
+
+    if (proc.type != MRBZ_T_PROC) {
+        return 0;
+    }
+    irep = &vm->ireps[proc.v.irep];
+    if (irep->nregs > MRBZ_BLOCK_REGS - vm->block_top) {
+        mrbz_block_fail(vm);
+        return 0;
+    }
+
+    blk->ctx.regs = &vm->block_regs[vm->block_top];
+    vm->block_top += irep->nregs;
+    blk->ctx.parent = vm->ctx;
+    blk->ctx.irep = proc.v.irep;
+
+    // ENTER only says how many arguments the block takes; check once
+    // here and start every call past it
+    ip = vm->bytecode + irep->insns;
+    blk->entry = irep->insns;
+    blk->arg = 0;
+    if (ip[0] == OP_ENTER) {
+        aspec = ((uint32_t)ip[1] << 16) | ((uint16_t)ip[2] << 8) | ip[3];
+        blk->arg = (aspec & ASPEC_ARGS) != 0;
+        blk->entry += 4;
+    }
+    return 1;
+}
+
+// Run the block body once
+// Every call starts with its locals nil, as a fresh block activation does
+// in mruby, so nothing leaks from the previous element.
+void mrbz_block_call(mrbz_vm* vm, mrbz_block* blk, mrbz_value arg) {
+    mrbz_value ret;
+    uint8_t i, n;
+
+    n = vm->ireps[blk->ctx.irep].nregs;
+    for (i = 0; i < n; i++) {
+        MRBZ_SET_NIL(blk->ctx.regs[i]);
+    }
+    if (blk->arg) {
+        blk->ctx.regs[1] = arg;
+    }
+    blk->ctx.pc = blk->entry;
+    blk->ctx.status = MRBZ_CTX_RUNNING;
+    mrbz_vm_exec(vm, &blk->ctx, &ret);
+}
+
+// Release a block's registers
+void mrbz_block_end(mrbz_vm* vm, mrbz_block* blk) {
+    vm->block_top -= vm->ireps[blk->ctx.irep].nregs;
+}
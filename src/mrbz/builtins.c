@@ -11,7 +11,13 @@ extern void gb_draw_tile(mrbz_vm* vm, int16_t x, int16_t y, int16_t tile, mrbz_v
 extern void gb_clear_tile(mrbz_vm* vm, int16_t x, int16_t y, mrbz_value* ret);
 extern void gb_wait_vbl(mrbz_vm* vm, mrbz_value* ret);
 extern void gb_rand(mrbz_vm* vm, int16_t max, mrbz_value* ret);
+extern void gb_srand(mrbz_vm* vm, uint8_t argc, int16_t seed, mrbz_value* ret);
+extern void gb_rand_pos(mrbz_vm* vm, int16_t w, int16_t h, mrbz_value* ret);
 extern void gb_game_over(mrbz_vm* vm, int16_t score, mrbz_value* ret);
+extern void gb_draw_number(mrbz_vm* vm, int16_t x, int16_t y, int16_t n, uint8_t width, mrbz_value* ret);
+extern void gb_draw_text(mrbz_vm* vm, int16_t x, int16_t y, const char* text, mrbz_value* ret);
+extern void gb_scroll_to(mrbz_vm* vm, int16_t x, int16_t y, mrbz_value* ret);
+extern void gb_map_tile(mrbz_vm* vm, int16_t x, int16_t y, mrbz_value* ret);
 
 // Simple string comparison (SDCC-compatible)
 static uint8_t str_eq(const char* a, const char* b) {
@@ -23,91 +29,906 @@ static uint8_t str_eq(const char* a, const char* b) {
     return *a == *b;
 }
 
-// Dispatch built-in calls based on symbol name
-void mrbz_builtin_call(mrbz_vm* vm, uint8_t sym_idx, uint8_t argc, uint8_t base_reg, mrbz_value* ret) {
-    int16_t x, y, tile, score, max, size, i;
-    mrbz_value default_val;
-    uint8_t arr_idx;
-    const char* name;
+#if MRBZ_HAS_BUILTIN(read_joypad)
+// read_joypad -> :up, :down, :left, :right or nil
+static void bi_read_joypad(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    (void)argc;
+    gb_read_joypad(vm, &frame[0]);
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(draw_tile)
+// draw_tile(x, y, tile)
+static void bi_draw_tile(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    (void)argc;
+    gb_draw_tile(vm, frame[1].v.i, frame[2].v.i, frame[3].v.i, &frame[0]);
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(clear_tile)
+// clear_tile(x, y)
+static void bi_clear_tile(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    (void)argc;
+    gb_clear_tile(vm, frame[1].v.i, frame[2].v.i, &frame[0]);
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(draw_number)
+// draw_number(x, y, n, width = 0) - width pads with leading zeros
+static void bi_draw_number(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    int16_t width = 0;
+
+    if (argc >= 4 && frame[4].type == MRBZ_T_INT) {
+        width = frame[4].v.i;
+    }
+    if (width < 0) width = 0;
+    if (width > 255) width = 255;
+    gb_draw_number(vm, frame[1].v.i, frame[2].v.i, frame[3].v.i, (uint8_t)width, &frame[0]);
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(draw_text)
+// draw_text(x, y, :name)
+static void bi_draw_text(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    (void)argc;
+    gb_draw_text(vm, frame[1].v.i, frame[2].v.i, vm->sym_names[frame[3].v.sym], &frame[0]);
+}
+#endif
 
-    // Initialize return value to nil
-    MRBZ_SET_NIL(*ret);
+#if MRBZ_HAS_BUILTIN(scroll_to)
+// scroll_to(x, y) - world camera in pixels, moved at the next wait_vbl
+static void bi_scroll_to(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    (void)argc;
+    gb_scroll_to(vm, frame[1].v.i, frame[2].v.i, &frame[0]);
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(map_tile)
+// map_tile(x, y) -> world tile, or nil off the map
+static void bi_map_tile(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    (void)argc;
+    gb_map_tile(vm, frame[1].v.i, frame[2].v.i, &frame[0]);
+}
+#endif
 
-    // Get symbol name
-    name = mrbz_get_symbol(vm, sym_idx);
-    if (name == 0) {
+#if MRBZ_HAS_BUILTIN(wait_vbl)
+// wait_vbl
+// Collects garbage first when the pool is filling up, so the pause lands
+// in the idle time the wait would otherwise burn, then gives every fiber
+// its turn for the new frame. Inside a fiber it just yields; under
+// mrbz_vm_step the top level yields too and the caller does the waiting.
+// A block run by Range#each can't wait (see block.c).
+static void bi_wait_vbl(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    (void)argc;
+    if (mrbz_block_active(vm)) {
+        mrbz_block_fail(vm);
+        return;
+    }
+    if (vm->ctx != &vm->root) {
+        vm->ctx->status = MRBZ_CTX_SUSPENDED;
+        MRBZ_SET_NIL(frame[0]);
+        return;
+    }
+    if (vm->next_array >= MRBZ_GC_THRESHOLD) {
+        mrbz_gc(vm);
+    }
+    if (vm->stepping) {
+        vm->root.status = MRBZ_CTX_SUSPENDED;
+        MRBZ_SET_NIL(frame[0]);
         return;
     }
+    vm->fiber_turn = 0;  // Pending even if the platform stops the VM here
+    gb_wait_vbl(vm, &frame[0]);
+    mrbz_fiber_run_all(vm);
+}
+#endif
 
-    // Match built-in function by name
-    if (str_eq(name, "read_joypad")) {
-        gb_read_joypad(vm, ret);
+#if MRBZ_HAS_BUILTIN(rand)
+// rand(max)
+static void bi_rand(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    (void)argc;
+    gb_rand(vm, frame[1].v.i, &frame[0]);
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(srand)
+// srand(seed) or srand (stir in hardware jitter)
+static void bi_srand(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    gb_srand(vm, argc, argc >= 1 ? frame[1].v.i : 0, &frame[0]);
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(rand_pos)
+// rand_pos(w, h) -> (y << 8) | x
+static void bi_rand_pos(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    (void)argc;
+    gb_rand_pos(vm, frame[1].v.i, frame[2].v.i, &frame[0]);
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(game_over)
+// game_over(score = 0)
+static void bi_game_over(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    gb_game_over(vm, argc >= 1 ? frame[1].v.i : 0, &frame[0]);
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(new)
+// Fiber.new { ... } - the block follows the arguments
+// A block run by Range#each can't make one: the fiber's upvars would
+// resolve through the block's context, which is gone once the iterator
+// returns (see block.c).
+static void fiber_new(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    uint8_t fib;
+
+    MRBZ_SET_NIL(frame[0]);
+    if (mrbz_block_active(vm)) {
+        mrbz_block_fail(vm);
+        return;
+    }
+    if (MRBZ_BLOCK_ARG(frame, argc).type == MRBZ_T_PROC) {
+        fib = mrbz_fiber_new(vm, MRBZ_BLOCK_ARG(frame, argc).v.irep);
+        if (fib != MRBZ_FIBER_NONE) {
+            MRBZ_SET_FIBER(frame[0], fib, vm->fiber_gen[fib]);
+        }
     }
-    else if (str_eq(name, "draw_tile")) {
-        if (argc >= 3) {
-            x = vm->regs[base_reg].v.i;
-            y = vm->regs[base_reg + 1].v.i;
-            tile = vm->regs[base_reg + 2].v.i;
-            gb_draw_tile(vm, x, y, tile, ret);
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(new)
+// Array.new(size, default), Hash.new or Fiber.new { ... }
+static void bi_new(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    int16_t size, i;
+    uint8_t arr_idx;
+
+    if (frame[0].type == MRBZ_T_CLASS && frame[0].v.cls == MRBZ_CLASS_FIBER) {
+        fiber_new(vm, frame, argc);
+        return;
+    }
+    if (frame[0].type == MRBZ_T_CLASS && frame[0].v.cls == MRBZ_CLASS_HASH) {
+        // No default values: missing keys read as nil
+        arr_idx = mrbz_hash_new(vm);
+        MRBZ_SET_NIL(frame[0]);
+        if (arr_idx != MRBZ_ARRAY_NONE) {
+            MRBZ_SET_HASH(frame[0], arr_idx);
+        }
+        return;
+    }
+
+    MRBZ_SET_NIL(frame[0]);
+    if (argc < 2 || frame[1].type != MRBZ_T_INT) {
+        return;
+    }
+    size = frame[1].v.i;
+
+    if (size > MRBZ_MAX_ARRAY_LEN) size = MRBZ_MAX_ARRAY_LEN;
+    if (size < 0) size = 0;
+
+    // Read the default only after allocating: a collection may move it
+    arr_idx = mrbz_array_alloc(vm, (uint8_t)size);
+    if (arr_idx != MRBZ_ARRAY_NONE) {
+        for (i = 0; i < size; i++) {
+            vm->arrays[arr_idx][i] = frame[2];
         }
+        MRBZ_SET_ARR(frame[0], arr_idx);
+    }
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(yield)
+// Fiber.yield - suspend the running fiber until its next turn
+static void bi_yield(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    (void)argc;
+    if (mrbz_block_active(vm)) {
+        mrbz_block_fail(vm);
+        return;
+    }
+    if (vm->ctx != &vm->root) {
+        vm->ctx->status = MRBZ_CTX_SUSPENDED;
+    }
+    MRBZ_SET_NIL(frame[0]);
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(resume)
+// fiber.resume - run it now until it yields
+// If the step budget runs out inside the fiber, the caller is left on the
+// send (receiver intact) and resumes it again on the next step, so code
+// after `resume` never runs while the fiber is mid-turn. A fiber that has
+// finished (and maybe given its slot away) is left alone.
+static void bi_resume(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    (void)argc;
+    if (mrbz_fiber_valid(vm, frame[0]) &&
+        mrbz_fiber_resume(vm, frame[0].v.fib.slot)) {
+        vm->ctx->pc -= 4;  // Every send is 4 bytes; pc is past it
+        return;
+    }
+    MRBZ_SET_NIL(frame[0]);
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(alive)
+// fiber.alive?
+static void bi_alive(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    (void)argc;
+    if (mrbz_fiber_valid(vm, frame[0]) &&
+        vm->fibers[frame[0].v.fib.slot].status != MRBZ_CTX_DONE) {
+        MRBZ_SET_TRUE(frame[0]);
+    } else {
+        MRBZ_SET_FALSE(frame[0]);
+    }
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(key_p)
+// hash.key?(key)
+static void bi_key_p(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    mrbz_value value;
+
+    (void)argc;
+    if (mrbz_hash_get(vm, frame[0].v.arr, frame[1], &value)) {
+        MRBZ_SET_TRUE(frame[0]);
+    } else {
+        MRBZ_SET_FALSE(frame[0]);
+    }
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(fetch)
+// hash.fetch(key, default = nil)
+// Without a default a missing key gives nil (there is no KeyError).
+static void bi_fetch(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    if (!mrbz_hash_get(vm, frame[0].v.arr, frame[1], &frame[0]) && argc >= 2) {
+        frame[0] = frame[2];
+    }
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(neq)
+// a != b
+static void bi_neq(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    (void)vm;
+    (void)argc;
+    if (mrbz_values_equal(frame[0], frame[1])) {
+        MRBZ_SET_FALSE(frame[0]);
+    } else {
+        MRBZ_SET_TRUE(frame[0]);
+    }
+}
+#endif
+
+// Ranges
+// A range is unboxed (first element and count), so iterating one allocates
+// nothing. The block runs from a native loop: per element that is one
+// increment and one compare on top of the block body itself.
+
+#if MRBZ_HAS_BUILTIN(include_p) || MRBZ_HAS_BUILTIN(eqq)
+// True if an Integer value lies in a range
+static uint8_t range_covers(mrbz_value range, mrbz_value v) {
+    return v.type == MRBZ_T_INT &&
+           (uint16_t)(v.v.i - range.v.range.first) < range.v.range.len;
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(each) || MRBZ_HAS_BUILTIN(reverse_each) || MRBZ_HAS_BUILTIN(step)
+// Call the block after the arguments count times with start, start + step, ..
+// Returns self, or nil without a block.
+static void range_iterate(mrbz_vm* vm, mrbz_value* frame, uint8_t argc,
+                          int16_t start, int16_t step, uint8_t count) {
+    mrbz_block blk;
+    mrbz_value v;
+
+    if (!mrbz_block_begin(vm, &blk, MRBZ_BLOCK_ARG(frame, argc))) {
+        MRBZ_SET_NIL(frame[0]);
+        return;
+    }
+    MRBZ_SET_INT(v, start);
+    while (count-- && vm->running) {
+        mrbz_block_call(vm, &blk, v);
+        v.v.i += step;
+    }
+    mrbz_block_end(vm, &blk);
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(each)
+// range.each { |i| ... } (also what `for i in range` compiles to)
+static void bi_each(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    range_iterate(vm, frame, argc, frame[0].v.range.first, 1, frame[0].v.range.len);
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(reverse_each)
+// range.reverse_each { |i| ... }
+static void bi_reverse_each(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    range_iterate(vm, frame, argc, frame[0].v.range.first + frame[0].v.range.len - 1,
+                  -1, frame[0].v.range.len);
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(step)
+// range.step(n) { |i| ... } - n must be positive
+static void bi_step(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    int16_t n = frame[1].v.i;
+
+    if (n <= 0) {
+        MRBZ_SET_NIL(frame[0]);
+        return;
+    }
+    range_iterate(vm, frame, argc, frame[0].v.range.first, n,
+                  frame[0].v.range.len ? (uint8_t)((frame[0].v.range.len - 1) / n + 1) : 0);
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(size)
+// range.size
+static void bi_size(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    (void)vm;
+    (void)argc;
+    MRBZ_SET_INT(frame[0], frame[0].v.range.len);
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(include_p)
+// range.include?(n)
+static void bi_include_p(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    (void)vm;
+    (void)argc;
+    if (range_covers(frame[0], frame[1])) {
+        MRBZ_SET_TRUE(frame[0]);
+    } else {
+        MRBZ_SET_FALSE(frame[0]);
+    }
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(eqq)
+// a === b (case/when); equality for the values mrbz has, membership for ranges
+static void bi_eqq(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    (void)vm;
+    (void)argc;
+    if (frame[0].type == MRBZ_T_RANGE ? range_covers(frame[0], frame[1])
+                                      : mrbz_values_equal(frame[0], frame[1])) {
+        MRBZ_SET_TRUE(frame[0]);
+    } else {
+        MRBZ_SET_FALSE(frame[0]);
+    }
+}
+#endif
+
+// Integer operators
+// Receiver and argument types are checked by the dispatcher, so these only
+// deal with 16-bit values. Division-free where the LR35902 allows it.
+
+#if MRBZ_HAS_BUILTIN(shl) || MRBZ_HAS_BUILTIN(shr)
+// Shift helpers follow Ruby: a negative count shifts the other way
+// Counts of 16 or more either way are settled before negating, so -32768
+// (which negates to itself) never bounces between the two.
+static int16_t int_shl(int16_t x, int16_t n);
+
+static int16_t int_shr(int16_t x, int16_t n) {
+    if (n <= -16) return 0;
+    if (n < 0) return int_shl(x, -n);
+    if (n >= 16) return x < 0 ? -1 : 0;
+    return x >> n;
+}
+
+static int16_t int_shl(int16_t x, int16_t n) {
+    if (n <= -16) return x < 0 ? -1 : 0;
+    if (n < 0) return int_shr(x, -n);
+    if (n >= 16) return 0;
+    return (int16_t)((uint16_t)x << n);
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(mod)
+// x mod m for m > 0 by shift and subtract: the Game Boy has no divide
+// instruction, and this takes at most 16 shift/subtract steps instead
+// of a call into SDCC's library divide
+static uint16_t umod(uint16_t x, uint16_t m) {
+    uint16_t d = m;
+
+    // Largest m << k that fits in x
+    while (d <= x >> 1) {
+        d <<= 1;
     }
-    else if (str_eq(name, "clear_tile")) {
-        if (argc >= 2) {
-            x = vm->regs[base_reg].v.i;
-            y = vm->regs[base_reg + 1].v.i;
-            gb_clear_tile(vm, x, y, ret);
+    while (d >= m) {
+        if (x >= d) x -= d;
+        d >>= 1;
+    }
+    return x;
+}
+
+// a % b (result takes the sign of b, like Ruby)
+// A positive power-of-two divisor is a mask; any other goes through umod
+// on the magnitudes, then the sign is fixed up.
+static void bi_mod(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    int16_t x, m, r;
+
+    (void)vm;
+    (void)argc;
+    x = frame[0].v.i;
+    m = frame[1].v.i;
+
+    if (m == 0) {
+        r = 0;  // Same convention as OP_DIV
+    } else if (m > 0 && (m & (m - 1)) == 0) {
+        // Power of two: floored modulo is a mask, no software divide
+        r = x & (m - 1);
+    } else {
+        r = (int16_t)umod(x < 0 ? (uint16_t)0 - (uint16_t)x : (uint16_t)x,
+                          m < 0 ? (uint16_t)0 - (uint16_t)m : (uint16_t)m);
+        if (x < 0) r = -r;  // Truncated remainder, sign of x
+        if (r != 0 && ((r ^ m) < 0)) {
+            r += m;
         }
     }
-    else if (str_eq(name, "wait_vbl")) {
-        gb_wait_vbl(vm, ret);
+    MRBZ_SET_INT(frame[0], r);
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(shl)
+// a << n
+static void bi_shl(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    (void)vm;
+    (void)argc;
+    MRBZ_SET_INT(frame[0], int_shl(frame[0].v.i, frame[1].v.i));
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(shr)
+// a >> n
+static void bi_shr(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    (void)vm;
+    (void)argc;
+    MRBZ_SET_INT(frame[0], int_shr(frame[0].v.i, frame[1].v.i));
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(and)
+// a & b
+static void bi_and(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    (void)vm;
+    (void)argc;
+    MRBZ_SET_INT(frame[0], frame[0].v.i & frame[1].v.i);
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(or)
+// a | b
+static void bi_or(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    (void)vm;
+    (void)argc;
+    MRBZ_SET_INT(frame[0], frame[0].v.i | frame[1].v.i);
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(xor)
+// a ^ b
+static void bi_xor(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    (void)vm;
+    (void)argc;
+    MRBZ_SET_INT(frame[0], frame[0].v.i ^ frame[1].v.i);
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(not)
+// ~a
+static void bi_not(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    (void)vm;
+    (void)argc;
+    MRBZ_SET_INT(frame[0], ~frame[0].v.i);
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(neg)
+// -a (Integer or fixed-point, the type is kept)
+static void bi_neg(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    (void)vm;
+    (void)argc;
+    frame[0].v.i = -frame[0].v.i;
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(abs)
+// a.abs (Integer or fixed-point, the type is kept)
+static void bi_abs(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    (void)vm;
+    (void)argc;
+    if (frame[0].v.i < 0) {
+        frame[0].v.i = -frame[0].v.i;
     }
-    else if (str_eq(name, "rand")) {
-        if (argc >= 1) {
-            max = vm->regs[base_reg].v.i;
-            gb_rand(vm, max, ret);
+}
+#endif
+
+// Fixed-point conversions and trigonometry
+// Angles are integers in binary degrees: 256 per full turn, so wrapping is
+// free and lookups need no multiply.
+
+#if MRBZ_HAS_BUILTIN(sin) || MRBZ_HAS_BUILTIN(cos)
+// sin() for 0..64 (a quarter turn), in 8.8 fixed-point
+static const int16_t sin_table[65] = {
+    0, 6, 13, 19, 25, 31, 38, 44, 50, 56, 62, 68,
+    74, 80, 86, 92, 98, 104, 109, 115, 121, 126, 132, 137,
+    142, 147, 152, 157, 162, 167, 172, 177, 181, 185, 190, 194,
+    198, 202, 206, 209, 213, 216, 220, 223, 226, 229, 231, 234,
+    237, 239, 241, 243, 245, 247, 248, 250, 251, 252, 253, 254,
+    255, 255, 256, 256, 256,
+};
+#endif
+
+#if MRBZ_HAS_BUILTIN(atan2)
+// atan(i / 32) for i = 0..32, in binary degrees
+static const uint8_t atan_table[33] = {
+    0, 1, 3, 4, 5, 6, 8, 9, 10, 11, 12, 13,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 25,
+    26, 27, 28, 29, 29, 30, 31, 31, 32,
+};
+#endif
+
+#if MRBZ_HAS_BUILTIN(sin) || MRBZ_HAS_BUILTIN(cos)
+// Sine of an angle in binary degrees, as 8.8 fixed-point
+static int16_t fixed_sin(uint8_t angle) {
+    uint8_t idx;
+
+    // Mirror the quarter wave for the 2nd/4th quadrant, negate for the 3rd/4th
+    idx = angle & 0x3F;
+    if (angle & 0x40) {
+        idx = 64 - idx;
+    }
+    return (angle & 0x80) ? -sin_table[idx] : sin_table[idx];
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(sin) || MRBZ_HAS_BUILTIN(cos)
+// Integer angle argument, fixed-point values use their integer part
+static uint8_t angle_arg(mrbz_value v) {
+    if (v.type == MRBZ_T_FIXED) {
+        return (uint8_t)(v.v.i >> MRBZ_FIXED_SHIFT);
+    }
+    return (uint8_t)v.v.i;
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(sin)
+// sin(angle)
+static void bi_sin(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    (void)vm;
+    (void)argc;
+    MRBZ_SET_FIXED(frame[0], fixed_sin(angle_arg(frame[1])));
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(cos)
+// cos(angle)
+static void bi_cos(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    (void)vm;
+    (void)argc;
+    MRBZ_SET_FIXED(frame[0], fixed_sin((uint8_t)(angle_arg(frame[1]) + 64)));
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(atan2)
+// atan2(y, x) -> angle in binary degrees (0..255)
+static void bi_atan2(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    int32_t y, x;
+    uint16_t ay, ax;
+    uint8_t angle;
+
+    (void)vm;
+    (void)argc;
+
+    // Bring both operands to the same scale, then small enough that the
+    // ratio fits in 16 bits
+    y = frame[1].type == MRBZ_T_FIXED ? frame[1].v.i : (int32_t)frame[1].v.i << MRBZ_FIXED_SHIFT;
+    x = frame[2].type == MRBZ_T_FIXED ? frame[2].v.i : (int32_t)frame[2].v.i << MRBZ_FIXED_SHIFT;
+    while (y > 0x3FF || y < -0x3FF || x > 0x3FF || x < -0x3FF) {
+        y >>= 1;
+        x >>= 1;
+    }
+    ay = (uint16_t)(y < 0 ? -y : y);
+    ax = (uint16_t)(x < 0 ? -x : x);
+
+    if (ax == 0 && ay == 0) {
+        angle = 0;
+    } else if (ay <= ax) {
+        angle = atan_table[(ay << 5) / ax];
+    } else {
+        angle = 64 - atan_table[(ax << 5) / ay];
+    }
+    if (x < 0) angle = 128 - angle;
+    if (y < 0) angle = (uint8_t)(0 - angle);
+
+    MRBZ_SET_INT(frame[0], angle);
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(to_i)
+// n.to_i (truncates toward zero like Float#to_i)
+static void bi_to_i(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    int16_t raw;
+
+    (void)vm;
+    (void)argc;
+    if (frame[0].type == MRBZ_T_FIXED) {
+        raw = frame[0].v.i;
+        MRBZ_SET_INT(frame[0], raw < 0 ? -(-raw >> MRBZ_FIXED_SHIFT) : raw >> MRBZ_FIXED_SHIFT);
+    }
+}
+#endif
+
+#if MRBZ_HAS_BUILTIN(to_f)
+// n.to_f (saturates outside -128..127)
+static void bi_to_f(mrbz_vm* vm, mrbz_value* frame, uint8_t argc) {
+    int16_t n;
+
+    (void)vm;
+    (void)argc;
+    if (frame[0].type == MRBZ_T_INT) {
+        n = frame[0].v.i;
+        if (n > 127) n = 127;
+        if (n < -128) n = -128;
+        MRBZ_SET_FIXED(frame[0], n << MRBZ_FIXED_SHIFT);
+    }
+}
+#endif
+
+// Builtin descriptor table
+// Indexed by the value stored in vm->sym_builtin, so dispatch cost does not
+// depend on the number of entries. Unlisted argument types are unchecked.
+// BUILTIN(key, name, arity, flags, self_types, arg types...) is implemented
+// by bi_<key>; a stripped build keeps an entry only if the program names
+// it (MRBZ_USE_BI_<key>, see vm.h).
+#if MRBZ_BUILTIN_KEYS
+#define BUILTIN(key, name, arity, flags, self, a0, a1, a2) \
+    { name, arity, flags, self, { a0, a1, a2 }, bi_##key, #key },
+#else
+#define BUILTIN(key, name, arity, flags, self, a0, a1, a2) \
+    { name, arity, flags, self, { a0, a1, a2 }, bi_##key },
+#endif
+
+static const mrbz_builtin builtins[] = {
+#if MRBZ_HAS_BUILTIN(read_joypad)
+    BUILTIN(read_joypad, "read_joypad", 0, 0, MRBZ_TM_ANY, 0, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(draw_tile)
+    BUILTIN(draw_tile, "draw_tile", 3, 0, MRBZ_TM_ANY, MRBZ_TM_INT, MRBZ_TM_INT, MRBZ_TM_INT)
+#endif
+#if MRBZ_HAS_BUILTIN(clear_tile)
+    BUILTIN(clear_tile, "clear_tile", 2, 0, MRBZ_TM_ANY, MRBZ_TM_INT, MRBZ_TM_INT, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(wait_vbl)
+    BUILTIN(wait_vbl, "wait_vbl", 0, MRBZ_BF_REENTERS, MRBZ_TM_ANY, 0, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(rand)
+    BUILTIN(rand, "rand", 1, 0, MRBZ_TM_ANY, MRBZ_TM_INT, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(srand)
+    BUILTIN(srand, "srand", 0, 0, MRBZ_TM_ANY, MRBZ_TM_INT, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(rand_pos)
+    BUILTIN(rand_pos, "rand_pos", 2, 0, MRBZ_TM_ANY, MRBZ_TM_INT, MRBZ_TM_INT, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(game_over)
+    BUILTIN(game_over, "game_over", 0, 0, MRBZ_TM_ANY, MRBZ_TM_INT, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(draw_number)
+    BUILTIN(draw_number, "draw_number", 3, 0, MRBZ_TM_ANY, MRBZ_TM_INT, MRBZ_TM_INT, MRBZ_TM_INT)
+#endif
+#if MRBZ_HAS_BUILTIN(draw_text)
+    BUILTIN(draw_text, "draw_text", 3, 0, MRBZ_TM_ANY, MRBZ_TM_INT, MRBZ_TM_INT, MRBZ_TM(MRBZ_T_SYMBOL))
+#endif
+#if MRBZ_HAS_BUILTIN(scroll_to)
+    BUILTIN(scroll_to, "scroll_to", 2, 0, MRBZ_TM_ANY, MRBZ_TM_INT, MRBZ_TM_INT, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(map_tile)
+    BUILTIN(map_tile, "map_tile", 2, 0, MRBZ_TM_ANY, MRBZ_TM_INT, MRBZ_TM_INT, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(new)
+    BUILTIN(new, "new", 0, MRBZ_BF_RETAINS, MRBZ_TM_ANY, 0, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(yield)
+    BUILTIN(yield, "yield", 0, MRBZ_BF_REENTERS, MRBZ_TM(MRBZ_T_CLASS), 0, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(resume)
+    BUILTIN(resume, "resume", 0, MRBZ_BF_REENTERS, MRBZ_TM(MRBZ_T_FIBER), 0, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(alive)
+    BUILTIN(alive, "alive?", 0, 0, MRBZ_TM(MRBZ_T_FIBER), 0, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(key_p)
+    BUILTIN(key_p, "key?", 1, 0, MRBZ_TM(MRBZ_T_HASH), MRBZ_TM_ANY, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(fetch)
+    BUILTIN(fetch, "fetch", 1, MRBZ_BF_RETAINS, MRBZ_TM(MRBZ_T_HASH), MRBZ_TM_ANY, MRBZ_TM_ANY, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(neq)
+    BUILTIN(neq, "!=", 1, 0, MRBZ_TM_ANY, MRBZ_TM_ANY, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(eqq)
+    BUILTIN(eqq, "===", 1, 0, MRBZ_TM_ANY, MRBZ_TM_ANY, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(each)
+    BUILTIN(each, "each", 0, MRBZ_BF_RETAINS | MRBZ_BF_REENTERS, MRBZ_TM(MRBZ_T_RANGE), 0, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(reverse_each)
+    BUILTIN(reverse_each, "reverse_each", 0, MRBZ_BF_RETAINS | MRBZ_BF_REENTERS, MRBZ_TM(MRBZ_T_RANGE), 0, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(step)
+    BUILTIN(step, "step", 1, MRBZ_BF_RETAINS | MRBZ_BF_REENTERS, MRBZ_TM(MRBZ_T_RANGE), MRBZ_TM_INT, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(size)
+    BUILTIN(size, "size", 0, 0, MRBZ_TM(MRBZ_T_RANGE), 0, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(include_p)
+    BUILTIN(include_p, "include?", 1, 0, MRBZ_TM(MRBZ_T_RANGE), MRBZ_TM_ANY, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(mod)
+    BUILTIN(mod, "%", 1, 0, MRBZ_TM_INT, MRBZ_TM_INT, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(shl)
+    BUILTIN(shl, "<<", 1, 0, MRBZ_TM_INT, MRBZ_TM_INT, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(shr)
+    BUILTIN(shr, ">>", 1, 0, MRBZ_TM_INT, MRBZ_TM_INT, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(and)
+    BUILTIN(and, "&", 1, 0, MRBZ_TM_INT, MRBZ_TM_INT, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(or)
+    BUILTIN(or, "|", 1, 0, MRBZ_TM_INT, MRBZ_TM_INT, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(xor)
+    BUILTIN(xor, "^", 1, 0, MRBZ_TM_INT, MRBZ_TM_INT, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(not)
+    BUILTIN(not, "~", 0, 0, MRBZ_TM_INT, 0, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(neg)
+    BUILTIN(neg, "-@", 0, 0, MRBZ_TM_NUM, 0, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(abs)
+    BUILTIN(abs, "abs", 0, 0, MRBZ_TM_NUM, 0, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(sin)
+    BUILTIN(sin, "sin", 1, 0, MRBZ_TM_ANY, MRBZ_TM_NUM, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(cos)
+    BUILTIN(cos, "cos", 1, 0, MRBZ_TM_ANY, MRBZ_TM_NUM, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(atan2)
+    BUILTIN(atan2, "atan2", 2, 0, MRBZ_TM_ANY, MRBZ_TM_NUM, MRBZ_TM_NUM, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(to_i)
+    BUILTIN(to_i, "to_i", 0, 0, MRBZ_TM_NUM, 0, 0, 0)
+#endif
+#if MRBZ_HAS_BUILTIN(to_f)
+    BUILTIN(to_f, "to_f", 0, 0, MRBZ_TM_NUM, 0, 0, 0)
+#endif
+#if MRBZ_STRIP
+    { 0, 0, 0, 0, { 0, 0, 0 }, 0 }  // Keeps the table non-empty; not counted
+#endif
+};
+
+// A variable rather than a constant: a stripped table may count none
+static const uint8_t num_builtins = (uint8_t)(sizeof(builtins) / sizeof(builtins[0]) - MRBZ_STRIP);
+#define NUM_BUILTINS num_builtins
+
+// Built-in classes, indexed by MRBZ_CLASS_*
+const char* const mrbz_class_names[MRBZ_CLASS_COUNT] = { "Array", "Fiber", "Hash" };
+
+// Define constants for built-in classes the program refers to
+void mrbz_builtin_define_classes(mrbz_vm* vm) {
+    uint8_t i, sym;
+    for (i = 0; i < MRBZ_CLASS_COUNT; i++) {
+        sym = mrbz_find_symbol(vm, mrbz_class_names[i]);
+        if (sym == 0xFF) {
+            continue;
+        }
+        if (vm->const_count >= MRBZ_MAX_CONSTS) {
+            vm->error = MRBZ_ERR_LIMIT;
+            return;
         }
+        vm->const_syms[vm->const_count] = sym;
+        MRBZ_SET_CLASS(vm->consts[vm->const_count], i);
+        vm->const_count++;
     }
-    else if (str_eq(name, "game_over")) {
-        if (argc >= 1) {
-            score = vm->regs[base_reg].v.i;
-            gb_game_over(vm, score, ret);
-        } else {
-            gb_game_over(vm, 0, ret);
+}
+
+// Flags of a builtin (0 for MRBZ_BUILTIN_NONE)
+uint8_t mrbz_builtin_flags(uint8_t idx) {
+    if (idx >= NUM_BUILTINS) {
+        return 0;
+    }
+    return builtins[idx].flags;
+}
+
+#if MRBZ_BUILTIN_KEYS
+uint8_t mrbz_builtin_count(void) {
+    return NUM_BUILTINS;
+}
+
+const char* mrbz_builtin_key(uint8_t idx) {
+    return builtins[idx].key;
+}
+#endif
+
+// Find builtin index by name
+uint8_t mrbz_builtin_lookup(const char* name) {
+    uint8_t i;
+    for (i = 0; i < NUM_BUILTINS; i++) {
+        if (str_eq(name, builtins[i].name)) {
+            return i;
         }
     }
-    else if (str_eq(name, "new")) {
-        // Array.new(size, default) - called on Array class
-        if (argc >= 2) {
-            size = vm->regs[base_reg].v.i;
-            default_val = vm->regs[base_reg + 1];
-
-            if (size > MRBZ_MAX_ARRAY_LEN) size = MRBZ_MAX_ARRAY_LEN;
-            if (size < 0) size = 0;
-
-            if (vm->next_array < MRBZ_MAX_ARRAYS) {
-                arr_idx = vm->next_array;
-                vm->next_array++;
-                vm->array_lens[arr_idx] = (uint8_t)size;
-                for (i = 0; i < size; i++) {
-                    vm->arrays[arr_idx][i] = default_val;
-                }
-                MRBZ_SET_ARR(*ret, arr_idx);
+    return MRBZ_BUILTIN_NONE;
+}
+
+// Dispatch a built-in call through the descriptor table
+void mrbz_builtin_call(mrbz_vm* vm, uint8_t sym_idx, uint8_t argc, mrbz_value* frame) {
+    const mrbz_builtin* bi;
+    mrbz_value window[1 + MRBZ_BUILTIN_MAX_ARGS + 1];
+    mrbz_root root;
+    mrbz_value* args;
+    uint8_t arr_idx;
+    uint8_t i;
+
+    if (sym_idx >= vm->sym_count || vm->sym_builtin[sym_idx] == MRBZ_BUILTIN_NONE) {
+        // Unknown methods are silently ignored
+        MRBZ_SET_NIL(frame[0]);
+        return;
+    }
+    bi = &builtins[vm->sym_builtin[sym_idx]];
+
+    // Fast path: arguments already sit in R[a+1].. so the builtin gets a
+    // pointer into the register file. Splat calls (argc == 15) pass a single
+    // array instead, with the block after it; unpack both into a local
+    // window laid out like a register one, registered as a GC root for the
+    // call since a builtin that allocates may move the arrays it names.
+    args = frame;
+    root.count = 0;
+    if (argc == 15) {
+        window[0] = frame[0];
+        argc = 0;
+        if (frame[1].type == MRBZ_T_ARRAY) {
+            arr_idx = frame[1].v.arr;
+            argc = vm->array_lens[arr_idx];
+            if (argc > MRBZ_BUILTIN_MAX_ARGS) argc = MRBZ_BUILTIN_MAX_ARGS;
+            for (i = 0; i < argc; i++) {
+                window[1 + i] = MRBZ_ARRAY_DATA(vm, arr_idx)[i];
             }
         }
+        MRBZ_BLOCK_ARG(window, argc) = frame[2];
+        args = window;
+        root.values = window;
+        root.count = argc + 2;
     }
-    else if (str_eq(name, "!=")) {
-        // Not-equal comparison
-        if (argc >= 1) {
-            if (vm->regs[base_reg - 1].type == vm->regs[base_reg].type) {
-                if (vm->regs[base_reg - 1].v.i != vm->regs[base_reg].v.i) {
-                    MRBZ_SET_TRUE(*ret);
-                } else {
-                    MRBZ_SET_FALSE(*ret);
-                }
-            } else {
-                MRBZ_SET_TRUE(*ret);
-            }
+
+    // Check receiver, arity and argument types
+    if (argc < bi->arity || !(bi->self_types & MRBZ_TM(args[0].type))) {
+        MRBZ_SET_NIL(frame[0]);
+        return;
+    }
+    for (i = 0; i < argc && i < MRBZ_BUILTIN_MAX_ARGS; i++) {
+        if (bi->arg_types[i] && !(bi->arg_types[i] & MRBZ_TM(args[1 + i].type))) {
+            MRBZ_SET_NIL(frame[0]);
+            return;
         }
     }
-    // Unknown methods are silently ignored
+
+    if (root.count) {
+        root.next = vm->roots;
+        vm->roots = &root;
+    }
+#if MRBZ_PROFILE
+    vm->prof_sym = sym_idx;
+    bi->fn(vm, args, argc);
+    vm->prof_sym = MRBZ_PROF_VM;
+#else
+    bi->fn(vm, args, argc);
+#endif
+    if (root.count) {
+        vm->roots = root.next;
+        frame[0] = args[0];
+    }
 }
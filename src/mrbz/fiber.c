@@ -0,0 +1,101 @@
+/**
+ * mrbz - Minimal Ruby for Game Boy
+ * Cooperative fibers
+ *
+ * A fiber is an execution context (pc, IREP, register window) running a
+ * block. Fibers are resumed once per frame from wait_vbl and run until
+ * Fiber.yield (or their own wait_vbl), so actors can be plain loops.
+ * Each fiber owns a fixed MRBZ_FIBER_REGS register window; nothing is
+ * allocated at run time. A Fiber value holds its slot and the slot's
+ * generation, so a handle kept past its fiber's end can't drive whichever
+ * fiber takes the slot next.
+ */
+
+#include "vm.h"
+
+// Create a fiber running a block IREP
+uint8_t mrbz_fiber_new(mrbz_vm* vm, uint8_t irep) {
+    mrbz_ctx* f;
+    uint8_t i, j;
+
+    if (irep >= vm->irep_count || vm->ireps[irep].nregs > MRBZ_FIBER_REGS) {
+        return MRBZ_FIBER_NONE;
+    }
+
+    for (i = 0; i < MRBZ_MAX_FIBERS; i++) {
+        f = &vm->fibers[i];
+        if (f->status != MRBZ_CTX_DONE) continue;
+
+        f->regs = vm->fiber_regs[i];
+        for (j = 0; j < MRBZ_FIBER_REGS; j++) {
+            MRBZ_SET_NIL(f->regs[j]);
+        }
+        // Upvars resolve through the creator: the top level or another
+        // fiber. A fiber creator may finish first, so its generation is
+        // kept and GETUPVAR/SETUPVAR check it (mrbz_fiber_parent_live).
+        f->parent = vm->ctx;
+        f->parent_gen = 0;
+        if (vm->ctx >= vm->fibers && vm->ctx < vm->fibers + MRBZ_MAX_FIBERS) {
+            f->parent_gen = vm->fiber_gen[vm->ctx - vm->fibers];
+        }
+        f->irep = irep;
+        f->pc = vm->ireps[irep].insns;
+        f->status = MRBZ_CTX_SUSPENDED;
+        vm->fiber_gen[i]++;
+        return i;
+    }
+    return MRBZ_FIBER_NONE;
+}
+
+// True if a Fiber value names the fiber now in its slot
+uint8_t mrbz_fiber_valid(const mrbz_vm* vm, mrbz_value fib) {
+    return fib.v.fib.slot < MRBZ_MAX_FIBERS &&
+           vm->fiber_gen[fib.v.fib.slot] == fib.v.fib.gen;
+}
+
+// True unless ctx is a fiber whose parent fiber is no longer running
+uint8_t mrbz_fiber_parent_live(const mrbz_vm* vm, const mrbz_ctx* ctx) {
+    const mrbz_ctx* p = ctx->parent;
+    uint8_t slot;
+
+    if (ctx < vm->fibers || ctx >= vm->fibers + MRBZ_MAX_FIBERS ||
+        p < vm->fibers || p >= vm->fibers + MRBZ_MAX_FIBERS) {
+        return 1;  // Not a fiber, or made by the top level
+    }
+    slot = (uint8_t)(p - vm->fibers);
+    return p->status != MRBZ_CTX_DONE && vm->fiber_gen[slot] == ctx->parent_gen;
+}
+
+// Run a suspended fiber until it yields or finishes
+// Returns 1 if the step budget ran out first.
+uint8_t mrbz_fiber_resume(mrbz_vm* vm, uint8_t fib) {
+    mrbz_ctx* f;
+    mrbz_value ret;
+
+    if (fib >= MRBZ_MAX_FIBERS) {
+        return 0;
+    }
+    f = &vm->fibers[fib];
+    if (f->status != MRBZ_CTX_SUSPENDED) {
+        return 0;  // Finished, or already running further up the stack
+    }
+    f->status = MRBZ_CTX_RUNNING;
+    mrbz_vm_exec(vm, f, &ret);
+    if (f->status == MRBZ_CTX_RUNNING) {
+        f->status = MRBZ_CTX_SUSPENDED;  // Preempted mid-turn
+        return 1;
+    }
+    return 0;
+}
+
+// Give each suspended fiber its turn for this frame
+// A pass starts when vm->fiber_turn is reset to 0. If the step budget runs
+// out, the pass stops at the preempted fiber and the next call continues it.
+void mrbz_fiber_run_all(mrbz_vm* vm) {
+    while (vm->fiber_turn < MRBZ_MAX_FIBERS && vm->running) {
+        if (mrbz_fiber_resume(vm, vm->fiber_turn)) {
+            return;
+        }
+        vm->fiber_turn++;
+    }
+}
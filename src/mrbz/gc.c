@@ -0,0 +1,167 @@
+/**
+ * mrbz - Minimal Ruby for Game Boy
+ * Array pool allocator and mark-and-compact garbage collector
+ *
+ * Arrays (and Hashes, which are arrays of key/value pairs) live in the fixed
+ * vm->arrays pool and are referenced by index.
+ * Collection marks everything reachable from the registers (top level,
+ * live fibers and running blocks), instance variables, globals, constants,
+ * scratch literals and the temporary roots of builtin calls, slides
+ * live arrays down to the start of the pool and rewrites every handle, so
+ * allocation stays a bump of vm->next_array.
+ */
+
+#include "vm.h"
+
+#if MRBZ_STATS
+// Platform clock for pause measurements (microseconds)
+extern uint32_t mrbz_stats_clock(void);
+#endif
+
+// True for values holding an array handle
+#define IS_ARRAY_HANDLE(v) ((v)->type == MRBZ_T_ARRAY || (v)->type == MRBZ_T_HASH)
+
+// Mark the pool array a value refers to; returns 1 if newly marked
+static uint8_t mark_value(const mrbz_value* v, uint8_t* marks) {
+    if (IS_ARRAY_HANDLE(v) && v->v.arr < MRBZ_MAX_ARRAYS && !marks[v->v.arr]) {
+        marks[v->v.arr] = 1;
+        return 1;
+    }
+    return 0;
+}
+
+// Mark every value in a root table
+static void mark_values(const mrbz_value* v, uint8_t count, uint8_t* marks) {
+    uint8_t i;
+    for (i = 0; i < count; i++) {
+        mark_value(&v[i], marks);
+    }
+}
+
+// Point a handle at the array's new slot (scratch handles never move)
+static void remap_value(mrbz_value* v, const uint8_t* remap) {
+    if (IS_ARRAY_HANDLE(v) && v->v.arr < MRBZ_MAX_ARRAYS) {
+        v->v.arr = remap[v->v.arr];
+    }
+}
+
+// Remap every value in a table
+static void remap_values(mrbz_value* v, uint8_t count, const uint8_t* remap) {
+    uint8_t i;
+    for (i = 0; i < count; i++) {
+        remap_value(&v[i], remap);
+    }
+}
+
+// Collect unreachable arrays, return the number freed
+uint8_t mrbz_gc(mrbz_vm* vm) {
+    uint8_t marks[MRBZ_MAX_ARRAYS];
+    uint8_t remap[MRBZ_MAX_ARRAYS];
+    uint8_t i, j, live, changed;
+    uint8_t freed;
+    mrbz_root* root;
+#if MRBZ_STATS
+    uint32_t start = mrbz_stats_clock();
+#endif
+
+    for (i = 0; i < vm->next_array; i++) {
+        marks[i] = 0;
+    }
+
+    // Mark roots
+    mark_values(vm->regs, MRBZ_MAX_REGS, marks);
+    for (i = 0; i < MRBZ_MAX_FIBERS; i++) {
+        if (vm->fibers[i].status != MRBZ_CTX_DONE) {
+            mark_values(vm->fiber_regs[i], MRBZ_FIBER_REGS, marks);
+        }
+    }
+    mark_values(vm->block_regs, vm->block_top, marks);
+    mark_values(vm->ivars, vm->ivar_count, marks);
+    mark_values(vm->globals, vm->global_count, marks);
+    mark_values(vm->consts, vm->const_count, marks);
+    for (i = 0; i < vm->scratch_count; i++) {
+        mark_values(vm->scratch[i], vm->array_lens[MRBZ_MAX_ARRAYS + i], marks);
+    }
+    for (root = vm->roots; root; root = root->next) {
+        mark_values(root->values, root->count, marks);
+    }
+
+    // Propagate through nested arrays until nothing changes
+    // (the pool is tiny, so repeated passes beat keeping a mark stack)
+    do {
+        changed = 0;
+        for (i = 0; i < vm->next_array; i++) {
+            if (!marks[i]) continue;
+            for (j = 0; j < vm->array_lens[i]; j++) {
+                changed |= mark_value(&vm->arrays[i][j], marks);
+            }
+        }
+    } while (changed);
+
+    // Compact: new slots are assigned in order, so each array only moves down
+    live = 0;
+    for (i = 0; i < vm->next_array; i++) {
+        if (!marks[i]) continue;
+        remap[i] = live;
+        if (live != i) {
+            for (j = 0; j < vm->array_lens[i]; j++) {
+                vm->arrays[live][j] = vm->arrays[i][j];
+            }
+            vm->array_lens[live] = vm->array_lens[i];
+        }
+        live++;
+    }
+    freed = vm->next_array - live;
+    vm->next_array = live;
+
+    // Rewrite handles
+    if (freed) {
+        remap_values(vm->regs, MRBZ_MAX_REGS, remap);
+        for (i = 0; i < MRBZ_MAX_FIBERS; i++) {
+            if (vm->fibers[i].status != MRBZ_CTX_DONE) {
+                remap_values(vm->fiber_regs[i], MRBZ_FIBER_REGS, remap);
+            }
+        }
+        remap_values(vm->block_regs, vm->block_top, remap);
+        remap_values(vm->ivars, vm->ivar_count, remap);
+        remap_values(vm->globals, vm->global_count, remap);
+        remap_values(vm->consts, vm->const_count, remap);
+        for (i = 0; i < vm->scratch_count; i++) {
+            remap_values(vm->scratch[i], vm->array_lens[MRBZ_MAX_ARRAYS + i], remap);
+        }
+        for (root = vm->roots; root; root = root->next) {
+            remap_values(root->values, root->count, remap);
+        }
+        for (i = 0; i < live; i++) {
+            remap_values(vm->arrays[i], vm->array_lens[i], remap);
+        }
+    }
+
+#if MRBZ_STATS
+    {
+        uint32_t pause = mrbz_stats_clock() - start;
+        vm->stats.gc_runs++;
+        vm->stats.gc_freed += freed;
+        vm->stats.gc_time_total += pause;
+        if (pause > vm->stats.gc_time_max) {
+            vm->stats.gc_time_max = pause;
+        }
+    }
+#endif
+
+    return freed;
+}
+
+// Allocate an array with len slots (contents are left to the caller)
+// Collects once if the pool is full; returns MRBZ_ARRAY_NONE on failure.
+uint8_t mrbz_array_alloc(mrbz_vm* vm, uint8_t len) {
+    uint8_t idx;
+
+    if (vm->next_array >= MRBZ_MAX_ARRAYS && mrbz_gc(vm) == 0) {
+        return MRBZ_ARRAY_NONE;
+    }
+    idx = vm->next_array;
+    vm->next_array++;
+    vm->array_lens[idx] = len;
+    return idx;
+}
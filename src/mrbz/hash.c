@@ -0,0 +1,113 @@
+/**
+ * mrbz - Minimal Ruby for Game Boy
+ * Hash tables with Symbol and Integer keys
+ *
+ * A Hash is a pool array of MRBZ_HASH_SLOTS key/value pairs (key in
+ * element 2n, value in 2n+1), so it is allocated, collected and moved
+ * exactly like an Array. Keys are placed by open addressing with linear
+ * probing; a nil key marks an empty slot. The table never grows and
+ * entries are never removed, so there are no tombstones and a lookup
+ * stops at the first empty slot: on a table that is not nearly full that
+ * is one or two probes, whatever the number of entries.
+ */
+
+#include "vm.h"
+
+// Slot a key hashes to (keys of different types never collide as equal)
+static uint8_t hash_slot(mrbz_value key) {
+    uint16_t k = (uint16_t)key.v.i;
+
+    if (key.type == MRBZ_T_SYMBOL) {
+        k = key.v.sym;
+    }
+    // Fold the high byte in so small keys and multiples of the table size
+    // spread out; symbols are offset so :a and 0 don't share a chain
+    k ^= k >> 8;
+    if (key.type == MRBZ_T_SYMBOL) {
+        k += MRBZ_HASH_SLOTS / 2 + 1;
+    }
+    return (uint8_t)k & (MRBZ_HASH_SLOTS - 1);
+}
+
+// True if a value can be used as a key
+static uint8_t valid_key(mrbz_value key) {
+    return key.type == MRBZ_T_INT || key.type == MRBZ_T_SYMBOL;
+}
+
+// Same key (type and value)
+static uint8_t same_key(mrbz_value a, mrbz_value b) {
+    if (a.type != b.type) return 0;
+    if (a.type == MRBZ_T_SYMBOL) return a.v.sym == b.v.sym;
+    return a.v.i == b.v.i;
+}
+
+// Find the pair for key, or the empty pair where it would go
+// Returns the element index of the key, or MRBZ_HASH_NONE if the table is
+// full and the key is not in it.
+static uint8_t find_pair(const mrbz_value* pairs, mrbz_value key) {
+    uint8_t slot, n;
+
+    slot = hash_slot(key);
+    for (n = 0; n < MRBZ_HASH_SLOTS; n++) {
+        if (pairs[slot * 2].type == MRBZ_T_NIL || same_key(pairs[slot * 2], key)) {
+            return slot * 2;
+        }
+        slot = (slot + 1) & (MRBZ_HASH_SLOTS - 1);
+    }
+    return MRBZ_HASH_NONE;
+}
+
+// Allocate an empty hash (returns MRBZ_ARRAY_NONE if the pool is full)
+#if MRBZ_MAX_ARRAY_LEN >= MRBZ_HASH_SLOTS * 2
+uint8_t mrbz_hash_new(mrbz_vm* vm) {
+    uint8_t idx, i;
+
+    idx = mrbz_array_alloc(vm, MRBZ_HASH_SLOTS * 2);
+    if (idx != MRBZ_ARRAY_NONE) {
+        for (i = 0; i < MRBZ_HASH_SLOTS * 2; i++) {
+            MRBZ_SET_NIL(vm->arrays[idx][i]);
+        }
+    }
+    return idx;
+}
+#else
+// Sized for a program without Hashes (see mrbz-check --config): no array
+// is long enough to hold one
+uint8_t mrbz_hash_new(mrbz_vm* vm) {
+    (void)vm;
+    return MRBZ_ARRAY_NONE;
+}
+#endif
+
+// Look up key; returns 1 and stores the value in *out if present
+uint8_t mrbz_hash_get(mrbz_vm* vm, uint8_t hash, mrbz_value key, mrbz_value* out) {
+    const mrbz_value* pairs = vm->arrays[hash];
+    uint8_t i;
+
+    if (valid_key(key)) {
+        i = find_pair(pairs, key);
+        if (i != MRBZ_HASH_NONE && pairs[i].type != MRBZ_T_NIL) {
+            *out = pairs[i + 1];
+            return 1;
+        }
+    }
+    MRBZ_SET_NIL(*out);
+    return 0;
+}
+
+// Store value under key; returns 0 if the key is invalid or the table full
+uint8_t mrbz_hash_set(mrbz_vm* vm, uint8_t hash, mrbz_value key, mrbz_value value) {
+    mrbz_value* pairs = vm->arrays[hash];
+    uint8_t i;
+
+    if (!valid_key(key)) {
+        return 0;
+    }
+    i = find_pair(pairs, key);
+    if (i == MRBZ_HASH_NONE) {
+        return 0;
+    }
+    pairs[i] = key;
+    pairs[i + 1] = value;
+    return 1;
+}
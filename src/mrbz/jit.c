@@ -0,0 +1,716 @@
+/**
+ * mrbz - Minimal Ruby for Game Boy
+ * Template JIT for hot loops (build with -DMRBZ_JIT=1)
+ *
+ * Every taken back jump calls mrbz_jit_back_jump, which counts it against the
+ * loop's header. Once a loop has gone round MRBZ_JIT_HOT times, its body is
+ * compiled by copying a pre-assembled machine code template per instruction
+ * into the embedder's code buffer (WRAM on the Game Boy) and patching the
+ * operands in. Later passes run the native code instead of the switch.
+ *
+ * Only straight integer work is compiled: moves, integer loads, + - and
+ * the ordered comparisons on Integers, and jumps. Reads of globals flagged
+ * MRBZ_GV_CONST compile to loads of their value: every loop runs after the
+ * writes that settle them (see mrbz_analyze_globals), so the value can't
+ * change under the compiled code. A loop holding anything
+ * else (a send, an array access, ==) stays interpreted. Each arithmetic
+ * template checks its operands are Integers first and otherwise leaves
+ * the native code at that instruction, so the interpreter handles
+ * fixed-point and odd types exactly as before. Jumps out of the loop leave
+ * the same way.
+ *
+ * Native code counts its back jumps against a fuel byte and leaves when it
+ * runs out, so mrbz_vm_step budgets still hold: a pass is charged as the
+ * instruction count of the whole loop. Instructions run natively are not
+ * in the MRBZ_STATS per-opcode counts.
+ *
+ * Two backends share the templates' shape: LR35902 for the Game Boy, with
+ * register addresses baked into the code, and x86-64 for the host build,
+ * so the tier-up logic can be exercised on a PC. Because of the baked
+ * addresses, a loop runs natively only in the register window it was
+ * compiled for; a fiber body shared by several fibers tiers up in the
+ * first one only.
+ */
+
+#include <stddef.h>
+#include "vm.h"
+
+#if MRBZ_JIT
+
+// Patch kinds: where template holes get their values from
+enum {
+    PK_TYPE_A,          // Address of R[a].type
+    PK_VAL_A,           // Address of R[a].v.i
+    PK_VAL_A1,          // Address of R[a].v.i high byte
+    PK_TYPE_B,          // Address of R[b].type
+    PK_VAL_B,           // Address of R[b].v.i
+    PK_VAL_X,           // Address of R[x].v.i (compares)
+    PK_VAL_Y,           // Address of R[y].v.i (compares)
+    PK_SLOT_A,          // Address of R[a]
+    PK_SLOT_B,          // Address of R[b]
+    PK_FUEL,            // Address of the fuel byte
+    PK_BYTE,            // Instruction-specific byte (type, condition code)
+    PK_IMM,             // 16-bit immediate
+    PK_IMM_LO,          // Immediate low byte
+    PK_IMM_HI,          // Immediate high byte
+    PK_EXIT,            // Leave at this instruction
+    PK_TARGET,          // Jump target: native code inside the loop, else leave there
+    PK_TARGET_EXIT      // Leave at the jump target (out of fuel)
+};
+
+typedef struct {
+    uint8_t off;        // Offset of the hole in the template
+    uint8_t kind;       // PK_*
+} jit_patch;
+
+typedef struct {
+    const uint8_t* code;
+    uint8_t len;
+    const jit_patch* patches;
+    uint8_t patch_count;
+} jit_template;
+
+#define TEMPLATE(name) { name, sizeof(name), name##_p, sizeof(name##_p) / sizeof(jit_patch) }
+
+// Templates test type bytes directly: guards compare with MRBZ_T_INT (3),
+// conditional jumps with MRBZ_T_TRUE (2), the first truthy type
+
+#if defined(__PORT_sm83) || defined(__PORT_gbz80)
+
+/*
+ * LR35902 backend
+ * Code is entered with call and leaves through a stub that loads the
+ * resume offset into BC and stores it in jit_exit_pc. Register operands
+ * are absolute addresses (2 bytes, little endian); jumps are absolute.
+ */
+
+#define JIT_ADDR_BYTES   2
+#define JIT_BRANCH_BYTES 2
+#define JIT_VALUE_SIZE   3
+
+static uint8_t jit_fuel;
+static uint16_t jit_exit_pc;
+
+// ld a,(R[a].type); cp 3; jp nz,exit
+static const uint8_t t_guard_a[] = { 0xFA, 0, 0, 0xFE, 0x03, 0xC2, 0, 0 };
+static const jit_patch t_guard_a_p[] = { { 1, PK_TYPE_A }, { 6, PK_EXIT } };
+static const uint8_t t_guard_b[] = { 0xFA, 0, 0, 0xFE, 0x03, 0xC2, 0, 0 };
+static const jit_patch t_guard_b_p[] = { { 1, PK_TYPE_B }, { 6, PK_EXIT } };
+
+// ld hl,R[b]; ld de,R[a]; 3 x (ld a,(hl+); ld (de),a; inc de)
+static const uint8_t t_move[] = {
+    0x21, 0, 0, 0x11, 0, 0,
+    0x2A, 0x12, 0x13, 0x2A, 0x12, 0x13, 0x2A, 0x12, 0x13
+};
+static const jit_patch t_move_p[] = { { 1, PK_SLOT_B }, { 4, PK_SLOT_A } };
+
+// R[a] = type byte, imm
+static const uint8_t t_load[] = {
+    0x3E, 0, 0xEA, 0, 0,        // ld a,type; ld (R[a].type),a
+    0x3E, 0, 0xEA, 0, 0,        // ld a,lo;   ld (R[a].v.i),a
+    0x3E, 0, 0xEA, 0, 0         // ld a,hi;   ld (R[a].v.i+1),a
+};
+static const jit_patch t_load_p[] = {
+    { 1, PK_BYTE }, { 3, PK_TYPE_A }, { 6, PK_IMM_LO }, { 8, PK_VAL_A },
+    { 11, PK_IMM_HI }, { 13, PK_VAL_A1 }
+};
+
+// bc = R[b]; R[a] += bc (add/adc) or -= bc (sub/sbc)
+static const uint8_t t_add[] = {
+    0x21, 0, 0, 0x2A, 0x4F, 0x46,           // ld hl,R[b]; ld a,(hl+); ld c,a; ld b,(hl)
+    0x21, 0, 0, 0x7E, 0x81, 0x22, 0x7E, 0x88, 0x77
+};
+static const jit_patch t_add_p[] = { { 1, PK_VAL_B }, { 7, PK_VAL_A } };
+static const uint8_t t_sub[] = {
+    0x21, 0, 0, 0x2A, 0x4F, 0x46,
+    0x21, 0, 0, 0x7E, 0x91, 0x22, 0x7E, 0x98, 0x77
+};
+static const jit_patch t_sub_p[] = { { 1, PK_VAL_B }, { 7, PK_VAL_A } };
+
+// R[a] += imm / -= imm
+static const uint8_t t_addi[] = { 0x21, 0, 0, 0x7E, 0xC6, 0, 0x22, 0x7E, 0xCE, 0, 0x77 };
+static const jit_patch t_addi_p[] = { { 1, PK_VAL_A }, { 5, PK_IMM_LO }, { 9, PK_IMM_HI } };
+static const uint8_t t_subi[] = { 0x21, 0, 0, 0x7E, 0xD6, 0, 0x22, 0x7E, 0xDE, 0, 0x77 };
+static const jit_patch t_subi_p[] = { { 1, PK_VAL_A }, { 5, PK_IMM_LO }, { 9, PK_IMM_HI } };
+
+// R[a] = R[x] < R[y], xor the byte (1 turns < into >=)
+// Flipping both sign bits makes the signed compare an unsigned one, and
+// the borrow out of x - y is the answer.
+static const uint8_t t_cmp[] = {
+    0x21, 0, 0, 0x2A, 0x4F, 0x7E, 0xEE, 0x80, 0x47,   // bc = y ^ 0x8000
+    0x21, 0, 0, 0x5E, 0x23, 0x7E, 0xEE, 0x80, 0x57,   // de = x ^ 0x8000
+    0x7B, 0x91, 0x7A, 0x98,                           // carry = de < bc
+    0x3E, 0x00, 0xCE, 0x00, 0xEE, 0,                  // a = carry ^ byte
+    0x21, 0, 0, 0x22, 0x36, 0x00,                     // R[a].v.i = a
+    0x3C, 0xEA, 0, 0                                  // R[a].type = a + 1
+};
+static const jit_patch t_cmp_p[] = {
+    { 1, PK_VAL_Y }, { 10, PK_VAL_X }, { 27, PK_BYTE }, { 29, PK_VAL_A }, { 36, PK_TYPE_A }
+};
+
+// jp target
+static const uint8_t t_jmp[] = { 0xC3, 0, 0 };
+static const jit_patch t_jmp_p[] = { { 1, PK_TARGET } };
+
+// Back jump: ld hl,fuel; dec (hl); jp z,exit; jp target
+static const uint8_t t_jmp_back[] = { 0x21, 0, 0, 0x35, 0xCA, 0, 0, 0xC3, 0, 0 };
+static const jit_patch t_jmp_back_p[] = { { 1, PK_FUEL }, { 5, PK_TARGET_EXIT }, { 8, PK_TARGET } };
+
+// ld a,(R[a].type); cp 2; jp nc/c,target
+static const uint8_t t_jcond[] = { 0xFA, 0, 0, 0xFE, 0x02, 0, 0, 0 };
+static const jit_patch t_jcond_p[] = { { 1, PK_TYPE_A }, { 5, PK_BYTE }, { 6, PK_TARGET } };
+
+// Conditional back jump: jr over the fuel check when not taken
+static const uint8_t t_jcond_back[] = {
+    0xFA, 0, 0, 0xFE, 0x02, 0, 0x0A,
+    0x21, 0, 0, 0x35, 0xCA, 0, 0, 0xC3, 0, 0
+};
+static const jit_patch t_jcond_back_p[] = {
+    { 1, PK_TYPE_A }, { 5, PK_BYTE }, { 8, PK_FUEL }, { 12, PK_TARGET_EXIT }, { 15, PK_TARGET }
+};
+
+// Condition bytes
+#define JIT_JMPIF        0xD2    // jp nc (type >= 2)
+#define JIT_JMPNOT       0xDA    // jp c
+#define JIT_JMPIF_BACK   0x38    // jr c past the taken path
+#define JIT_JMPNOT_BACK  0x30    // jr nc
+
+#elif defined(__x86_64__)
+
+/*
+ * x86-64 backend (host)
+ * Code is called as uint16_t fn(mrbz_value* regs, uint8_t* fuel): regs in
+ * rdi, fuel in rsi, the resume offset returned in eax. Register operands
+ * are 32-bit displacements from rdi; jumps are rel32.
+ */
+
+#define JIT_ADDR_BYTES   4
+#define JIT_BRANCH_BYTES 4
+#define JIT_VALUE_SIZE   4
+
+typedef uint16_t (*jit_fn)(mrbz_value* regs, uint8_t* fuel);
+
+// cmp byte [rdi+R[a].type],3; jne exit
+static const uint8_t t_guard_a[] = { 0x80, 0xBF, 0, 0, 0, 0, 0x03, 0x0F, 0x85, 0, 0, 0, 0 };
+static const jit_patch t_guard_a_p[] = { { 2, PK_TYPE_A }, { 9, PK_EXIT } };
+static const uint8_t t_guard_b[] = { 0x80, 0xBF, 0, 0, 0, 0, 0x03, 0x0F, 0x85, 0, 0, 0, 0 };
+static const jit_patch t_guard_b_p[] = { { 2, PK_TYPE_B }, { 9, PK_EXIT } };
+
+// mov eax,[R[b]]; mov [R[a]],eax
+static const uint8_t t_move[] = { 0x8B, 0x87, 0, 0, 0, 0, 0x89, 0x87, 0, 0, 0, 0 };
+static const jit_patch t_move_p[] = { { 2, PK_SLOT_B }, { 8, PK_SLOT_A } };
+
+// mov byte [R[a].type],type; mov word [R[a].v.i],imm
+static const uint8_t t_load[] = {
+    0xC6, 0x87, 0, 0, 0, 0, 0,
+    0x66, 0xC7, 0x87, 0, 0, 0, 0, 0, 0
+};
+static const jit_patch t_load_p[] = { { 2, PK_TYPE_A }, { 6, PK_BYTE }, { 10, PK_VAL_A }, { 14, PK_IMM } };
+
+// mov ax,[R[b].v.i]; add/sub [R[a].v.i],ax
+static const uint8_t t_add[] = { 0x66, 0x8B, 0x87, 0, 0, 0, 0, 0x66, 0x01, 0x87, 0, 0, 0, 0 };
+static const jit_patch t_add_p[] = { { 3, PK_VAL_B }, { 10, PK_VAL_A } };
+static const uint8_t t_sub[] = { 0x66, 0x8B, 0x87, 0, 0, 0, 0, 0x66, 0x29, 0x87, 0, 0, 0, 0 };
+static const jit_patch t_sub_p[] = { { 3, PK_VAL_B }, { 10, PK_VAL_A } };
+
+// add/sub word [R[a].v.i],imm
+static const uint8_t t_addi[] = { 0x66, 0x81, 0x87, 0, 0, 0, 0, 0, 0 };
+static const jit_patch t_addi_p[] = { { 3, PK_VAL_A }, { 7, PK_IMM } };
+static const uint8_t t_subi[] = { 0x66, 0x81, 0xAF, 0, 0, 0, 0, 0, 0 };
+static const jit_patch t_subi_p[] = { { 3, PK_VAL_A }, { 7, PK_IMM } };
+
+// R[a] = R[a] cc R[b], the byte picks the setcc
+static const uint8_t t_cmp[] = {
+    0x66, 0x8B, 0x87, 0, 0, 0, 0,       // mov ax,[R[a].v.i]
+    0x66, 0x3B, 0x87, 0, 0, 0, 0,       // cmp ax,[R[b].v.i]
+    0x0F, 0, 0xC1,                      // setcc cl
+    0x0F, 0xB6, 0xC9,                   // movzx ecx,cl
+    0x66, 0x89, 0x8F, 0, 0, 0, 0,       // mov [R[a].v.i],cx
+    0xFE, 0xC1,                         // inc cl
+    0x88, 0x8F, 0, 0, 0, 0              // mov [R[a].type],cl
+};
+static const jit_patch t_cmp_p[] = {
+    { 3, PK_VAL_A }, { 10, PK_VAL_B }, { 15, PK_BYTE }, { 23, PK_VAL_A }, { 31, PK_TYPE_A }
+};
+
+// jmp target
+static const uint8_t t_jmp[] = { 0xE9, 0, 0, 0, 0 };
+static const jit_patch t_jmp_p[] = { { 1, PK_TARGET } };
+
+// Back jump: dec byte [rsi]; jz exit; jmp target
+static const uint8_t t_jmp_back[] = { 0xFE, 0x0E, 0x0F, 0x84, 0, 0, 0, 0, 0xE9, 0, 0, 0, 0 };
+static const jit_patch t_jmp_back_p[] = { { 4, PK_TARGET_EXIT }, { 9, PK_TARGET } };
+
+// cmp byte [R[a].type],2; jae/jb target
+static const uint8_t t_jcond[] = { 0x80, 0xBF, 0, 0, 0, 0, 0x02, 0x0F, 0, 0, 0, 0, 0 };
+static const jit_patch t_jcond_p[] = { { 2, PK_TYPE_A }, { 8, PK_BYTE }, { 9, PK_TARGET } };
+
+// Conditional back jump: short jump over the fuel check when not taken
+static const uint8_t t_jcond_back[] = {
+    0x80, 0xBF, 0, 0, 0, 0, 0x02, 0, 0x0D,
+    0xFE, 0x0E, 0x0F, 0x84, 0, 0, 0, 0, 0xE9, 0, 0, 0, 0
+};
+static const jit_patch t_jcond_back_p[] = {
+    { 2, PK_TYPE_A }, { 7, PK_BYTE }, { 13, PK_TARGET_EXIT }, { 18, PK_TARGET }
+};
+
+// Condition bytes
+#define JIT_JMPIF        0x83    // jae (type >= 2)
+#define JIT_JMPNOT       0x82    // jb
+#define JIT_JMPIF_BACK   0x72    // jb past the taken path
+#define JIT_JMPNOT_BACK  0x73    // jae
+
+#else
+#error "MRBZ_JIT needs the Game Boy (SDCC sm83) or an x86-64 host"
+#endif
+
+// Templates patch a fixed value layout and type numbering
+typedef char jit_value_layout[sizeof(mrbz_value) == JIT_VALUE_SIZE ? 1 : -1];
+typedef char jit_type_order[MRBZ_T_INT == 3 && MRBZ_T_TRUE == 2 ? 1 : -1];
+
+static const jit_template tpl_guard_a = TEMPLATE(t_guard_a);
+static const jit_template tpl_guard_b = TEMPLATE(t_guard_b);
+static const jit_template tpl_move = TEMPLATE(t_move);
+static const jit_template tpl_load = TEMPLATE(t_load);
+static const jit_template tpl_add = TEMPLATE(t_add);
+static const jit_template tpl_sub = TEMPLATE(t_sub);
+static const jit_template tpl_addi = TEMPLATE(t_addi);
+static const jit_template tpl_subi = TEMPLATE(t_subi);
+static const jit_template tpl_cmp = TEMPLATE(t_cmp);
+static const jit_template tpl_jmp = TEMPLATE(t_jmp);
+static const jit_template tpl_jmp_back = TEMPLATE(t_jmp_back);
+static const jit_template tpl_jcond = TEMPLATE(t_jcond);
+static const jit_template tpl_jcond_back = TEMPLATE(t_jcond_back);
+
+// Jumps patched once the whole loop is laid out
+#define JIT_FIXUPS 24
+
+typedef struct {
+    uint16_t pos;       // Offset of the hole in the code
+    uint16_t pc;        // Bytecode offset it refers to
+    uint8_t exit;       // Always leave (PK_EXIT, PK_TARGET_EXIT)
+} jit_fixup;
+
+// Compiler state for one loop
+typedef struct {
+    mrbz_value* regs;
+    uint8_t* out;                       // Start of this loop's code
+    uint16_t len;                       // Bytes emitted
+    uint16_t cap;                       // Room in the buffer
+    uint16_t header;
+    uint16_t end;
+    uint16_t native[MRBZ_JIT_REGION];   // Code offset per bytecode offset
+    jit_fixup fixups[JIT_FIXUPS];
+    uint8_t fixup_count;
+    uint8_t ok;
+
+    // Operands of the instruction being compiled
+    uint16_t pc;
+    uint16_t target;
+    int16_t imm;
+    uint8_t a, b, x, y;
+    uint8_t byte;
+} jit_comp;
+
+// Store a little-endian value of n bytes
+static void put_le(uint8_t* p, uint32_t v, uint8_t n) {
+    while (n--) {
+        *p++ = (uint8_t)v;
+        v >>= 8;
+    }
+}
+
+// Register operand: a displacement from the window (x86-64) or an
+// absolute address (Game Boy)
+static void put_addr(jit_comp* c, uint8_t* p, const void* addr) {
+#if JIT_ADDR_BYTES == 4
+    put_le(p, (uint32_t)((const uint8_t*)addr - (const uint8_t*)c->regs), 4);
+#else
+    (void)c;
+    put_le(p, (uint16_t)(uintptr_t)addr, 2);
+#endif
+}
+
+// Copy a template and fill in its holes
+static void emit(jit_comp* c, const jit_template* t) {
+    uint8_t* p;
+    const jit_patch* patch;
+    uint8_t i;
+
+    if (!c->ok || c->len + t->len > c->cap) {
+        c->ok = 0;
+        return;
+    }
+    p = c->out + c->len;
+    for (i = 0; i < t->len; i++) {
+        p[i] = t->code[i];
+    }
+    for (i = 0; i < t->patch_count; i++) {
+        patch = &t->patches[i];
+        switch (patch->kind) {
+            case PK_TYPE_A: put_addr(c, p + patch->off, &c->regs[c->a].type); break;
+            case PK_VAL_A:  put_addr(c, p + patch->off, &c->regs[c->a].v.i); break;
+            case PK_VAL_A1: put_addr(c, p + patch->off, (const uint8_t*)&c->regs[c->a].v.i + 1); break;
+            case PK_TYPE_B: put_addr(c, p + patch->off, &c->regs[c->b].type); break;
+            case PK_VAL_B:  put_addr(c, p + patch->off, &c->regs[c->b].v.i); break;
+            case PK_VAL_X:  put_addr(c, p + patch->off, &c->regs[c->x].v.i); break;
+            case PK_VAL_Y:  put_addr(c, p + patch->off, &c->regs[c->y].v.i); break;
+            case PK_SLOT_A: put_addr(c, p + patch->off, &c->regs[c->a]); break;
+            case PK_SLOT_B: put_addr(c, p + patch->off, &c->regs[c->b]); break;
+#if JIT_ADDR_BYTES == 2
+            case PK_FUEL:   put_addr(c, p + patch->off, &jit_fuel); break;
+#endif
+            case PK_BYTE:   p[patch->off] = c->byte; break;
+            case PK_IMM:    put_le(p + patch->off, (uint16_t)c->imm, 2); break;
+            case PK_IMM_LO: p[patch->off] = (uint8_t)c->imm; break;
+            case PK_IMM_HI: p[patch->off] = (uint8_t)((uint16_t)c->imm >> 8); break;
+            default:
+                // Jumps: resolved once every instruction has its address
+                if (c->fixup_count == JIT_FIXUPS) {
+                    c->ok = 0;
+                    return;
+                }
+                c->fixups[c->fixup_count].pos = c->len + patch->off;
+                c->fixups[c->fixup_count].pc = patch->kind == PK_EXIT ? c->pc : c->target;
+                c->fixups[c->fixup_count].exit = patch->kind != PK_TARGET;
+                c->fixup_count++;
+                break;
+        }
+    }
+    c->len += t->len;
+}
+
+// Code that leaves the loop at bytecode offset pc; returns its offset
+static uint16_t emit_exit(jit_comp* c, uint16_t pc, uint16_t* common) {
+    uint16_t at = c->len;
+    uint8_t* p = c->out + c->len;
+
+#if JIT_ADDR_BYTES == 2
+    // ld bc,pc; jp common (common: store bc in jit_exit_pc and return)
+    if (*common == MRBZ_JIT_NONE) {
+        if (c->len + 7 > c->cap) {
+            c->ok = 0;
+            return 0;
+        }
+        *common = c->len;
+        p[0] = 0x21;
+        put_le(p + 1, (uint16_t)(uintptr_t)&jit_exit_pc, 2);
+        p[3] = 0x71;    // ld (hl),c
+        p[4] = 0x23;    // inc hl
+        p[5] = 0x70;    // ld (hl),b
+        p[6] = 0xC9;    // ret
+        c->len += 7;
+        at = c->len;
+        p = c->out + c->len;
+    }
+    if (c->len + 6 > c->cap) {
+        c->ok = 0;
+        return 0;
+    }
+    p[0] = 0x01;
+    put_le(p + 1, pc, 2);
+    p[3] = 0xC3;
+    put_le(p + 4, (uint16_t)(uintptr_t)(c->out + *common), 2);
+    c->len += 6;
+#else
+    // mov eax,pc; ret
+    (void)common;
+    if (c->len + 6 > c->cap) {
+        c->ok = 0;
+        return 0;
+    }
+    p[0] = 0xB8;
+    put_le(p + 1, pc, 4);
+    p[5] = 0xC3;
+    c->len += 6;
+#endif
+    return at;
+}
+
+// Point every jump at its target or at an exit
+static void resolve(jit_comp* c) {
+    uint16_t exits[JIT_FIXUPS];
+    uint16_t common = MRBZ_JIT_NONE;
+    uint16_t dest;
+    jit_fixup* f;
+    uint8_t i, j;
+
+    for (i = 0; i < c->fixup_count && c->ok; i++) {
+        f = &c->fixups[i];
+        if (!f->exit && f->pc >= c->header && f->pc < c->end) {
+            dest = c->native[f->pc - c->header];
+            if (dest == MRBZ_JIT_NONE) {
+                c->ok = 0;  // Not an instruction boundary
+                return;
+            }
+        } else {
+            // One exit per distinct offset
+            for (j = 0; j < i; j++) {
+                if (c->fixups[j].pc == f->pc && exits[j] != MRBZ_JIT_NONE) {
+                    break;
+                }
+            }
+            dest = j < i ? exits[j] : emit_exit(c, f->pc, &common);
+        }
+        exits[i] = f->exit || f->pc < c->header || f->pc >= c->end ? dest : MRBZ_JIT_NONE;
+#if JIT_BRANCH_BYTES == 4
+        put_le(c->out + f->pos, (uint32_t)(dest - (f->pos + 4)), 4);
+#else
+        put_le(c->out + f->pos, (uint16_t)(uintptr_t)(c->out + dest), 2);
+#endif
+    }
+}
+
+// Compile a loop; returns its instruction count, 0 if it can't be compiled
+static uint8_t compile(mrbz_vm* vm, mrbz_jit_loop* loop, mrbz_value* regs) {
+    const uint8_t* bc = vm->bytecode;
+    const uint8_t* syms = &vm->irep_syms[vm->ireps[vm->ctx->irep].syms];
+    const mrbz_value* gv;
+    jit_comp c;
+    uint16_t i, pc;
+    uint8_t op, len, slot, ops = 0;
+    int16_t offset;
+
+    if (loop->end - loop->header > MRBZ_JIT_REGION) {
+        return 0;
+    }
+    c.regs = regs;
+    c.out = vm->jit_code + vm->jit_used;
+    c.len = 0;
+    c.cap = vm->jit_cap - vm->jit_used;
+    c.header = loop->header;
+    c.end = loop->end;
+    c.fixup_count = 0;
+    c.ok = 1;
+    for (i = 0; i < MRBZ_JIT_REGION; i++) {
+        c.native[i] = MRBZ_JIT_NONE;
+    }
+
+    for (pc = loop->header; pc < loop->end && c.ok; pc += len) {
+        op = bc[pc];
+        len = mrbz_op_length(op);
+        c.native[pc - loop->header] = c.len;
+        c.pc = pc;
+        c.a = bc[pc + 1];
+        c.b = c.a + 1;
+        c.byte = MRBZ_T_INT;
+        ops++;
+
+        switch (op) {
+            case OP_MOVE:
+                c.b = bc[pc + 2];
+                emit(&c, &tpl_move);
+                break;
+
+            case OP_LOADI_0: case OP_LOADI_1: case OP_LOADI_2: case OP_LOADI_3:
+            case OP_LOADI_4: case OP_LOADI_5: case OP_LOADI_6: case OP_LOADI_7:
+                c.imm = op - OP_LOADI_0;
+                emit(&c, &tpl_load);
+                break;
+
+            case OP_LOADI__1:
+                c.imm = -1;
+                emit(&c, &tpl_load);
+                break;
+
+            case OP_LOADI:
+                c.imm = bc[pc + 2];
+                emit(&c, &tpl_load);
+                break;
+
+            case OP_LOADINEG:
+                c.imm = -(int16_t)bc[pc + 2];
+                emit(&c, &tpl_load);
+                break;
+
+            case OP_LOADI16:
+                c.imm = (int16_t)(((uint16_t)bc[pc + 2] << 8) | bc[pc + 3]);
+                emit(&c, &tpl_load);
+                break;
+
+            case OP_LOADNIL:
+            case OP_LOADT:
+            case OP_LOADF:
+                c.byte = op == OP_LOADNIL ? MRBZ_T_NIL : op == OP_LOADT ? MRBZ_T_TRUE : MRBZ_T_FALSE;
+                c.imm = op == OP_LOADT;
+                emit(&c, &tpl_load);
+                break;
+
+            case OP_GETGV:
+                slot = vm->sym_global[syms[bc[pc + 2]]];
+                if (slot == MRBZ_GLOBAL_NONE || !(vm->global_flags[slot] & MRBZ_GV_CONST)) {
+                    return 0;
+                }
+                gv = &vm->globals[slot];
+                if (gv->type != MRBZ_T_INT && gv->type != MRBZ_T_FIXED && gv->type != MRBZ_T_NIL &&
+                    gv->type != MRBZ_T_TRUE && gv->type != MRBZ_T_FALSE) {
+                    return 0;
+                }
+                c.byte = gv->type;
+                c.imm = gv->type == MRBZ_T_TRUE ? 1 : gv->type == MRBZ_T_INT || gv->type == MRBZ_T_FIXED ? gv->v.i : 0;
+                emit(&c, &tpl_load);
+                break;
+
+            case OP_ADD:
+            case OP_SUB:
+                emit(&c, &tpl_guard_a);
+                emit(&c, &tpl_guard_b);
+                emit(&c, op == OP_ADD ? &tpl_add : &tpl_sub);
+                break;
+
+            case OP_ADDI:
+            case OP_SUBI:
+                c.imm = bc[pc + 2];
+                emit(&c, &tpl_guard_a);
+                emit(&c, op == OP_ADDI ? &tpl_addi : &tpl_subi);
+                break;
+
+            case OP_LT:
+            case OP_LE:
+            case OP_GT:
+            case OP_GE:
+                emit(&c, &tpl_guard_a);
+                emit(&c, &tpl_guard_b);
+#if JIT_ADDR_BYTES == 2
+                // x < y, or its negation: a > b is b < a
+                c.x = op == OP_LT || op == OP_GE ? c.a : c.b;
+                c.y = op == OP_LT || op == OP_GE ? c.b : c.a;
+                c.byte = op == OP_GE || op == OP_LE;
+#else
+                c.byte = op == OP_LT ? 0x9C : op == OP_LE ? 0x9E : op == OP_GT ? 0x9F : 0x9D;
+#endif
+                emit(&c, &tpl_cmp);
+                break;
+
+            case OP_JMP:
+                offset = (int16_t)(((uint16_t)bc[pc + 1] << 8) | bc[pc + 2]);
+                c.target = pc + len + offset;
+                emit(&c, c.target <= pc && c.target >= loop->header ? &tpl_jmp_back : &tpl_jmp);
+                break;
+
+            case OP_JMPIF:
+            case OP_JMPNOT:
+                offset = (int16_t)(((uint16_t)bc[pc + 2] << 8) | bc[pc + 3]);
+                c.target = pc + len + offset;
+                if (c.target <= pc && c.target >= loop->header) {
+                    c.byte = op == OP_JMPIF ? JIT_JMPIF_BACK : JIT_JMPNOT_BACK;
+                    emit(&c, &tpl_jcond_back);
+                } else {
+                    c.byte = op == OP_JMPIF ? JIT_JMPIF : JIT_JMPNOT;
+                    emit(&c, &tpl_jcond);
+                }
+                break;
+
+            default:
+                return 0;
+        }
+    }
+    if (pc != loop->end) {
+        return 0;
+    }
+
+    // Falling out of the bottom leaves the loop
+    c.pc = pc;
+    c.target = loop->end;
+    emit(&c, &tpl_jmp);
+    resolve(&c);
+    if (!c.ok) {
+        return 0;
+    }
+
+    loop->code = vm->jit_used;
+    loop->regs = regs;
+    vm->jit_used += c.len;
+    return ops;
+}
+
+// Run a compiled loop with fuel back jumps; returns where to resume
+static uint16_t run(mrbz_vm* vm, mrbz_jit_loop* loop, mrbz_value* regs, uint8_t* fuel) {
+#if JIT_ADDR_BYTES == 2
+    (void)regs;
+    jit_fuel = *fuel;
+    ((void (*)(void))(vm->jit_code + loop->code))();
+    *fuel = jit_fuel;
+    return jit_exit_pc;
+#else
+    return ((jit_fn)(void*)(vm->jit_code + loop->code))(regs, fuel);
+#endif
+}
+
+void mrbz_jit_init(mrbz_vm* vm, uint8_t* code, uint16_t cap) {
+    vm->jit_code = code;
+    vm->jit_cap = cap;
+    vm->jit_used = 0;
+    vm->jit_loop_count = 0;
+}
+
+uint16_t mrbz_jit_back_jump(mrbz_vm* vm, mrbz_value* regs, uint16_t header, uint16_t end) {
+    mrbz_jit_loop* loop;
+    uint16_t resume, passes;
+    uint8_t i, fuel, left;
+
+    if (!vm->jit_code) {
+        return header;
+    }
+    for (i = 0; i < vm->jit_loop_count; i++) {
+        if (vm->jit_loops[i].header == header) {
+            break;
+        }
+    }
+    loop = &vm->jit_loops[i];
+    if (i == vm->jit_loop_count) {
+        if (i == MRBZ_JIT_LOOPS) {
+            return header;
+        }
+        vm->jit_loop_count++;
+        loop->header = header;
+        loop->end = end;
+        loop->code = MRBZ_JIT_NONE;
+        loop->hits = 0;
+    }
+
+    if (loop->code == MRBZ_JIT_NONE) {
+        // hits stays at 0xFF once a loop turns out not to compile
+        if (loop->hits == 0xFF || ++loop->hits < MRBZ_JIT_HOT) {
+            return header;
+        }
+        loop->ops = compile(vm, loop, regs);
+        if (!loop->ops) {
+            loop->hits = 0xFF;
+            return header;
+        }
+#if MRBZ_STATS
+        vm->stats.jit_compiled++;
+#endif
+    }
+    if (loop->regs != regs) {
+        return header;
+    }
+
+    // Passes the step budget allows
+    fuel = 0xFF;
+    if (vm->stepping && !vm->block_top) {
+        passes = vm->budget / loop->ops;
+        if (passes == 0) {
+            return header;
+        }
+        if (passes < fuel) {
+            fuel = (uint8_t)passes;
+        }
+    }
+
+    // Out of fuel: exactly fuel passes; otherwise the passes that jumped
+    // back plus the one that left
+    left = fuel;
+    resume = run(vm, loop, regs, &left);
+    passes = (uint16_t)(fuel - left) + (left != 0);
+    if (vm->stepping && !vm->block_top) {
+        vm->budget -= passes * loop->ops;
+    }
+#if MRBZ_STATS
+    vm->stats.jit_ops += (uint32_t)passes * loop->ops;
+#endif
+    return resume;
+}
+
+#endif // MRBZ_JIT
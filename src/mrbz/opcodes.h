@@ -166,4 +166,7 @@ enum OPCODE {
     OP_STOP       = 0x69, // Z    stop VM
 };
 
+// Number of opcodes (highest + 1)
+#define MRBZ_OP_COUNT 0x6A
+
 #endif // MRBZ_OPCODES_H
@@ -0,0 +1,422 @@
+/**
+ * mrbz - Minimal Ruby for Game Boy
+ * Snapshot and restore of interpreter state
+ *
+ * A snapshot holds only what changes at run time: execution contexts,
+ * registers, live arrays, instance variables, globals and constants. Symbols,
+ * IREPs, the literal pool and load-time analysis come from the bytecode,
+ * so a snapshot is restored into a VM that has loaded the same program.
+ * Values are stored as a type byte plus 0-2 payload bytes, and only the
+ * registers an IREP uses and the arrays in use are written, so a typical
+ * snapshot is a few hundred bytes.
+ *
+ * Take and restore snapshots between mrbz_vm_step calls (or before the
+ * first one), never from inside a builtin.
+ */
+
+#include "vm.h"
+
+#define SNAP_MAGIC0  'M'
+#define SNAP_MAGIC1  'Z'
+#define SNAP_VERSION 4
+
+// Context parent encoding
+#define PARENT_NONE 0xFF
+#define PARENT_ROOT 0xFE
+
+// Buffer cursor; a write or read past cap sets ok to 0
+typedef struct {
+    uint8_t* buf;
+    uint16_t pos;
+    uint16_t cap;
+    uint8_t ok;
+} snap_io;
+
+static void put_u8(snap_io* io, uint8_t v) {
+    if (io->pos >= io->cap) {
+        io->ok = 0;
+        return;
+    }
+    io->buf[io->pos++] = v;
+}
+
+static void put_u16(snap_io* io, uint16_t v) {
+    put_u8(io, v & 0xFF);
+    put_u8(io, v >> 8);
+}
+
+static uint8_t get_u8(snap_io* io) {
+    if (io->pos >= io->cap) {
+        io->ok = 0;
+        return 0;
+    }
+    return io->buf[io->pos++];
+}
+
+static uint16_t get_u16(snap_io* io) {
+    uint16_t lo = get_u8(io);
+    return lo | ((uint16_t)get_u8(io) << 8);
+}
+
+// Value: type byte, then int16 for numbers, one index byte for handles,
+// slot and generation bytes for fibers or first and count bytes for ranges
+static void put_value(snap_io* io, mrbz_value v) {
+    put_u8(io, v.type);
+    switch (v.type) {
+        case MRBZ_T_INT:
+        case MRBZ_T_FIXED:
+            put_u16(io, (uint16_t)v.v.i);
+            break;
+        case MRBZ_T_SYMBOL:
+        case MRBZ_T_ARRAY:
+        case MRBZ_T_HASH:
+        case MRBZ_T_CLASS:
+        case MRBZ_T_PROC:
+            put_u8(io, v.v.arr);
+            break;
+        case MRBZ_T_FIBER:
+            put_u8(io, v.v.fib.slot);
+            put_u8(io, v.v.fib.gen);
+            break;
+        case MRBZ_T_RANGE:
+            put_u8(io, (uint8_t)v.v.range.first);
+            put_u8(io, v.v.range.len);
+            break;
+        default:
+            break;
+    }
+}
+
+static mrbz_value get_value(snap_io* io) {
+    mrbz_value v;
+
+    v.type = get_u8(io);
+    v.v.i = 0;
+    switch (v.type) {
+        case MRBZ_T_INT:
+        case MRBZ_T_FIXED:
+            v.v.i = (int16_t)get_u16(io);
+            break;
+        case MRBZ_T_SYMBOL:
+        case MRBZ_T_ARRAY:
+        case MRBZ_T_HASH:
+        case MRBZ_T_CLASS:
+        case MRBZ_T_PROC:
+            v.v.arr = get_u8(io);
+            break;
+        case MRBZ_T_FIBER:
+            v.v.fib.slot = get_u8(io);
+            v.v.fib.gen = get_u8(io);
+            break;
+        case MRBZ_T_RANGE:
+            v.v.range.first = (int8_t)get_u8(io);
+            v.v.range.len = get_u8(io);
+            break;
+        case MRBZ_T_NIL:
+        case MRBZ_T_FALSE:
+        case MRBZ_T_TRUE:
+            break;
+        default:
+            io->ok = 0;
+            break;
+    }
+    return v;
+}
+
+static void put_values(snap_io* io, const mrbz_value* v, uint8_t n) {
+    uint8_t i;
+    for (i = 0; i < n; i++) {
+        put_value(io, v[i]);
+    }
+}
+
+static void get_values(snap_io* io, mrbz_value* v, uint8_t n) {
+    uint8_t i;
+    for (i = 0; i < n; i++) {
+        v[i] = get_value(io);
+    }
+}
+
+// Whether a restored value refers to something that exists in this VM
+// Array and Hash handles must be a pool array below next_array or one of
+// the program's scratch slots, so restore the arrays before checking.
+static uint8_t value_ok(mrbz_vm* vm, mrbz_value v) {
+    switch (v.type) {
+        case MRBZ_T_SYMBOL:
+            return v.v.sym < vm->sym_count;
+        case MRBZ_T_ARRAY:
+        case MRBZ_T_HASH:
+            if (v.v.arr < MRBZ_MAX_ARRAYS) return v.v.arr < vm->next_array;
+            return v.v.arr - MRBZ_MAX_ARRAYS < vm->scratch_count;
+        case MRBZ_T_CLASS:
+            return v.v.cls < MRBZ_CLASS_COUNT;
+        case MRBZ_T_PROC:
+            return v.v.irep < vm->irep_count;
+        case MRBZ_T_FIBER:
+            return v.v.fib.slot < MRBZ_MAX_FIBERS;
+        default:
+            return 1;
+    }
+}
+
+static uint8_t values_ok(mrbz_vm* vm, const mrbz_value* v, uint8_t n) {
+    uint8_t i;
+    for (i = 0; i < n; i++) {
+        if (!value_ok(vm, v[i])) return 0;
+    }
+    return 1;
+}
+
+// Whether a restored context resumes inside its IREP
+static uint8_t ctx_ok(mrbz_vm* vm, const mrbz_ctx* ctx) {
+    const mrbz_irep* irep;
+
+    if (ctx->irep >= vm->irep_count) return 0;
+    irep = &vm->ireps[ctx->irep];
+    return ctx->pc >= irep->insns && ctx->pc <= irep->end;
+}
+
+// Registers a context's IREP uses
+static uint8_t ctx_regs(mrbz_vm* vm, const mrbz_ctx* ctx, uint8_t max) {
+    uint8_t n = vm->ireps[ctx->irep].nregs;
+    return n < max ? n : max;
+}
+
+// Serialize the running state; returns bytes written, 0 if cap is too small
+uint16_t mrbz_vm_snapshot(mrbz_vm* vm, uint8_t* buf, uint16_t cap) {
+    snap_io io;
+    mrbz_ctx* f;
+    uint8_t i, n, status;
+
+    io.buf = buf;
+    io.pos = 0;
+    io.cap = cap;
+    io.ok = 1;
+
+    // Header: identifies the program the snapshot belongs to
+    put_u8(&io, SNAP_MAGIC0);
+    put_u8(&io, SNAP_MAGIC1);
+    put_u8(&io, SNAP_VERSION);
+    put_u8(&io, vm->irep_count);
+    put_u8(&io, vm->sym_count);
+    put_u8(&io, vm->pool_count);
+    put_u16(&io, vm->ireps[vm->irep_count - 1].end);
+
+    // Top level
+    put_u16(&io, vm->root.pc);
+    put_u8(&io, vm->root.irep);
+    put_u8(&io, vm->root.status);
+    n = ctx_regs(vm, &vm->root, MRBZ_MAX_REGS);
+    put_u8(&io, n);
+    put_values(&io, vm->regs, n);
+
+    // Live fibers; one stopped mid-turn resumes at its next turn
+    put_u8(&io, vm->fiber_turn);
+    for (i = 0; i < MRBZ_MAX_FIBERS; i++) {
+        put_u8(&io, vm->fiber_gen[i]);
+    }
+    for (i = 0; i < MRBZ_MAX_FIBERS; i++) {
+        f = &vm->fibers[i];
+        if (f->status == MRBZ_CTX_DONE) continue;
+        status = f->status == MRBZ_CTX_RUNNING ? MRBZ_CTX_SUSPENDED : f->status;
+        put_u8(&io, i);
+        put_u16(&io, f->pc);
+        put_u8(&io, f->irep);
+        put_u8(&io, status);
+        if (!f->parent) {
+            put_u8(&io, PARENT_NONE);
+        } else if (f->parent == &vm->root) {
+            put_u8(&io, PARENT_ROOT);
+        } else {
+            put_u8(&io, (uint8_t)(f->parent - vm->fibers));
+        }
+        put_u8(&io, f->parent_gen);
+        n = ctx_regs(vm, f, MRBZ_FIBER_REGS);
+        put_u8(&io, n);
+        put_values(&io, f->regs, n);
+    }
+    put_u8(&io, MRBZ_FIBER_NONE);
+
+    // Arrays in use: the pool below next_array, then the scratch slots
+    put_u8(&io, vm->next_array);
+    for (i = 0; i < vm->next_array; i++) {
+        put_u8(&io, vm->array_lens[i]);
+        put_values(&io, vm->arrays[i], vm->array_lens[i]);
+    }
+    for (i = 0; i < vm->scratch_count; i++) {
+        n = vm->array_lens[MRBZ_MAX_ARRAYS + i];
+        put_u8(&io, n);
+        put_values(&io, vm->scratch[i], n);
+    }
+
+    // Instance variables, globals (slots come from the program) and constants
+    put_u8(&io, vm->ivar_count);
+    for (i = 0; i < vm->ivar_count; i++) {
+        put_u8(&io, vm->ivar_syms[i]);
+        put_value(&io, vm->ivars[i]);
+    }
+    put_u8(&io, vm->global_count);
+    put_values(&io, vm->globals, vm->global_count);
+    put_u8(&io, vm->const_count);
+    for (i = 0; i < vm->const_count; i++) {
+        put_u8(&io, vm->const_syms[i]);
+        put_value(&io, vm->consts[i]);
+    }
+
+    return io.ok ? io.pos : 0;
+}
+
+// Restore a snapshot into a VM that has loaded the same program
+// Returns the bytes consumed, or 0 if the snapshot belongs to another
+// program (VM untouched) or is corrupt (VM stopped).
+uint16_t mrbz_vm_restore(mrbz_vm* vm, uint8_t* buf, uint16_t len) {
+    snap_io io;
+    mrbz_ctx* f;
+    uint8_t i, n, idx, parent;
+
+    io.buf = buf;
+    io.pos = 0;
+    io.cap = len;
+    io.ok = 1;
+
+    if (get_u8(&io) != SNAP_MAGIC0 || get_u8(&io) != SNAP_MAGIC1 ||
+        get_u8(&io) != SNAP_VERSION || get_u8(&io) != vm->irep_count ||
+        get_u8(&io) != vm->sym_count || get_u8(&io) != vm->pool_count ||
+        get_u16(&io) != vm->ireps[vm->irep_count - 1].end) {
+        return 0;
+    }
+
+    // Top level
+    vm->root.pc = get_u16(&io);
+    vm->root.irep = get_u8(&io);
+    vm->root.status = get_u8(&io);
+    n = get_u8(&io);
+    if (n > MRBZ_MAX_REGS || !ctx_ok(vm, &vm->root) ||
+        vm->root.status > MRBZ_CTX_SUSPENDED) {
+        io.ok = 0;
+        n = 0;
+    }
+    get_values(&io, vm->regs, n);
+    for (i = n; i < MRBZ_MAX_REGS; i++) {
+        MRBZ_SET_NIL(vm->regs[i]);
+    }
+
+    // Fibers
+    vm->fiber_turn = get_u8(&io);
+    if (vm->fiber_turn > MRBZ_MAX_FIBERS) {
+        io.ok = 0;
+    }
+    for (i = 0; i < MRBZ_MAX_FIBERS; i++) {
+        vm->fibers[i].status = MRBZ_CTX_DONE;
+        vm->fiber_gen[i] = get_u8(&io);
+    }
+    while (io.ok && (idx = get_u8(&io)) != MRBZ_FIBER_NONE) {
+        if (idx >= MRBZ_MAX_FIBERS) {
+            io.ok = 0;
+            break;
+        }
+        f = &vm->fibers[idx];
+        f->regs = vm->fiber_regs[idx];
+        f->pc = get_u16(&io);
+        f->irep = get_u8(&io);
+        f->status = get_u8(&io);
+        parent = get_u8(&io);
+        if (parent == PARENT_NONE) {
+            f->parent = 0;
+        } else if (parent == PARENT_ROOT) {
+            f->parent = &vm->root;
+        } else if (parent < MRBZ_MAX_FIBERS && parent != idx) {
+            f->parent = &vm->fibers[parent];
+        } else {
+            io.ok = 0;
+            break;
+        }
+        f->parent_gen = get_u8(&io);
+        n = get_u8(&io);
+        // Snapshots only hold live fibers, all of them suspended
+        if (n > MRBZ_FIBER_REGS || !ctx_ok(vm, f) ||
+            f->status != MRBZ_CTX_SUSPENDED) {
+            io.ok = 0;
+            break;
+        }
+        get_values(&io, f->regs, n);
+        for (; n < MRBZ_FIBER_REGS; n++) {
+            MRBZ_SET_NIL(f->regs[n]);
+        }
+    }
+
+    // Arrays
+    vm->next_array = get_u8(&io);
+    if (vm->next_array > MRBZ_MAX_ARRAYS) {
+        io.ok = 0;
+        vm->next_array = 0;
+    }
+    for (i = 0; i < vm->next_array && io.ok; i++) {
+        n = get_u8(&io);
+        if (n > MRBZ_MAX_ARRAY_LEN) {
+            io.ok = 0;
+            break;
+        }
+        vm->array_lens[i] = n;
+        get_values(&io, vm->arrays[i], n);
+    }
+    for (i = 0; i < vm->scratch_count && io.ok; i++) {
+        n = get_u8(&io);
+        if (n > MRBZ_SCRATCH_LEN) {
+            io.ok = 0;
+            break;
+        }
+        vm->array_lens[MRBZ_MAX_ARRAYS + i] = n;
+        get_values(&io, vm->scratch[i], n);
+    }
+
+    // Instance variables, globals and constants
+    vm->ivar_count = get_u8(&io);
+    if (vm->ivar_count > MRBZ_MAX_IVARS) {
+        io.ok = 0;
+        vm->ivar_count = 0;
+    }
+    for (i = 0; i < vm->ivar_count; i++) {
+        vm->ivar_syms[i] = get_u8(&io);
+        vm->ivars[i] = get_value(&io);
+        if (vm->ivar_syms[i] >= vm->sym_count) io.ok = 0;
+    }
+    if (get_u8(&io) != vm->global_count) {
+        io.ok = 0;
+    } else {
+        get_values(&io, vm->globals, vm->global_count);
+    }
+    vm->const_count = get_u8(&io);
+    if (vm->const_count > MRBZ_MAX_CONSTS) {
+        io.ok = 0;
+        vm->const_count = 0;
+    }
+    for (i = 0; i < vm->const_count; i++) {
+        vm->const_syms[i] = get_u8(&io);
+        vm->consts[i] = get_value(&io);
+        if (vm->const_syms[i] >= vm->sym_count) io.ok = 0;
+    }
+
+    // Every handle must name something restored above
+    if (io.ok) {
+        io.ok = values_ok(vm, vm->regs, MRBZ_MAX_REGS) &&
+                values_ok(vm, vm->ivars, vm->ivar_count) &&
+                values_ok(vm, vm->globals, vm->global_count) &&
+                values_ok(vm, vm->consts, vm->const_count);
+        for (i = 0; i < MRBZ_MAX_FIBERS && io.ok; i++) {
+            if (vm->fibers[i].status == MRBZ_CTX_DONE) continue;
+            io.ok = values_ok(vm, vm->fiber_regs[i], MRBZ_FIBER_REGS);
+        }
+        for (i = 0; i < vm->next_array && io.ok; i++) {
+            io.ok = values_ok(vm, vm->arrays[i], vm->array_lens[i]);
+        }
+        for (i = 0; i < vm->scratch_count && io.ok; i++) {
+            io.ok = values_ok(vm, vm->scratch[i], vm->array_lens[MRBZ_MAX_ARRAYS + i]);
+        }
+    }
+
+    vm->ctx = &vm->root;
+    vm->error = MRBZ_ERR_NONE;
+    vm->running = io.ok && vm->root.status != MRBZ_CTX_DONE;
+    return io.ok ? io.pos : 0;
+}
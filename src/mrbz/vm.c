@@ -6,10 +6,9 @@
 #include "vm.h"
 #include "opcodes.h"
 
-// Forward declaration for built-in dispatch (using output param for SDCC)
-extern void mrbz_builtin_call(mrbz_vm* vm, uint8_t sym_idx, uint8_t argc, uint8_t base_reg, mrbz_value* ret);
-
-// Debug flag (disable for release, or enable with -DMRBZ_DEBUG=1)
+// Load-time debug output (enable with -DMRBZ_DEBUG=1); instructions are
+// traced with MRBZ_TRACE instead, which doesn't slow them down enough to
+// change what a program does
 #ifndef MRBZ_DEBUG
 #define MRBZ_DEBUG 0
 #endif
@@ -21,15 +20,72 @@ extern void mrbz_builtin_call(mrbz_vm* vm, uint8_t sym_idx, uint8_t argc, uint8_
 #define DBG_PRINT(...)
 #endif
 
+// Target of a taken jump; back jumps (loops) go through the JIT, which
+// may run the loop natively and continue further on
+#if MRBZ_JIT
+#define JUMP_BACK(pc, offset) \
+    ((offset) < 0 && vm->jit_code ? mrbz_jit_back_jump(vm, regs, (pc) + (offset), (pc)) : (pc) + (offset))
+#else
+#define JUMP_BACK(pc, offset) ((pc) + (offset))
+#endif
+
 // Initialize the VM
 void mrbz_vm_init(mrbz_vm* vm) {
     uint8_t i;
     vm->running = 0;
+    vm->error = MRBZ_ERR_NONE;
+    vm->error_pc = 0;
+    vm->stepping = 0;
+    vm->budget = 0;
     vm->next_array = 0;
+#if MRBZ_STATS
+    vm->stats.gc_runs = 0;
+    vm->stats.gc_freed = 0;
+    vm->stats.gc_time_total = 0;
+    vm->stats.gc_time_max = 0;
+    for (i = 0; i < MRBZ_OP_COUNT; i++) {
+        vm->stats.ops[i] = 0;
+    }
+#if MRBZ_JIT
+    vm->stats.jit_compiled = 0;
+    vm->stats.jit_ops = 0;
+#endif
+#endif
+#if MRBZ_JIT
+    vm->jit_code = 0;
+    vm->jit_cap = 0;
+    vm->jit_used = 0;
+    vm->jit_loop_count = 0;
+#endif
+#if MRBZ_TRACE
+    vm->trace_pos = 0;
+    vm->trace_full = 0;
+#endif
+#if MRBZ_PROFILE
+    vm->prof_pc = 0;
+    vm->prof_sym = MRBZ_PROF_VM;
+#endif
     vm->sym_count = 0;
     vm->ivar_count = 0;
+    vm->global_count = 0;
     vm->const_count = 0;
+    vm->pool_count = 0;
+    vm->irep_count = 0;
+    vm->irep_sym_count = 0;
+    vm->irep_kid_count = 0;
     vm->bytecode = 0;
+    vm->platform = 0;
+    vm->ctx = &vm->root;
+    vm->root.status = MRBZ_CTX_DONE;
+
+    // No fibers yet
+    for (i = 0; i < MRBZ_MAX_FIBERS; i++) {
+        vm->fibers[i].status = MRBZ_CTX_DONE;
+        vm->fiber_gen[i] = 0;
+    }
+    vm->fiber_turn = MRBZ_MAX_FIBERS;
+    vm->block_top = 0;
+    vm->roots = 0;
 
     // Clear registers
     for (i = 0; i < MRBZ_MAX_REGS; i++) {
@@ -37,13 +93,17 @@ void mrbz_vm_init(mrbz_vm* vm) {
     }
 
     // Clear array lengths
-    for (i = 0; i < MRBZ_MAX_ARRAYS; i++) {
+    for (i = 0; i < MRBZ_MAX_ARRAYS + MRBZ_MAX_SCRATCH; i++) {
         vm->array_lens[i] = 0;
     }
+    vm->scratch_count = 0;
+    vm->switch_count = 0;
 
     // Clear symbol table
     for (i = 0; i < MRBZ_MAX_SYMBOLS; i++) {
         vm->sym_names[i] = 0;
+        vm->sym_builtin[i] = MRBZ_BUILTIN_NONE;
+        vm->sym_global[i] = MRBZ_GLOBAL_NONE;
     }
 }
 
@@ -81,14 +141,34 @@ static uint16_t read_u16(const uint8_t* p) {
     return ((uint16_t)p[0] << 8) | (uint16_t)p[1];
 }
 
-// Parse symbol table from bytecode
-// Symbols are after the instruction bytes, in format:
-// 2 bytes: symbol count
+// Add a symbol to the shared table (or find it), return its index
+static uint8_t intern_symbol(mrbz_vm* vm, const char* name) {
+    uint8_t idx;
+
+    idx = mrbz_find_symbol(vm, name);
+    if (idx != 0xFF) {
+        return idx;
+    }
+    if (vm->sym_count >= MRBZ_MAX_SYMBOLS) {
+        vm->error = MRBZ_ERR_LIMIT;
+        return 0xFF;
+    }
+    idx = vm->sym_count++;
+    vm->sym_names[idx] = name;
+    // Bind builtins once here so SEND dispatch is a table index
+    vm->sym_builtin[idx] = mrbz_builtin_lookup(name);
+    return idx;
+}
+
+// Parse an IREP's symbol list from bytecode, return offset just past it
+// Format: 2 bytes symbol count
 // For each symbol: 2 bytes length + characters + null terminator
-static void parse_symbols(mrbz_vm* vm, uint16_t offset) {
+// Every IREP has its own list; entries are mapped onto the shared table so
+// ivars, constants and builtins agree across blocks.
+static uint16_t parse_symbols(mrbz_vm* vm, mrbz_irep* irep, uint16_t offset) {
     const uint8_t* p;
-    uint16_t count, len;
-    uint8_t i;
+    uint16_t count, len, i;
+    uint8_t sym;
 
     p = vm->bytecode + offset;
     count = read_u16(p);
@@ -96,525 +176,1169 @@ static void parse_symbols(mrbz_vm* vm, uint16_t offset) {
 
     DBG_PRINT("Parsing %d symbols at offset %d\n", count, offset);
 
-    for (i = 0; i < count && i < MRBZ_MAX_SYMBOLS; i++) {
+    irep->syms = vm->irep_sym_count;
+    for (i = 0; i < count; i++) {
         len = read_u16(p);
         p += 2;
-        vm->sym_names[i] = (const char*)p;
-        DBG_PRINT("  sym[%d] = \"%s\"\n", i, vm->sym_names[i]);
+        sym = intern_symbol(vm, (const char*)p);
+        if (vm->irep_sym_count < MRBZ_MAX_IREP_SYMS) {
+            vm->irep_syms[vm->irep_sym_count++] = sym;
+        } else {
+            vm->error = MRBZ_ERR_LIMIT;
+        }
+        DBG_PRINT("  sym[%d] = \"%s\" -> %d\n", i, (const char*)p, sym);
         p += len + 1;  // +1 for null terminator
     }
-    vm->sym_count = (i < count) ? i : count;
+    return (uint16_t)(p - vm->bytecode);
 }
 
+// Convert an IEEE754 double (little-endian, as dumped by mrbc) to 8.8
+// fixed-point using integer ops only. Out-of-range values saturate.
+static int16_t double_to_fixed(const uint8_t* p) {
+    uint16_t exp;
+    uint32_t mant;
+    int16_t shift;
+    int16_t raw;
+
+    exp = ((uint16_t)(p[7] & 0x7F) << 4) | (p[6] >> 4);
+    if (exp == 0) {
+        return 0;
+    }
+
+    // Top 16 bits of the significand including the implicit 1 (1.m * 2^15)
+    mant = 0x8000UL | ((uint32_t)(p[6] & 0x0F) << 11) | ((uint16_t)p[5] << 3) | (p[4] >> 5);
+
+    // value * 256 = mant * 2^(exp - 1023 + 8 - 15)
+    shift = (int16_t)exp - 1030;
+    if (shift >= 0) {
+        raw = 0x7FFF;
+    } else if (shift < -16) {
+        raw = 0;
+    } else {
+        mant = ((mant >> (-shift - 1)) + 1) >> 1;  // Round to nearest
+        raw = mant > 0x7FFF ? 0x7FFF : (int16_t)mant;
+    }
+    return (p[7] & 0x80) ? -raw : raw;
+}
+
+// Parse an IREP's literal pool from bytecode, return offset just past it
+// Each entry: 1 byte type tag + data
+static uint16_t parse_pool(mrbz_vm* vm, mrbz_irep* irep, uint16_t offset) {
+    const uint8_t* p;
+    uint16_t count, i;
+    mrbz_value overflow;
+    mrbz_value* v;
+
+    p = vm->bytecode + offset;
+    count = read_u16(p);
+    p += 2;
+
+    irep->pool = vm->pool_count;
+    for (i = 0; i < count; i++) {
+        if (vm->pool_count >= MRBZ_MAX_POOL) {
+            vm->error = MRBZ_ERR_LIMIT;
+        }
+        v = vm->pool_count < MRBZ_MAX_POOL ? &vm->pool[vm->pool_count++] : &overflow;
+        MRBZ_SET_NIL(*v);
+        switch (*p++) {
+            case 0:  // String
+            case 2:  // Static string
+                p += read_u16(p) + 3;  // length + data + null terminator
+                break;
+            case 1:  // 32-bit integer (truncated to 16 bits)
+                MRBZ_SET_INT(*v, (int16_t)read_u16(p + 2));
+                p += 4;
+                break;
+            case 3:  // 64-bit integer (truncated to 16 bits)
+                MRBZ_SET_INT(*v, (int16_t)read_u16(p + 6));
+                p += 8;
+                break;
+            case 5:  // Float
+                MRBZ_SET_FIXED(*v, double_to_fixed(p));
+                DBG_PRINT("  pool[%d] = fixed %d\n", i, v->v.i);
+                p += 8;
+                break;
+            case 7:  // Bigint
+                p += *p + 2;  // length byte + base byte + digits
+                break;
+            default:
+                break;
+        }
+    }
+    return (uint16_t)(p - vm->bytecode);
+}
+
+// Widen a numeric value to 8.8 fixed-point in 32 bits
+static int32_t to_fixed32(mrbz_value v) {
+    if (v.type == MRBZ_T_FIXED) {
+        return v.v.i;
+    }
+    return (int32_t)v.v.i << MRBZ_FIXED_SHIFT;
+}
+
+#if MRBZ_HAS_OP(ADD) || MRBZ_HAS_OP(SUB) || MRBZ_HAS_OP(MUL) || MRBZ_HAS_OP(DIV) \
+    || MRBZ_HAS_OP(ADDI) || MRBZ_HAS_OP(SUBI)
+// Clamp a 32-bit fixed-point result into a value
+static void set_fixed32(mrbz_value* dest, int32_t raw) {
+    if (raw > 0x7FFF) raw = 0x7FFF;
+    if (raw < -0x8000) raw = -0x8000;
+    MRBZ_SET_FIXED(*dest, (int16_t)raw);
+}
+#endif
+
+// True if either operand of a binary op at R[a] is fixed-point
+#define FIXED_OPERANDS(regs, a) \
+    ((regs)[a].type == MRBZ_T_FIXED || (regs)[(a)+1].type == MRBZ_T_FIXED)
+
+#if MRBZ_HAS_OP(ADD) || MRBZ_HAS_OP(SUB) || MRBZ_HAS_OP(MUL) || MRBZ_HAS_OP(DIV)
+// Fixed-point arithmetic: r[0] = r[0] op r[1], integers are promoted
+static void fixed_arith(mrbz_value* r, uint8_t op) {
+    int32_t x, y;
+
+    x = to_fixed32(r[0]);
+    y = to_fixed32(r[1]);
+    switch (op) {
+        case OP_ADD:
+            x += y;
+            break;
+        case OP_SUB:
+            x -= y;
+            break;
+        case OP_MUL:
+            if (r[0].type == MRBZ_T_INT || r[1].type == MRBZ_T_INT) {
+                // Fixed * Integer needs no rescale
+                x = (int32_t)r[0].v.i * r[1].v.i;
+            } else {
+                x = (x * y) >> MRBZ_FIXED_SHIFT;
+            }
+            break;
+        case OP_DIV:
+            if (y == 0) {
+                x = 0;  // Same convention as integer division
+            } else if (r[1].type == MRBZ_T_INT) {
+                x = r[0].v.i / r[1].v.i;
+            } else if (x < 0x400000L && x > -0x400000L) {
+                x = (x << MRBZ_FIXED_SHIFT) / y;
+            } else {
+                x = (x / y) << MRBZ_FIXED_SHIFT;
+            }
+            break;
+    }
+    set_fixed32(&r[0], x);
+}
+#endif
+
+#if MRBZ_HAS_OP(LT) || MRBZ_HAS_OP(LE) || MRBZ_HAS_OP(GT) || MRBZ_HAS_OP(GE)
+// Fixed-point comparison of r[0] and r[1]: -1, 0 or 1
+static int8_t fixed_compare(mrbz_value* r) {
+    int32_t x, y;
+
+    x = to_fixed32(r[0]);
+    y = to_fixed32(r[1]);
+    if (x < y) return -1;
+    return x > y;
+}
+#endif
+
 // Compare two values for equality
-static uint8_t values_equal(mrbz_value a, mrbz_value b) {
-    if (a.type != b.type) return 0;
+uint8_t mrbz_values_equal(mrbz_value a, mrbz_value b) {
+    if (a.type != b.type) {
+        // 1 == 1.0 holds in Ruby
+        if ((a.type == MRBZ_T_FIXED && b.type == MRBZ_T_INT) ||
+            (a.type == MRBZ_T_INT && b.type == MRBZ_T_FIXED)) {
+            return to_fixed32(a) == to_fixed32(b);
+        }
+        return 0;
+    }
     switch (a.type) {
         case MRBZ_T_NIL:
         case MRBZ_T_TRUE:
         case MRBZ_T_FALSE:
             return 1;
         case MRBZ_T_INT:
+        case MRBZ_T_FIXED:
             return a.v.i == b.v.i;
         case MRBZ_T_SYMBOL:
             return a.v.sym == b.v.sym;
         case MRBZ_T_ARRAY:
+        case MRBZ_T_HASH:
             return a.v.arr == b.v.arr;
+        case MRBZ_T_RANGE:
+            return a.v.range.first == b.v.range.first && a.v.range.len == b.v.range.len;
         default:
             return 0;
     }
 }
 
-// Allocate a new array, return its index
-static uint8_t alloc_array(mrbz_vm* vm) {
-    uint8_t idx;
-    if (vm->next_array >= MRBZ_MAX_ARRAYS) {
+#if MRBZ_HAS_OP(RANGE_INC) || MRBZ_HAS_OP(RANGE_EXC)
+// r[0] = r[0]..r[1] (or ...), unboxed
+// Returns 0 if the bounds aren't Integers or the range doesn't fit: the
+// first element must fit in int8 and there may be at most 255 elements.
+static uint8_t make_range(mrbz_value* r, uint8_t exclusive) {
+    int16_t first, last;
+
+    if (r[0].type != MRBZ_T_INT || r[1].type != MRBZ_T_INT) {
         return 0;
     }
-    idx = vm->next_array;
-    vm->next_array++;
-    vm->array_lens[idx] = 0;
-    return idx;
+    first = r[0].v.i;
+    last = r[1].v.i;
+    if (last < first || (exclusive && last == first)) {
+        MRBZ_SET_RANGE(r[0], 0, 0);  // All empty ranges are alike
+        return 1;
+    }
+    if (exclusive) {
+        last--;
+    }
+    if (first < -128 || first > 127 || last > first + 254) {
+        return 0;
+    }
+    MRBZ_SET_RANGE(r[0], (int8_t)first, (uint8_t)(last - first + 1));
+    return 1;
 }
+#endif
 
-// Run the VM on bytecode
-void mrbz_vm_run(mrbz_vm* vm, mrbz_value* result, const uint8_t* bytecode) {
-    uint16_t pc;
-    uint16_t ilen;
-    uint16_t inst_end;
-    uint8_t op;
-    uint8_t a, b, c;
-    int16_t val, offset;
-    uint8_t arr_idx;
+#if MRBZ_HAS_OP(ARRAY) || MRBZ_HAS_OP(ARRAY2)
+// Scratch handle for the array literal at pc, or MRBZ_ARRAY_NONE
+static uint8_t scratch_slot(mrbz_vm* vm, uint16_t pc) {
+    uint8_t i;
+    for (i = 0; i < vm->scratch_count; i++) {
+        if (vm->scratch_pc[i] == pc) {
+            return MRBZ_MAX_ARRAYS + i;
+        }
+    }
+    return MRBZ_ARRAY_NONE;
+}
+#endif
 
-    vm->bytecode = bytecode;
-    vm->running = 1;
+#if MRBZ_HAS_OP(EQ) || MRBZ_HAS_OP(SSEND) || MRBZ_HAS_OP(SSENDB) || MRBZ_HAS_OP(SEND) \
+    || MRBZ_HAS_OP(SENDB)
+// Dispatch a lowered compare chain (see mrbz_analyze_switches)
+// compare_pc is the EQ or SEND of one of its tests. Returns the pc the
+// chain would reach, having set the compare registers as it would have, or
+// 0 to run the compare normally (not a chain test, or a subject type the
+// table doesn't cover).
+static uint16_t switch_dispatch(mrbz_vm* vm, mrbz_value* regs, uint16_t compare_pc) {
+    mrbz_switch* sw;
+    mrbz_value* r;
+    mrbz_value subject;
+    uint16_t offset;
+    uint8_t i, j, hit;
+
+    for (i = 0; i < vm->switch_count; i++) {
+        sw = &vm->switches[i];
+        if (compare_pc < sw->test_pc[0] || compare_pc > sw->test_pc[sw->count - 1]) continue;
+        for (j = 0; j < sw->count && sw->test_pc[j] != compare_pc; j++) {}
+        if (j == sw->count) continue;
+
+        r = &regs[sw->reg];
+        subject = sw->eqq ? r[1] : r[0];
+        if (subject.type != sw->type) {
+            return 0;
+        }
 
-    // Parse bytecode header (mruby RITE format)
-    // Bytes 0-7:   "RITE0300" magic
-    // Bytes 8-11:  total size (big-endian)
-    // Bytes 12-15: "MATZ" compiler ident
-    // Bytes 16-19: compiler version
-    pc = 20;
+        // Tests before j have already failed, so only later ones can match
+        if (sw->type == MRBZ_T_SYMBOL) {
+            offset = (uint16_t)(subject.v.sym - sw->base);
+        } else {
+            offset = (uint16_t)(subject.v.i - sw->base);
+        }
+        hit = offset < MRBZ_SWITCH_SPAN ? sw->case_of[offset] : 0xFF;
+        if (hit != 0xFF && hit >= j) {
+            MRBZ_SET_TRUE(r[0]);
+            if (!sw->eqq) r[1] = subject;
+            return sw->arm_pc[hit];
+        }
+        MRBZ_SET_FALSE(r[0]);
+        if (sw->eqq) {
+            // r[1] still holds the subject
+        } else if (sw->type == MRBZ_T_SYMBOL) {
+            MRBZ_SET_SYM(r[1], (uint8_t)sw->last_key);
+        } else {
+            MRBZ_SET_INT(r[1], sw->last_key);
+        }
+        return sw->default_pc;
+    }
+    return 0;
+}
+#endif
 
-    // Bytes 20-23: "IREP" section marker
-    pc += 4;
+// Parse one IREP record and its children (depth first)
+// Returns the offset just past the record and its children.
+// Record layout: 4 bytes record size, 2 nlocals, 2 nregs, 2 rlen (child
+// IREPs), 2 clen (catch handlers), 4 ilen, instructions, catch handler
+// table (13 bytes per entry), pool, symbols, then the child records.
+static uint16_t parse_irep(mrbz_vm* vm, uint16_t offset, uint8_t* out) {
+    const uint8_t* p;
+    mrbz_irep* irep;
+    uint16_t rlen, clen, ilen, i;
+    uint8_t idx, kid;
+
+    *out = 0;
+    if (vm->irep_count >= MRBZ_MAX_IREPS) {
+        vm->error = MRBZ_ERR_LIMIT;
+        return offset;
+    }
+    idx = vm->irep_count++;
+    irep = &vm->ireps[idx];
 
-    // Bytes 24-27: IREP section size
-    pc += 4;
+    p = vm->bytecode + offset;
+    irep->nregs = (uint8_t)read_u16(p + 6);
+    rlen = read_u16(p + 8);
+    clen = read_u16(p + 10);
+    ilen = read_u16(p + 14);
+    irep->insns = offset + 16;
+    irep->end = irep->insns + ilen;
+
+    DBG_PRINT("IREP %d: nregs=%d ilen=%d rlen=%d\n", idx, irep->nregs, ilen, rlen);
+
+    offset = parse_pool(vm, irep, irep->end + clen * 13);
+    offset = parse_symbols(vm, irep, offset);
+
+    // Reserve child slots before recursing; grandchildren come in between
+    irep->kids = vm->irep_kid_count;
+    vm->irep_kid_count += rlen;
+    for (i = 0; i < rlen; i++) {
+        offset = parse_irep(vm, offset, &kid);
+        if (irep->kids + i < MRBZ_MAX_IREPS) {
+            vm->irep_kids[irep->kids + i] = kid;
+        }
+    }
 
-    // Bytes 28-31: "0300" IREP version (2) + record size (2, but actually 4 bytes total)
-    pc += 4;
+    *out = idx;
+    return offset;
+}
 
-    // Bytes 32-35: record size (4 bytes)
-    pc += 4;
+// mrbz_vm_verify callback for mrbz_vm_load: remember the first failure
+static void reject_op(mrbz_vm* vm, const mrbz_bad_op* bad, void* user) {
+    (void)user;
+    if (vm->error == MRBZ_ERR_NONE) {
+        vm->error = MRBZ_ERR_OPCODE;
+        vm->error_pc = bad->pc;
+    }
+}
 
-    // Bytes 36-37: nlocals (2 bytes)
-    // Bytes 38-39: nregs (2 bytes)
-    // Bytes 40-41: rlen (2 bytes) - number of child IREPs
-    // Bytes 42-43: clen (2 bytes) - catch handler table size
-    pc += 8;
+// Load bytecode (mruby RITE format)
+// Bytes 0-7:   "RITE0300" magic
+// Bytes 8-11:  total size (big-endian)
+// Bytes 12-15: "MATZ" compiler ident
+// Bytes 16-19: compiler version
+// Bytes 20-23: "IREP" section marker
+// Bytes 24-27: IREP section size
+// Bytes 28-31: "0300" IREP version
+// Bytes 32-:   top-level IREP record, followed by its children
+void mrbz_vm_load(mrbz_vm* vm, const uint8_t* bytecode) {
+    uint8_t top, i;
 
-    // Bytes 44-47: ilen (4 bytes) - instruction length in bytes
-    ilen = read_u16(bytecode + pc + 2);
-    pc += 4;
+    vm->bytecode = bytecode;
+    DBG_PRINT("Header: %.4s\n", bytecode);
+    parse_irep(vm, 32, &top);
+
+    // Needs bound builtins, so runs after the symbol tables
+    mrbz_analyze_globals(vm);
+    for (i = 0; i < vm->irep_count; i++) {
+        mrbz_analyze_escapes(vm, i);
+        mrbz_analyze_switches(vm, i);
+    }
 
-    // Now pc = 48, which is where instructions start
-    inst_end = pc + ilen;
+    mrbz_builtin_define_classes(vm);
 
-    DBG_PRINT("Header: %.4s\n", bytecode);
-    DBG_PRINT("ilen=%d pc=%d end=%d\n", ilen, pc, inst_end);
-
-    // Parse pool and symbols after instructions
-    // After instructions: 2-byte pool count, then pool entries
-    //                     2-byte symbol count, then symbol entries
-    {
-        uint16_t pool_offset, pool_count, sym_offset;
-        pool_offset = inst_end;
-        pool_count = read_u16(bytecode + pool_offset);
-        // Skip pool entries (each is 1 byte type + data)
-        // For simplicity, assume no pool entries (plen=0) for now
-        sym_offset = pool_offset + 2;  // Skip pool count
-        DBG_PRINT("pool_count=%d sym_offset=%d\n", pool_count, sym_offset);
-        parse_symbols(vm, sym_offset);
+    vm->root.regs = vm->regs;
+    vm->root.parent = 0;
+    vm->root.irep = top;
+    vm->root.pc = vm->ireps[top].insns;
+    vm->root.status = MRBZ_CTX_RUNNING;
+    vm->running = 1;
+
+    if (vm->ireps[top].nregs > MRBZ_MAX_REGS) {
+        vm->error = MRBZ_ERR_LIMIT;
+    }
+
+    // Refuse programs with instructions this build can't run, or that
+    // outgrow its tables, so they stop with an error at load instead of
+    // partway through the game
+    if (mrbz_vm_verify(vm, reject_op, 0) || vm->error != MRBZ_ERR_NONE) {
+        vm->root.status = MRBZ_CTX_DONE;
+        vm->running = 0;
     }
+}
+
+// Execute a context until it returns, yields or the VM stops
+// Contexts nest: a builtin (e.g. wait_vbl running fibers) may call back in.
+void mrbz_vm_exec(mrbz_vm* vm, mrbz_ctx* ctx, mrbz_value* result) {
+    const uint8_t* bytecode = vm->bytecode;
+    const mrbz_irep* irep = &vm->ireps[ctx->irep];
+    const uint8_t* syms = &vm->irep_syms[irep->syms];
+    mrbz_value* regs = ctx->regs;
+    mrbz_ctx* prev = vm->ctx;
+    mrbz_ctx* up;
+    uint16_t pc = ctx->pc;
+    uint16_t target;
+    uint8_t op;
+    uint8_t a, b, c, i;
+    int16_t val, offset;
+    uint8_t arr_idx;
+#if MRBZ_PROFILE
+    uint8_t prof_sym = vm->prof_sym;    // Builtin that re-entered the VM
+#endif
+#if MRBZ_TRACE
+    mrbz_trace_rec* rec;
+#endif
+
+    vm->ctx = ctx;
+    MRBZ_SET_NIL(*result);
+#if MRBZ_PROFILE
+    vm->prof_sym = MRBZ_PROF_VM;
+#endif
+#if MRBZ_STRIP
+    // Locals only some handlers use
+    (void)up; (void)target; (void)b; (void)c; (void)i;
+    (void)val; (void)offset; (void)arr_idx;
+#endif
 
     // Main execution loop
-    while (vm->running && pc < inst_end) {
+    while (vm->running && ctx->status == MRBZ_CTX_RUNNING) {
+        if (vm->stepping && !vm->block_top) {
+            // Blocks run by builtins aren't preempted (see block.c)
+            if (vm->budget == 0) break;  // Preempted; ctx stays resumable
+            vm->budget--;
+        }
+        if (pc >= irep->end) {
+            ctx->status = MRBZ_CTX_DONE;
+            break;
+        }
+#if MRBZ_PROFILE
+        vm->prof_pc = pc;
+#endif
         op = bytecode[pc];
         pc++;
-        DBG_PRINT("PC=%d OP=0x%02X\n", pc-1, op);
 
         // Bounds check
-        if (op > 0x69) {
+        if (op >= MRBZ_OP_COUNT) {
             vm->running = 0;
+            vm->error = MRBZ_ERR_OPCODE;
+            vm->error_pc = pc - 1;
             MRBZ_SET_NIL(*result);
             break;
         }
+#if MRBZ_STATS
+        vm->stats.ops[op]++;
+#endif
+#if MRBZ_TRACE
+        rec = &vm->trace[vm->trace_pos];
+        rec->pc = pc - 1;
+        rec->op = op;
+        rec->a = bytecode[pc];
+        if (rec->a < irep->nregs) {
+            rec->ra = regs[rec->a];
+        } else {
+            MRBZ_SET_NIL(rec->ra);
+        }
+        vm->trace_pos = (vm->trace_pos + 1) & (MRBZ_TRACE_LEN - 1);
+        if (vm->trace_pos == 0) {
+            vm->trace_full = 1;
+        }
+#endif
 
         switch (op) {
+#if MRBZ_HAS_OP(NOP)
             case OP_NOP:
                 break;
+#endif
 
+#if MRBZ_HAS_OP(MOVE)
             case OP_MOVE:
                 a = bytecode[pc++];
                 b = bytecode[pc++];
-                vm->regs[a] = vm->regs[b];
-                DBG_PRINT("  MOVE R%d <- R%d\n", a, b);
+                regs[a] = regs[b];
                 break;
+#endif
 
+#if MRBZ_HAS_OP(LOADI_0) || MRBZ_HAS_OP(LOADI_1) || MRBZ_HAS_OP(LOADI_2) \
+    || MRBZ_HAS_OP(LOADI_3) || MRBZ_HAS_OP(LOADI_4) || MRBZ_HAS_OP(LOADI_5) \
+    || MRBZ_HAS_OP(LOADI_6) || MRBZ_HAS_OP(LOADI_7)
             case OP_LOADI_0: case OP_LOADI_1: case OP_LOADI_2: case OP_LOADI_3:
             case OP_LOADI_4: case OP_LOADI_5: case OP_LOADI_6: case OP_LOADI_7:
                 a = bytecode[pc++];
                 val = op - OP_LOADI_0;
-                MRBZ_SET_INT(vm->regs[a], val);
-                DBG_PRINT("  LOADI_%d R%d\n", val, a);
+                MRBZ_SET_INT(regs[a], val);
                 break;
+#endif
 
+#if MRBZ_HAS_OP(LOADI__1)
             case OP_LOADI__1:
                 a = bytecode[pc++];
-                MRBZ_SET_INT(vm->regs[a], -1);
-                DBG_PRINT("  LOADI_-1 R%d\n", a);
+                MRBZ_SET_INT(regs[a], -1);
                 break;
+#endif
 
+#if MRBZ_HAS_OP(LOADI)
             case OP_LOADI:
                 a = bytecode[pc++];
                 b = bytecode[pc++];
-                MRBZ_SET_INT(vm->regs[a], (int16_t)b);
-                DBG_PRINT("  LOADI R%d <- %d\n", a, b);
+                MRBZ_SET_INT(regs[a], (int16_t)b);
                 break;
+#endif
 
+#if MRBZ_HAS_OP(LOADINEG)
             case OP_LOADINEG:
                 a = bytecode[pc++];
                 b = bytecode[pc++];
-                MRBZ_SET_INT(vm->regs[a], -(int16_t)b);
-                DBG_PRINT("  LOADINEG R%d <- -%d\n", a, b);
+                MRBZ_SET_INT(regs[a], -(int16_t)b);
                 break;
+#endif
 
+#if MRBZ_HAS_OP(LOADI16)
             case OP_LOADI16:
                 a = bytecode[pc++];
                 val = (int16_t)read_u16(bytecode + pc);
                 pc += 2;
-                MRBZ_SET_INT(vm->regs[a], val);
-                DBG_PRINT("  LOADI16 R%d <- %d\n", a, val);
+                MRBZ_SET_INT(regs[a], val);
                 break;
+#endif
 
+#if MRBZ_HAS_OP(LOADNIL)
             case OP_LOADNIL:
                 a = bytecode[pc++];
-                MRBZ_SET_NIL(vm->regs[a]);
-                DBG_PRINT("  LOADNIL R%d\n", a);
+                MRBZ_SET_NIL(regs[a]);
                 break;
+#endif
 
+#if MRBZ_HAS_OP(LOADT)
             case OP_LOADT:
                 a = bytecode[pc++];
-                MRBZ_SET_TRUE(vm->regs[a]);
-                DBG_PRINT("  LOADT R%d\n", a);
+                MRBZ_SET_TRUE(regs[a]);
                 break;
+#endif
 
+#if MRBZ_HAS_OP(LOADF)
             case OP_LOADF:
                 a = bytecode[pc++];
-                MRBZ_SET_FALSE(vm->regs[a]);
-                DBG_PRINT("  LOADF R%d\n", a);
+                MRBZ_SET_FALSE(regs[a]);
                 break;
+#endif
 
+#if MRBZ_HAS_OP(LOADL)
+            case OP_LOADL:
+                a = bytecode[pc++];
+                b = bytecode[pc++];
+                if (irep->pool + b < vm->pool_count) {
+                    regs[a] = vm->pool[irep->pool + b];
+                } else {
+                    MRBZ_SET_NIL(regs[a]);
+                }
+                break;
+#endif
+
+#if MRBZ_HAS_OP(LOADSYM)
             case OP_LOADSYM:
                 a = bytecode[pc++];
                 b = bytecode[pc++];
-                MRBZ_SET_SYM(vm->regs[a], b);
-                DBG_PRINT("  LOADSYM R%d <- sym%d\n", a, b);
+                MRBZ_SET_SYM(regs[a], syms[b]);
                 break;
+#endif
 
             // Arithmetic operations
+            // Integer operands take the inline path; any fixed-point operand
+            // goes through fixed_arith()/fixed_compare().
+#if MRBZ_HAS_OP(ADD)
             case OP_ADD:
                 a = bytecode[pc++];
-                val = vm->regs[a].v.i + vm->regs[a+1].v.i;
-                MRBZ_SET_INT(vm->regs[a], val);
-                DBG_PRINT("  ADD R%d = %d\n", a, val);
+                if (FIXED_OPERANDS(regs, a)) {
+                    fixed_arith(&regs[a], op);
+                } else {
+                    val = regs[a].v.i + regs[a+1].v.i;
+                    MRBZ_SET_INT(regs[a], val);
+                }
                 break;
+#endif
 
+#if MRBZ_HAS_OP(ADDI)
             case OP_ADDI:
                 a = bytecode[pc++];
                 b = bytecode[pc++];
-                val = vm->regs[a].v.i + (int16_t)b;
-                MRBZ_SET_INT(vm->regs[a], val);
-                DBG_PRINT("  ADDI R%d += %d = %d\n", a, b, val);
+                if (regs[a].type == MRBZ_T_FIXED) {
+                    set_fixed32(&regs[a], (int32_t)regs[a].v.i + ((int32_t)b << MRBZ_FIXED_SHIFT));
+                } else {
+                    val = regs[a].v.i + (int16_t)b;
+                    MRBZ_SET_INT(regs[a], val);
+                }
                 break;
+#endif
 
+#if MRBZ_HAS_OP(SUB)
             case OP_SUB:
                 a = bytecode[pc++];
-                val = vm->regs[a].v.i - vm->regs[a+1].v.i;
-                MRBZ_SET_INT(vm->regs[a], val);
-                DBG_PRINT("  SUB R%d = %d\n", a, val);
+                if (FIXED_OPERANDS(regs, a)) {
+                    fixed_arith(&regs[a], op);
+                } else {
+                    val = regs[a].v.i - regs[a+1].v.i;
+                    MRBZ_SET_INT(regs[a], val);
+                }
                 break;
+#endif
 
+#if MRBZ_HAS_OP(SUBI)
             case OP_SUBI:
                 a = bytecode[pc++];
                 b = bytecode[pc++];
-                val = vm->regs[a].v.i - (int16_t)b;
-                MRBZ_SET_INT(vm->regs[a], val);
-                DBG_PRINT("  SUBI R%d -= %d = %d\n", a, b, val);
+                if (regs[a].type == MRBZ_T_FIXED) {
+                    set_fixed32(&regs[a], (int32_t)regs[a].v.i - ((int32_t)b << MRBZ_FIXED_SHIFT));
+                } else {
+                    val = regs[a].v.i - (int16_t)b;
+                    MRBZ_SET_INT(regs[a], val);
+                }
                 break;
+#endif
 
+#if MRBZ_HAS_OP(MUL)
             case OP_MUL:
                 a = bytecode[pc++];
-                val = vm->regs[a].v.i * vm->regs[a+1].v.i;
-                MRBZ_SET_INT(vm->regs[a], val);
-                DBG_PRINT("  MUL R%d = %d\n", a, val);
+                if (FIXED_OPERANDS(regs, a)) {
+                    fixed_arith(&regs[a], op);
+                } else {
+                    val = regs[a].v.i * regs[a+1].v.i;
+                    MRBZ_SET_INT(regs[a], val);
+                }
                 break;
+#endif
 
+#if MRBZ_HAS_OP(DIV)
             case OP_DIV:
                 a = bytecode[pc++];
-                if (vm->regs[a+1].v.i == 0) {
-                    MRBZ_SET_INT(vm->regs[a], 0);
+                if (FIXED_OPERANDS(regs, a)) {
+                    fixed_arith(&regs[a], op);
+                } else if (regs[a+1].v.i == 0) {
+                    MRBZ_SET_INT(regs[a], 0);
                 } else {
-                    val = vm->regs[a].v.i / vm->regs[a+1].v.i;
-                    MRBZ_SET_INT(vm->regs[a], val);
+                    val = regs[a].v.i / regs[a+1].v.i;
+                    MRBZ_SET_INT(regs[a], val);
                 }
-                DBG_PRINT("  DIV R%d\n", a);
                 break;
+#endif
 
             // Comparison operations
+#if MRBZ_HAS_OP(EQ)
             case OP_EQ:
                 a = bytecode[pc++];
-                if (values_equal(vm->regs[a], vm->regs[a+1])) {
-                    MRBZ_SET_TRUE(vm->regs[a]);
+                if (vm->switch_count) {
+                    target = switch_dispatch(vm, regs, pc - 2);
+                    if (target) {
+                        pc = target;
+                        break;
+                    }
+                }
+                if (mrbz_values_equal(regs[a], regs[a+1])) {
+                    MRBZ_SET_TRUE(regs[a]);
                 } else {
-                    MRBZ_SET_FALSE(vm->regs[a]);
+                    MRBZ_SET_FALSE(regs[a]);
                 }
-                DBG_PRINT("  EQ R%d\n", a);
                 break;
+#endif
 
+#if MRBZ_HAS_OP(LT)
             case OP_LT:
                 a = bytecode[pc++];
-                if (vm->regs[a].v.i < vm->regs[a+1].v.i) {
-                    MRBZ_SET_TRUE(vm->regs[a]);
+                if (FIXED_OPERANDS(regs, a) ? fixed_compare(&regs[a]) < 0
+                                          : regs[a].v.i < regs[a+1].v.i) {
+                    MRBZ_SET_TRUE(regs[a]);
                 } else {
-                    MRBZ_SET_FALSE(vm->regs[a]);
+                    MRBZ_SET_FALSE(regs[a]);
                 }
-                DBG_PRINT("  LT R%d\n", a);
                 break;
+#endif
 
+#if MRBZ_HAS_OP(LE)
             case OP_LE:
                 a = bytecode[pc++];
-                if (vm->regs[a].v.i <= vm->regs[a+1].v.i) {
-                    MRBZ_SET_TRUE(vm->regs[a]);
+                if (FIXED_OPERANDS(regs, a) ? fixed_compare(&regs[a]) <= 0
+                                          : regs[a].v.i <= regs[a+1].v.i) {
+                    MRBZ_SET_TRUE(regs[a]);
                 } else {
-                    MRBZ_SET_FALSE(vm->regs[a]);
+                    MRBZ_SET_FALSE(regs[a]);
                 }
-                DBG_PRINT("  LE R%d\n", a);
                 break;
+#endif
 
+#if MRBZ_HAS_OP(GT)
             case OP_GT:
                 a = bytecode[pc++];
-                if (vm->regs[a].v.i > vm->regs[a+1].v.i) {
-                    MRBZ_SET_TRUE(vm->regs[a]);
+                if (FIXED_OPERANDS(regs, a) ? fixed_compare(&regs[a]) > 0
+                                          : regs[a].v.i > regs[a+1].v.i) {
+                    MRBZ_SET_TRUE(regs[a]);
                 } else {
-                    MRBZ_SET_FALSE(vm->regs[a]);
+                    MRBZ_SET_FALSE(regs[a]);
                 }
-                DBG_PRINT("  GT R%d\n", a);
                 break;
+#endif
 
+#if MRBZ_HAS_OP(GE)
             case OP_GE:
                 a = bytecode[pc++];
-                if (vm->regs[a].v.i >= vm->regs[a+1].v.i) {
-                    MRBZ_SET_TRUE(vm->regs[a]);
+                if (FIXED_OPERANDS(regs, a) ? fixed_compare(&regs[a]) >= 0
+                                          : regs[a].v.i >= regs[a+1].v.i) {
+                    MRBZ_SET_TRUE(regs[a]);
                 } else {
-                    MRBZ_SET_FALSE(vm->regs[a]);
+                    MRBZ_SET_FALSE(regs[a]);
                 }
-                DBG_PRINT("  GE R%d\n", a);
                 break;
+#endif
 
             // Jump operations
+#if MRBZ_HAS_OP(JMP)
             case OP_JMP:
                 offset = (int16_t)read_u16(bytecode + pc);
                 pc += 2;
-                pc = pc + offset;
-                DBG_PRINT("  JMP to %d\n", pc);
+                pc = JUMP_BACK(pc, offset);
                 break;
+#endif
 
+#if MRBZ_HAS_OP(JMPIF)
             case OP_JMPIF:
                 a = bytecode[pc++];
                 offset = (int16_t)read_u16(bytecode + pc);
                 pc += 2;
-                if (MRBZ_TRUTHY(vm->regs[a])) {
-                    pc = pc + offset;
-                    DBG_PRINT("  JMPIF taken -> %d\n", pc);
-                } else {
-                    DBG_PRINT("  JMPIF not taken\n");
+                if (MRBZ_TRUTHY(regs[a])) {
+                    pc = JUMP_BACK(pc, offset);
                 }
                 break;
+#endif
 
+#if MRBZ_HAS_OP(JMPNOT)
             case OP_JMPNOT:
                 a = bytecode[pc++];
                 offset = (int16_t)read_u16(bytecode + pc);
                 pc += 2;
-                if (!MRBZ_TRUTHY(vm->regs[a])) {
-                    pc = pc + offset;
-                    DBG_PRINT("  JMPNOT taken -> %d\n", pc);
-                } else {
-                    DBG_PRINT("  JMPNOT not taken\n");
+                if (!MRBZ_TRUTHY(regs[a])) {
+                    pc = JUMP_BACK(pc, offset);
                 }
                 break;
+#endif
 
+#if MRBZ_HAS_OP(JMPNIL)
             case OP_JMPNIL:
                 a = bytecode[pc++];
                 offset = (int16_t)read_u16(bytecode + pc);
                 pc += 2;
-                if (vm->regs[a].type == MRBZ_T_NIL) {
+                if (regs[a].type == MRBZ_T_NIL) {
                     pc = pc + offset;
                 }
-                DBG_PRINT("  JMPNIL R%d\n", a);
                 break;
+#endif
 
             // Array operations
+#if MRBZ_HAS_OP(ARRAY) || MRBZ_HAS_OP(ARRAY2)
             case OP_ARRAY:
+            case OP_ARRAY2:
                 a = bytecode[pc++];
                 b = bytecode[pc++];
-                arr_idx = alloc_array(vm);
-                for (c = 0; c <= b; c++) {
-                    vm->arrays[arr_idx][c] = vm->regs[a + c];
+                if (op == OP_ARRAY2) {
+                    c = bytecode[pc++];   // R[a] = [R[b]..R[b+c-1]]
+                } else {
+                    c = b;                // R[a] = [R[a]..R[a+b-1]]
+                    b = a;
+                }
+                if (c > MRBZ_MAX_ARRAY_LEN) c = MRBZ_MAX_ARRAY_LEN;
+                arr_idx = scratch_slot(vm, pc - mrbz_op_length(op));
+                if (arr_idx != MRBZ_ARRAY_NONE) {
+                    vm->array_lens[arr_idx] = c;
+                } else {
+                    arr_idx = mrbz_array_alloc(vm, c);
                 }
-                vm->array_lens[arr_idx] = b + 1;
-                MRBZ_SET_ARR(vm->regs[a], arr_idx);
-                DBG_PRINT("  ARRAY R%d = [%d elems]\n", a, b+1);
+                if (arr_idx == MRBZ_ARRAY_NONE) {
+                    MRBZ_SET_NIL(regs[a]);
+                    break;
+                }
+                for (i = 0; i < c; i++) {
+                    MRBZ_ARRAY_DATA(vm, arr_idx)[i] = regs[b + i];
+                }
+                MRBZ_SET_ARR(regs[a], arr_idx);
                 break;
+#endif
 
+#if MRBZ_HAS_OP(AREF)
             case OP_AREF:
                 a = bytecode[pc++];
                 b = bytecode[pc++];
                 c = bytecode[pc++];
-                if (vm->regs[b].type == MRBZ_T_ARRAY) {
-                    arr_idx = vm->regs[b].v.arr;
+                if (regs[b].type == MRBZ_T_ARRAY) {
+                    arr_idx = regs[b].v.arr;
                     if (c < vm->array_lens[arr_idx]) {
-                        vm->regs[a] = vm->arrays[arr_idx][c];
+                        regs[a] = MRBZ_ARRAY_DATA(vm, arr_idx)[c];
                     } else {
-                        MRBZ_SET_NIL(vm->regs[a]);
+                        MRBZ_SET_NIL(regs[a]);
                     }
                 } else {
-                    MRBZ_SET_NIL(vm->regs[a]);
+                    MRBZ_SET_NIL(regs[a]);
                 }
-                DBG_PRINT("  AREF R%d = R%d[%d]\n", a, b, c);
                 break;
+#endif
 
+#if MRBZ_HAS_OP(ASET)
             case OP_ASET:
                 a = bytecode[pc++];
                 b = bytecode[pc++];
                 c = bytecode[pc++];
-                if (vm->regs[b].type == MRBZ_T_ARRAY) {
-                    arr_idx = vm->regs[b].v.arr;
-                    if (c < MRBZ_MAX_ARRAY_LEN) {
-                        vm->arrays[arr_idx][c] = vm->regs[a];
+                if (regs[b].type == MRBZ_T_ARRAY) {
+                    arr_idx = regs[b].v.arr;
+                    if (c < MRBZ_ARRAY_CAP(arr_idx)) {
+                        MRBZ_ARRAY_DATA(vm, arr_idx)[c] = regs[a];
                         if (c >= vm->array_lens[arr_idx]) {
                             vm->array_lens[arr_idx] = c + 1;
                         }
                     }
                 }
-                DBG_PRINT("  ASET R%d[%d] = R%d\n", b, c, a);
                 break;
+#endif
 
+#if MRBZ_HAS_OP(GETIDX)
             case OP_GETIDX:
                 a = bytecode[pc++];
-                if (vm->regs[a].type == MRBZ_T_ARRAY && vm->regs[a+1].v.i >= 0) {
-                    arr_idx = vm->regs[a].v.arr;
-                    c = (uint8_t)vm->regs[a+1].v.i;
+                if (regs[a].type == MRBZ_T_HASH) {
+                    mrbz_hash_get(vm, regs[a].v.arr, regs[a+1], &regs[a]);
+                } else if (regs[a].type == MRBZ_T_ARRAY && regs[a+1].v.i >= 0) {
+                    arr_idx = regs[a].v.arr;
+                    c = (uint8_t)regs[a+1].v.i;
                     if (c < vm->array_lens[arr_idx]) {
-                        vm->regs[a] = vm->arrays[arr_idx][c];
+                        regs[a] = MRBZ_ARRAY_DATA(vm, arr_idx)[c];
                     } else {
-                        MRBZ_SET_NIL(vm->regs[a]);
+                        MRBZ_SET_NIL(regs[a]);
                     }
                 } else {
-                    MRBZ_SET_NIL(vm->regs[a]);
+                    MRBZ_SET_NIL(regs[a]);
                 }
-                DBG_PRINT("  GETIDX R%d\n", a);
                 break;
+#endif
 
+#if MRBZ_HAS_OP(SETIDX)
             case OP_SETIDX:
                 a = bytecode[pc++];
-                if (vm->regs[a].type == MRBZ_T_ARRAY) {
-                    arr_idx = vm->regs[a].v.arr;
-                    c = (uint8_t)vm->regs[a+1].v.i;
-                    if (c < MRBZ_MAX_ARRAY_LEN) {
-                        vm->arrays[arr_idx][c] = vm->regs[a+2];
+                if (regs[a].type == MRBZ_T_HASH) {
+                    mrbz_hash_set(vm, regs[a].v.arr, regs[a+1], regs[a+2]);
+                } else if (regs[a].type == MRBZ_T_ARRAY) {
+                    arr_idx = regs[a].v.arr;
+                    c = (uint8_t)regs[a+1].v.i;
+                    if (c < MRBZ_ARRAY_CAP(arr_idx)) {
+                        MRBZ_ARRAY_DATA(vm, arr_idx)[c] = regs[a+2];
                         if (c >= vm->array_lens[arr_idx]) {
                             vm->array_lens[arr_idx] = c + 1;
                         }
                     }
                 }
-                DBG_PRINT("  SETIDX R%d\n", a);
                 break;
+#endif
+
+            // Hash literals: R[a] = {R[a] => R[a+1], ..} (b pairs), and
+            // HASHADD stores R[a+1].. (b pairs) into the Hash in R[a]
+#if MRBZ_HAS_OP(HASH) || MRBZ_HAS_OP(HASHADD)
+            case OP_HASH:
+            case OP_HASHADD:
+                a = bytecode[pc++];
+                b = bytecode[pc++];
+                if (op == OP_HASH) {
+                    // Pairs are read only after allocating: a collection may
+                    // move arrays they refer to
+                    arr_idx = mrbz_hash_new(vm);
+                    c = a;
+                } else if (regs[a].type == MRBZ_T_HASH) {
+                    arr_idx = regs[a].v.arr;
+                    c = a + 1;
+                } else {
+                    break;
+                }
+                if (arr_idx == MRBZ_ARRAY_NONE) {
+                    MRBZ_SET_NIL(regs[a]);
+                    break;
+                }
+                for (i = 0; i < b; i++) {
+                    mrbz_hash_set(vm, arr_idx, regs[c + i * 2], regs[c + i * 2 + 1]);
+                }
+                MRBZ_SET_HASH(regs[a], arr_idx);
+                break;
+#endif
+
+            // Integer ranges: R[a] = R[a]..R[a+1] (INC) or R[a]...R[a+1] (EXC)
+#if MRBZ_HAS_OP(RANGE_INC) || MRBZ_HAS_OP(RANGE_EXC)
+            case OP_RANGE_INC:
+            case OP_RANGE_EXC:
+                a = bytecode[pc++];
+                if (!make_range(&regs[a], op == OP_RANGE_EXC)) {
+                    vm->running = 0;
+                    vm->error = MRBZ_ERR_RANGE;
+                    vm->error_pc = pc - 2;
+                    break;
+                }
+                break;
+#endif
 
             // Method call - dispatch to built-ins
+            // R[a] is the receiver, R[a+1].. the arguments and the slot
+            // after them the block (nil unless SENDB/SSENDB)
+#if MRBZ_HAS_OP(SSEND) || MRBZ_HAS_OP(SSENDB) || MRBZ_HAS_OP(SEND) || MRBZ_HAS_OP(SENDB)
             case OP_SSEND:
+            case OP_SSENDB:
+            case OP_SEND:
+            case OP_SENDB:
                 a = bytecode[pc++];
                 b = bytecode[pc++];
                 c = bytecode[pc++];
-                mrbz_builtin_call(vm, b, c & 0x0F, a + 1, &vm->regs[a]);
-                DBG_PRINT("  SSEND R%d = builtin[%d]\n", a, b);
+                if (op == OP_SSEND || op == OP_SSENDB) {
+                    MRBZ_SET_NIL(regs[a]);  // self is nil at top level
+                }
+                if (op == OP_SSEND || op == OP_SEND) {
+                    MRBZ_SET_NIL(regs[a + ((c & 0x0F) == 15 ? 1 : (c & 0x0F)) + 1]);
+                }
+                if (op == OP_SEND && vm->switch_count) {
+                    // case/when test: `key === subject`
+                    target = switch_dispatch(vm, regs, pc - 4);
+                    if (target) {
+                        pc = target;
+                        break;
+                    }
+                }
+                ctx->pc = pc;  // Builtins may switch contexts
+                mrbz_builtin_call(vm, syms[b], c & 0x0F, &regs[a]);
+                pc = ctx->pc;  // ... or move back onto the send to re-issue it
                 break;
+#endif
 
-            case OP_SEND:
+            // Blocks
+#if MRBZ_HAS_OP(BLOCK) || MRBZ_HAS_OP(LAMBDA)
+            case OP_BLOCK:
+            case OP_LAMBDA:
+                a = bytecode[pc++];
+                b = bytecode[pc++];
+                MRBZ_SET_PROC(regs[a], vm->irep_kids[irep->kids + b]);
+                break;
+#endif
+
+            // Variables of enclosing scopes (c levels out)
+#if MRBZ_HAS_OP(GETUPVAR) || MRBZ_HAS_OP(SETUPVAR)
+            case OP_GETUPVAR:
+            case OP_SETUPVAR:
                 a = bytecode[pc++];
                 b = bytecode[pc++];
                 c = bytecode[pc++];
-                mrbz_builtin_call(vm, b, c & 0x0F, a + 1, &vm->regs[a]);
-                DBG_PRINT("  SEND R%d = builtin[%d]\n", a, b);
+                // c more levels past the parent; a finished fiber on the
+                // way has no variables left to reach
+                up = ctx;
+                do {
+                    if (!mrbz_fiber_parent_live(vm, up)) {
+                        vm->running = 0;
+                        vm->error = MRBZ_ERR_UPVAR;
+                        vm->error_pc = pc - 4;
+                        break;
+                    }
+                    up = up->parent;
+                } while (up && c--);
+                if (!vm->running) {
+                    break;
+                } else if (op == OP_SETUPVAR) {
+                    if (up) up->regs[b] = regs[a];
+                } else if (up) {
+                    regs[a] = up->regs[b];
+                } else {
+                    MRBZ_SET_NIL(regs[a]);
+                }
                 break;
+#endif
+
+            // Global variables (slots resolved at load; mrbz_vm_verify
+            // rejects programs with globals that didn't get one)
+#if MRBZ_HAS_OP(GETGV)
+            case OP_GETGV:
+                a = bytecode[pc++];
+                b = vm->sym_global[syms[bytecode[pc++]]];
+                regs[a] = vm->globals[b];
+                break;
+#endif
+
+#if MRBZ_HAS_OP(SETGV)
+            case OP_SETGV:
+                a = bytecode[pc++];
+                b = vm->sym_global[syms[bytecode[pc++]]];
+                vm->globals[b] = regs[a];
+                break;
+#endif
 
             // Instance variables
+#if MRBZ_HAS_OP(GETIV)
             case OP_GETIV:
                 a = bytecode[pc++];
-                b = bytecode[pc++];
-                MRBZ_SET_NIL(vm->regs[a]);
+                b = syms[bytecode[pc++]];
+                MRBZ_SET_NIL(regs[a]);
                 for (c = 0; c < vm->ivar_count; c++) {
                     if (vm->ivar_syms[c] == b) {
-                        vm->regs[a] = vm->ivars[c];
+                        regs[a] = vm->ivars[c];
                         break;
                     }
                 }
-                DBG_PRINT("  GETIV R%d = @%d\n", a, b);
                 break;
+#endif
 
+#if MRBZ_HAS_OP(SETIV)
             case OP_SETIV:
                 a = bytecode[pc++];
-                b = bytecode[pc++];
+                b = syms[bytecode[pc++]];
                 c = 0;
                 for (c = 0; c < vm->ivar_count; c++) {
                     if (vm->ivar_syms[c] == b) {
-                        vm->ivars[c] = vm->regs[a];
+                        vm->ivars[c] = regs[a];
                         break;
                     }
                 }
                 if (c == vm->ivar_count && vm->ivar_count < MRBZ_MAX_IVARS) {
                     vm->ivar_syms[vm->ivar_count] = b;
-                    vm->ivars[vm->ivar_count] = vm->regs[a];
+                    vm->ivars[vm->ivar_count] = regs[a];
                     vm->ivar_count++;
                 }
-                DBG_PRINT("  SETIV @%d = R%d\n", b, a);
                 break;
+#endif
 
             // Constants
+#if MRBZ_HAS_OP(GETCONST)
             case OP_GETCONST:
                 a = bytecode[pc++];
-                b = bytecode[pc++];
-                MRBZ_SET_NIL(vm->regs[a]);
+                b = syms[bytecode[pc++]];
+                MRBZ_SET_NIL(regs[a]);
                 for (c = 0; c < vm->const_count; c++) {
                     if (vm->const_syms[c] == b) {
-                        vm->regs[a] = vm->consts[c];
+                        regs[a] = vm->consts[c];
                         break;
                     }
                 }
-                DBG_PRINT("  GETCONST R%d = C%d\n", a, b);
                 break;
+#endif
 
+#if MRBZ_HAS_OP(SETCONST)
             case OP_SETCONST:
                 a = bytecode[pc++];
-                b = bytecode[pc++];
+                b = syms[bytecode[pc++]];
                 c = 0;
                 for (c = 0; c < vm->const_count; c++) {
                     if (vm->const_syms[c] == b) {
-                        vm->consts[c] = vm->regs[a];
+                        vm->consts[c] = regs[a];
                         break;
                     }
                 }
                 if (c == vm->const_count && vm->const_count < MRBZ_MAX_CONSTS) {
                     vm->const_syms[vm->const_count] = b;
-                    vm->consts[vm->const_count] = vm->regs[a];
+                    vm->consts[vm->const_count] = regs[a];
                     vm->const_count++;
                 }
-                DBG_PRINT("  SETCONST C%d = R%d\n", b, a);
                 break;
+#endif
 
             // Return
+#if MRBZ_HAS_OP(RETURN) || MRBZ_HAS_OP(RETURN_BLK)
             case OP_RETURN:
+            case OP_RETURN_BLK:
                 a = bytecode[pc++];
-                *result = vm->regs[a];
-                vm->running = 0;
-                DBG_PRINT("  RETURN R%d\n", a);
+                *result = regs[a];
+                ctx->status = MRBZ_CTX_DONE;
                 break;
+#endif
 
+#if MRBZ_HAS_OP(STOP)
             case OP_STOP:
                 MRBZ_SET_NIL(*result);
-                vm->running = 0;
-                DBG_PRINT("  STOP\n");
+                ctx->status = MRBZ_CTX_DONE;
                 break;
+#endif
 
             // Argument setup - skip for now
+#if MRBZ_HAS_OP(ENTER)
             case OP_ENTER:
                 pc += 3;
-                DBG_PRINT("  ENTER\n");
                 break;
+#endif
 
             // Load self - return nil
+#if MRBZ_HAS_OP(LOADSELF)
             case OP_LOADSELF:
                 a = bytecode[pc++];
-                MRBZ_SET_NIL(vm->regs[a]);
-                DBG_PRINT("  LOADSELF R%d\n", a);
+                MRBZ_SET_NIL(regs[a]);
                 break;
+#endif
 
             default:
                 vm->running = 0;
+                vm->error = MRBZ_ERR_OPCODE;
+                vm->error_pc = pc - 1;
                 MRBZ_SET_NIL(*result);
                 break;
         }
     }
+
+    ctx->pc = pc;
+    vm->ctx = prev;
+#if MRBZ_PROFILE
+    vm->prof_sym = prof_sym;
+#endif
+}
+
+#if MRBZ_TRACE
+uint16_t mrbz_trace_dump(const mrbz_vm* vm, uint8_t* buf, uint16_t cap) {
+    const mrbz_trace_rec* rec;
+    const uint8_t* v;
+    uint8_t* p = buf + 3;
+    uint16_t count, i, len;
+    uint8_t idx;
+
+    count = vm->trace_full ? MRBZ_TRACE_LEN : vm->trace_pos;
+    len = 3 + count * MRBZ_TRACE_REC;
+    if (cap < len) {
+        return 0;
+    }
+    buf[0] = 'M';
+    buf[1] = 'T';
+    buf[2] = (uint8_t)count;    // 0 for a full ring of 256
+    idx = vm->trace_full ? vm->trace_pos : 0;
+    for (i = 0; i < count; i++) {
+        rec = &vm->trace[idx];
+        v = (const uint8_t*)&rec->ra.v;
+        p[0] = rec->pc & 0xFF;
+        p[1] = rec->pc >> 8;
+        p[2] = rec->op;
+        p[3] = rec->a;
+        p[4] = rec->ra.type;
+        p[5] = v[0];
+        p[6] = v[1];
+        p += MRBZ_TRACE_REC;
+        idx = (idx + 1) & (MRBZ_TRACE_LEN - 1);
+    }
+    return len;
+}
+#endif
+
+// Run the VM on bytecode
+void mrbz_vm_run(mrbz_vm* vm, mrbz_value* result, const uint8_t* bytecode) {
+    mrbz_vm_load(vm, bytecode);
+    mrbz_vm_exec(vm, &vm->root, result);
+}
+
+// Run a time slice of a loaded VM
+uint8_t mrbz_vm_step(mrbz_vm* vm, uint16_t max_instructions) {
+    mrbz_value result;
+
+    vm->stepping = 1;
+    vm->budget = max_instructions;
+
+    if (vm->running && vm->root.status == MRBZ_CTX_SUSPENDED) {
+        // Resuming after a yielded wait_vbl: the frame has passed, so this
+        // is where fibers get their turn
+        vm->root.status = MRBZ_CTX_RUNNING;
+        vm->fiber_turn = 0;
+    }
+    mrbz_fiber_run_all(vm);  // Starts or continues this frame's pass
+
+    if (vm->running && vm->root.status == MRBZ_CTX_RUNNING &&
+        vm->fiber_turn >= MRBZ_MAX_FIBERS) {
+        mrbz_vm_exec(vm, &vm->root, &result);
+    }
+    vm->stepping = 0;
+
+    if (vm->error != MRBZ_ERR_NONE) return MRBZ_STEP_ERROR;
+    if (!vm->running || vm->root.status == MRBZ_CTX_DONE) return MRBZ_STEP_FINISHED;
+    if (vm->root.status == MRBZ_CTX_SUSPENDED) return MRBZ_STEP_YIELDED;
+    return MRBZ_STEP_BUDGET;
 }
@@ -7,14 +7,143 @@
 #define MRBZ_VM_H
 
 #include <stdint.h>
+#include "opcodes.h"
 
 // Configuration
+// Every size is a default a build may override. ROM builds pass
+// -DMRBZ_CONFIG and get mrbz_config.h generated from the program by
+// `mrbz-check --config`, which sizes each table to what the program uses.
+#ifdef MRBZ_CONFIG
+#include "mrbz_config.h"
+#endif
+#ifndef MRBZ_MAX_REGS
 #define MRBZ_MAX_REGS      32    // Number of registers
+#endif
+#ifndef MRBZ_MAX_ARRAYS
 #define MRBZ_MAX_ARRAYS    8     // Number of pre-allocated arrays
+#endif
+#ifndef MRBZ_MAX_ARRAY_LEN
 #define MRBZ_MAX_ARRAY_LEN 100   // Maximum array length
+#endif
+#ifndef MRBZ_MAX_SYMBOLS
 #define MRBZ_MAX_SYMBOLS   32    // Maximum symbols in pool
+#endif
+#ifndef MRBZ_MAX_CONSTS
 #define MRBZ_MAX_CONSTS    16    // Maximum constants
+#endif
+#ifndef MRBZ_MAX_IVARS
 #define MRBZ_MAX_IVARS     16    // Maximum instance variables
+#endif
+#ifndef MRBZ_MAX_GLOBALS
+#define MRBZ_MAX_GLOBALS   16    // Maximum global variables
+#endif
+#ifndef MRBZ_MAX_POOL
+#define MRBZ_MAX_POOL      16    // Maximum literal pool entries
+#endif
+#ifndef MRBZ_GC_THRESHOLD
+#define MRBZ_GC_THRESHOLD  (MRBZ_MAX_ARRAYS / 2)  // Pool use that triggers GC at wait_vbl
+#endif
+#ifndef MRBZ_MAX_IREPS
+#define MRBZ_MAX_IREPS     16    // Maximum IREPs (top level + blocks)
+#endif
+#ifndef MRBZ_MAX_IREP_SYMS
+#define MRBZ_MAX_IREP_SYMS 64    // Symbol slots summed over all IREPs
+#endif
+#ifndef MRBZ_MAX_FIBERS
+#define MRBZ_MAX_FIBERS    8     // Maximum live fibers
+#endif
+#ifndef MRBZ_FIBER_REGS
+#define MRBZ_FIBER_REGS    16    // Registers per fiber
+#endif
+#ifndef MRBZ_MAX_SCRATCH
+#define MRBZ_MAX_SCRATCH   4     // Non-escaping array literal sites
+#endif
+#ifndef MRBZ_SCRATCH_LEN
+#define MRBZ_SCRATCH_LEN   4     // Maximum length of a scratch array literal
+#endif
+#ifndef MRBZ_HASH_SLOTS
+#define MRBZ_HASH_SLOTS    16    // Entries per Hash (power of two, 2x fits an array)
+#endif
+#ifndef MRBZ_MAX_SWITCHES
+#define MRBZ_MAX_SWITCHES  4     // Compare chains lowered to jump tables
+#endif
+#ifndef MRBZ_SWITCH_CASES
+#define MRBZ_SWITCH_CASES  8     // Tests per lowered chain
+#endif
+#ifndef MRBZ_SWITCH_SPAN
+#define MRBZ_SWITCH_SPAN   32    // Key range per lowered chain
+#endif
+#ifndef MRBZ_BLOCK_REGS
+#define MRBZ_BLOCK_REGS    32    // Registers for blocks run by builtins (summed over nesting)
+#endif
+
+// Dead-code stripping: mrbz_config.h sets MRBZ_STRIP and defines
+// MRBZ_USE_OP_<name> and MRBZ_USE_BI_<key> for each opcode and builtin the
+// program uses; the interpreter and builtin table keep only those.
+// MRBZ_OPS_USED is the same opcode set as a bitmap for the load check.
+// Without a config every handler is built.
+#ifndef MRBZ_STRIP
+#define MRBZ_STRIP 0
+#endif
+#ifndef MRBZ_BUILTIN_KEYS
+#define MRBZ_BUILTIN_KEYS 0     // Builtin keys in the table (mrbz-check)
+#endif
+#if MRBZ_STRIP
+#define MRBZ_HAS_OP(name)      (MRBZ_USE_OP_##name + 0)
+#define MRBZ_HAS_BUILTIN(key)  (MRBZ_USE_BI_##key + 0)
+#else
+#define MRBZ_HAS_OP(name)      1
+#define MRBZ_HAS_BUILTIN(key)  1
+#endif
+
+// Template JIT for hot loops (enable with -DMRBZ_JIT=1, see jit.c)
+#ifndef MRBZ_JIT
+#define MRBZ_JIT 0
+#endif
+#ifndef MRBZ_JIT_LOOPS
+#define MRBZ_JIT_LOOPS     8     // Loop headers tracked
+#endif
+#ifndef MRBZ_JIT_HOT
+#define MRBZ_JIT_HOT       16    // Back jumps before a loop is compiled
+#endif
+#ifndef MRBZ_JIT_REGION
+#define MRBZ_JIT_REGION    64    // Longest loop compiled (bytecode bytes)
+#endif
+#ifndef MRBZ_JIT_CODE
+#define MRBZ_JIT_CODE      1024  // Code buffer the platform provides (bytes)
+#endif
+
+// Sampling profiler hooks (enable with -DMRBZ_PROFILE=1): the VM keeps
+// prof_pc and prof_sym current for a timer interrupt to read
+#ifndef MRBZ_PROFILE
+#define MRBZ_PROFILE 0
+#endif
+#define MRBZ_PROF_VM       0xFF  // prof_sym while no builtin is running
+
+// Binary instruction trace (enable with -DMRBZ_TRACE=1): a ring of the last
+// MRBZ_TRACE_LEN instructions run, read out with mrbz_trace_dump
+#ifndef MRBZ_TRACE
+#define MRBZ_TRACE 0
+#endif
+#ifndef MRBZ_TRACE_LEN
+#define MRBZ_TRACE_LEN     64    // Records kept (a power of two, at most 256)
+#endif
+#if MRBZ_TRACE && ((MRBZ_TRACE_LEN & (MRBZ_TRACE_LEN - 1)) || MRBZ_TRACE_LEN > 256)
+#error "MRBZ_TRACE_LEN must be a power of two no larger than 256"
+#endif
+#define MRBZ_TRACE_REC     7     // Bytes per dumped record
+
+// Statistics counters (enable with -DMRBZ_STATS=1, used by the host build)
+#ifndef MRBZ_STATS
+#define MRBZ_STATS 0
+#endif
+
+#define MRBZ_ARRAY_NONE    0xFF  // Allocation failure
+#define MRBZ_GLOBAL_NONE   0xFF  // Symbol is not a global variable
+#define MRBZ_HASH_NONE     0xFF  // Key not found and no free slot
+
+// Global variable flags (see mrbz_analyze_globals)
+#define MRBZ_GV_CONST      0x01  // Never written after the top level's opening straight-line code
 
 // Value types
 typedef enum {
@@ -23,19 +152,53 @@ typedef enum {
     MRBZ_T_TRUE,
     MRBZ_T_INT,
     MRBZ_T_SYMBOL,
-    MRBZ_T_ARRAY
+    MRBZ_T_ARRAY,
+    MRBZ_T_FIXED,       // 8.8 fixed-point (stands in for Float)
+    MRBZ_T_CLASS,       // Built-in class (Array, Fiber, Hash)
+    MRBZ_T_PROC,        // Block
+    MRBZ_T_FIBER,       // Fiber
+    MRBZ_T_HASH,        // Hash (a pool array of key/value pairs)
+    MRBZ_T_RANGE        // Integer range, unboxed (v.range)
 } mrbz_type;
 
+// Built-in class ids (v.cls)
+#define MRBZ_CLASS_ARRAY 0
+#define MRBZ_CLASS_FIBER 1
+#define MRBZ_CLASS_HASH  2
+#define MRBZ_CLASS_COUNT 3
+
+// Fixed-point 8.8: v.i holds value * 256
+#define MRBZ_FIXED_SHIFT 8
+#define MRBZ_FIXED_ONE   (1 << MRBZ_FIXED_SHIFT)
+
 // A value in the VM
 typedef struct {
     uint8_t type;
     union {
-        int16_t i;          // Integer value
+        int16_t i;          // Integer value (or raw 8.8 fixed-point)
         uint8_t sym;        // Symbol index
-        uint8_t arr;        // Array index
+        uint8_t arr;        // Array index (also Hash)
+        uint8_t cls;        // Class id
+        uint8_t irep;       // Block IREP index
+        struct {
+            uint8_t slot;   // Fiber table index
+            uint8_t gen;    // Generation of the slot when the fiber was made
+        } fib;
+        struct {
+            int8_t first;   // First element
+            uint8_t len;    // Element count (an exclusive end is folded in)
+        } range;
     } v;
 } mrbz_value;
 
+// One traced instruction
+typedef struct {
+    uint16_t pc;            // Bytecode offset
+    uint8_t op;
+    uint8_t a;              // First operand byte
+    mrbz_value ra;          // R[a] as the instruction found it (nil if a isn't a register)
+} mrbz_trace_rec;
+
 // Helper macros using statement expressions (for SDCC compatibility)
 // These set a destination variable directly
 
@@ -69,28 +232,181 @@ typedef struct {
     (dest).v.arr = (n); \
 } while(0)
 
+#define MRBZ_SET_FIXED(dest, raw) do { \
+    (dest).type = MRBZ_T_FIXED; \
+    (dest).v.i = (raw); \
+} while(0)
+
+#define MRBZ_SET_CLASS(dest, n) do { \
+    (dest).type = MRBZ_T_CLASS; \
+    (dest).v.cls = (n); \
+} while(0)
+
+#define MRBZ_SET_PROC(dest, n) do { \
+    (dest).type = MRBZ_T_PROC; \
+    (dest).v.irep = (n); \
+} while(0)
+
+#define MRBZ_SET_FIBER(dest, n, g) do { \
+    (dest).type = MRBZ_T_FIBER; \
+    (dest).v.fib.slot = (n); \
+    (dest).v.fib.gen = (g); \
+} while(0)
+
+#define MRBZ_SET_HASH(dest, n) do { \
+    (dest).type = MRBZ_T_HASH; \
+    (dest).v.arr = (n); \
+} while(0)
+
+#define MRBZ_SET_RANGE(dest, f, n) do { \
+    (dest).type = MRBZ_T_RANGE; \
+    (dest).v.range.first = (f); \
+    (dest).v.range.len = (n); \
+} while(0)
+
+// Element storage and capacity for an array handle (pool or scratch slot)
+#define MRBZ_ARRAY_DATA(vm, h) \
+    ((h) < MRBZ_MAX_ARRAYS ? (vm)->arrays[h] : (vm)->scratch[(h) - MRBZ_MAX_ARRAYS])
+#define MRBZ_ARRAY_CAP(h) \
+    ((h) < MRBZ_MAX_ARRAYS ? MRBZ_MAX_ARRAY_LEN : MRBZ_SCRATCH_LEN)
+
 // Check if value is truthy (not nil or false)
 #define MRBZ_TRUTHY(v)  ((v).type != MRBZ_T_NIL && (v).type != MRBZ_T_FALSE)
 
-// Virtual machine state
+// IREP (instruction sequence) metadata, filled in at load
+typedef struct {
+    uint16_t insns;     // Bytecode offset of the first instruction
+    uint16_t end;       // Bytecode offset just past the last instruction
+    uint8_t nregs;      // Registers used
+    uint8_t syms;       // First entry in vm->irep_syms
+    uint8_t pool;       // First entry in vm->pool
+    uint8_t kids;       // First entry in vm->irep_kids
+} mrbz_irep;
+
+// Compare chain lowered to a jump table (see analyze.c)
+// Tests are `subject == key; JMPNOT` (if/elsif ladders) or
+// `key === subject; JMPIF` (case/when), all on one subject and one
+// scratch register, with distinct Symbol or small Integer keys.
 typedef struct {
+    uint16_t test_pc[MRBZ_SWITCH_CASES];   // Compare instruction of each test
+    uint16_t arm_pc[MRBZ_SWITCH_CASES];    // Where each test goes on a match
+    uint16_t default_pc;                   // Where the chain goes on no match
+    int16_t base;                          // Smallest key
+    int16_t last_key;                      // Key of the final test
+    uint8_t case_of[MRBZ_SWITCH_SPAN];     // Test per key - base (0xFF: none)
+    uint8_t count;                         // Number of tests
+    uint8_t type;                          // Key type (MRBZ_T_INT or MRBZ_T_SYMBOL)
+    uint8_t reg;                           // Register the compares use
+    uint8_t eqq;                           // case/when form
+} mrbz_switch;
+
+// Loop seen by the JIT (see jit.c)
+typedef struct {
+    uint16_t header;    // Bytecode offset the back jump goes to
+    uint16_t end;       // Bytecode offset just past the back jump
+    uint16_t code;      // Offset in the code buffer (MRBZ_JIT_NONE: not compiled)
+    mrbz_value* regs;   // Register window the code was compiled for
+    uint8_t hits;       // Back jumps taken while interpreted
+    uint8_t ops;        // Instructions per pass through the loop
+} mrbz_jit_loop;
+
+#define MRBZ_JIT_NONE 0xFFFF
+
+// Execution context status
+#define MRBZ_CTX_DONE      0    // Finished (a free fiber slot)
+#define MRBZ_CTX_RUNNING   1
+#define MRBZ_CTX_SUSPENDED 2    // Yielded, waiting to be resumed
+
+// VM errors
+#define MRBZ_ERR_NONE    0
+#define MRBZ_ERR_OPCODE  1      // Unsupported instruction
+#define MRBZ_ERR_RANGE   2      // Range bounds not Integers or past the unboxed limits
+#define MRBZ_ERR_BLOCK   3      // Block run by a builtin tried to suspend or make a fiber, or nested too deep
+#define MRBZ_ERR_LIMIT   4      // Program outgrows a configured table (found at load)
+#define MRBZ_ERR_UPVAR   5      // Fiber reached a variable of a fiber that has finished
+
+// Execution context: the top level, a fiber or a block run by a builtin
+typedef struct mrbz_ctx {
+    mrbz_value* regs;           // Register window
+    struct mrbz_ctx* parent;    // Enclosing scope for GETUPVAR/SETUPVAR
+    uint16_t pc;                // Next instruction (bytecode offset)
+    uint8_t irep;               // IREP being executed
+    uint8_t status;             // MRBZ_CTX_*
+    uint8_t parent_gen;         // Generation of the parent's slot, if it is a fiber
+} mrbz_ctx;
+
+// Values held on the C stack for the length of a builtin call (a splat
+// call's argument window); the collector marks and remaps them
+typedef struct mrbz_root {
+    mrbz_value* values;
+    uint8_t count;
+    struct mrbz_root* next;     // Root registered by an enclosing call
+} mrbz_root;
+
+// Virtual machine state
+typedef struct mrbz_vm {
     // Registers
     mrbz_value regs[MRBZ_MAX_REGS];
 
     // Array pool (static allocation)
     mrbz_value arrays[MRBZ_MAX_ARRAYS][MRBZ_MAX_ARRAY_LEN];
-    uint8_t array_lens[MRBZ_MAX_ARRAYS];
+    uint8_t array_lens[MRBZ_MAX_ARRAYS + MRBZ_MAX_SCRATCH];  // Pool, then scratch
     uint8_t next_array;
 
-    // Symbol table - pointers into bytecode
+    // Scratch storage for array literals that never escape (see analyze.c)
+    // Handles MRBZ_MAX_ARRAYS + n refer to scratch[n]; each literal site
+    // owns one slot, so building it never touches the pool.
+    mrbz_value scratch[MRBZ_MAX_SCRATCH][MRBZ_SCRATCH_LEN];
+    uint16_t scratch_pc[MRBZ_MAX_SCRATCH];  // Bytecode offset of each site
+    uint8_t scratch_count;
+
+    // Compare chains dispatched through a table (see analyze.c)
+    mrbz_switch switches[MRBZ_MAX_SWITCHES];
+    uint8_t switch_count;
+
+    // Symbol table - pointers into bytecode, shared by all IREPs
     const char* sym_names[MRBZ_MAX_SYMBOLS];
+    uint8_t sym_builtin[MRBZ_MAX_SYMBOLS];  // Builtin index per symbol (resolved at load)
     uint8_t sym_count;
 
+    // IREPs (ireps[0] is the top level)
+    mrbz_irep ireps[MRBZ_MAX_IREPS];
+    uint8_t irep_count;
+    uint8_t irep_syms[MRBZ_MAX_IREP_SYMS];  // IREP-local symbol -> symbol table index
+    uint8_t irep_sym_count;
+    uint8_t irep_kids[MRBZ_MAX_IREPS];      // Child IREP indices
+    uint8_t irep_kid_count;
+
+    // Execution contexts
+    mrbz_ctx root;                          // Top-level code (uses regs)
+    mrbz_ctx* ctx;                          // Context currently executing
+    mrbz_ctx fibers[MRBZ_MAX_FIBERS];
+    mrbz_value fiber_regs[MRBZ_MAX_FIBERS][MRBZ_FIBER_REGS];
+    uint8_t fiber_gen[MRBZ_MAX_FIBERS];     // Bumped when a slot is reused
+    uint8_t fiber_turn;                     // Next fiber in this frame's pass
+
+    // Registers of blocks run to completion by builtins (see block.c),
+    // allocated as a stack: nested calls take the next window up
+    mrbz_value block_regs[MRBZ_BLOCK_REGS];
+    uint8_t block_top;                      // Registers in use
+    mrbz_root* roots;                       // Temporary roots, innermost first
+
     // Instance variables (for @variables)
     uint8_t ivar_syms[MRBZ_MAX_IVARS];   // Symbol index for each ivar
     mrbz_value ivars[MRBZ_MAX_IVARS];    // Values
     uint8_t ivar_count;
 
+    // Global variables ($name): each one gets a dense slot at load, so
+    // GETGV/SETGV index straight into globals[] with no search
+    uint8_t sym_global[MRBZ_MAX_SYMBOLS];   // Global slot per symbol
+    mrbz_value globals[MRBZ_MAX_GLOBALS];
+    uint8_t global_flags[MRBZ_MAX_GLOBALS]; // MRBZ_GV_*
+    uint8_t global_count;
+
+    // Literal pool (Float entries converted to 8.8 fixed-point at load)
+    mrbz_value pool[MRBZ_MAX_POOL];
+    uint8_t pool_count;
+
     // Constants (for CONST_NAME)
     uint8_t const_syms[MRBZ_MAX_CONSTS]; // Symbol index for each constant
     mrbz_value consts[MRBZ_MAX_CONSTS];  // Values
@@ -99,20 +415,261 @@ typedef struct {
     // Bytecode pointer (for symbol table access)
     const uint8_t* bytecode;
 
+    // Platform layer state, owned by the embedder (the host keeps its
+    // simulated machine here; unused on the Game Boy)
+    void* platform;
+
     // Running state
     uint8_t running;
+    uint8_t error;                          // MRBZ_ERR_*
+    uint16_t error_pc;                      // Bytecode offset of the failing instruction
+    uint8_t stepping;                       // Driven by mrbz_vm_step
+    uint16_t budget;                        // Instructions left in this step
+
+#if MRBZ_JIT
+    // Hot loops compiled into a code buffer owned by the embedder
+    mrbz_jit_loop jit_loops[MRBZ_JIT_LOOPS];
+    uint8_t jit_loop_count;
+    uint8_t* jit_code;                      // Executable buffer (0 = JIT off)
+    uint16_t jit_cap;
+    uint16_t jit_used;
+#endif
+
+#if MRBZ_TRACE
+    mrbz_trace_rec trace[MRBZ_TRACE_LEN];
+    uint8_t trace_pos;                      // Next record written
+    uint8_t trace_full;                     // The ring has wrapped
+#endif
+
+#if MRBZ_PROFILE
+    // Where the VM is, for a sampling interrupt
+    volatile uint16_t prof_pc;              // Instruction being run
+    volatile uint8_t prof_sym;              // Builtin being run (symbol), or MRBZ_PROF_VM
+#endif
+
+#if MRBZ_STATS
+    struct {
+        uint16_t gc_runs;         // Collections performed
+        uint16_t gc_freed;        // Arrays reclaimed
+        uint32_t gc_time_total;   // Total pause (platform clock units)
+        uint32_t gc_time_max;     // Longest pause
+        uint32_t ops[MRBZ_OP_COUNT];  // Instructions executed per opcode
+#if MRBZ_JIT
+        uint16_t jit_compiled;    // Loops compiled
+        uint32_t jit_ops;         // Instructions run as native code (not in ops)
+#endif
+    } stats;
+#endif
 } mrbz_vm;
 
+// Built-in function ABI
+// A builtin sees a register window: frame[0] holds the receiver on entry and
+// receives the return value, frame[1..argc] hold the arguments and
+// frame[argc + 1] the block (nil without one). The VM checks arity and
+// argument types against the descriptor before calling, so the function
+// body can read frame[n].v directly.
+typedef void (*mrbz_builtin_fn)(mrbz_vm* vm, mrbz_value* frame, uint8_t argc);
+
+// Block passed to a builtin
+#define MRBZ_BLOCK_ARG(frame, argc) ((frame)[(argc) + 1])
+
+#define MRBZ_BUILTIN_MAX_ARGS 3     // Arguments covered by type checks
+#define MRBZ_BUILTIN_NONE     0xFF  // Symbol is not a builtin
+
+// Type masks for builtin descriptors
+#define MRBZ_TM(t)   ((uint16_t)1 << (t))
+#define MRBZ_TM_ANY  0xFFFF
+#define MRBZ_TM_INT  MRBZ_TM(MRBZ_T_INT)
+#define MRBZ_TM_NUM  (MRBZ_TM(MRBZ_T_INT) | MRBZ_TM(MRBZ_T_FIXED))
+
+// Builtin flags
+#define MRBZ_BF_RETAINS  0x01   // May store or return its receiver/arguments
+#define MRBZ_BF_REENTERS 0x02   // May run Ruby code (fibers, blocks)
+
+// Builtin descriptor
+typedef struct {
+    const char* name;
+    uint8_t arity;                                // Required argument count
+    uint8_t flags;                                // MRBZ_BF_*
+    uint16_t self_types;                          // Accepted receiver types
+    uint16_t arg_types[MRBZ_BUILTIN_MAX_ARGS];    // Accepted types per argument
+    mrbz_builtin_fn fn;
+#if MRBZ_BUILTIN_KEYS
+    const char* key;                              // MRBZ_USE_BI_<key> (mrbz-check)
+#endif
+} mrbz_builtin;
+
+// Find builtin index by name (returns MRBZ_BUILTIN_NONE if not found)
+uint8_t mrbz_builtin_lookup(const char* name);
+
+// Flags of a builtin (0 for MRBZ_BUILTIN_NONE)
+uint8_t mrbz_builtin_flags(uint8_t idx);
+
+#if MRBZ_BUILTIN_KEYS
+// Builtins in this build, and the key a stripped build knows each by
+uint8_t mrbz_builtin_count(void);
+const char* mrbz_builtin_key(uint8_t idx);
+#endif
+
+// Call the builtin bound to a symbol with a register window
+void mrbz_builtin_call(mrbz_vm* vm, uint8_t sym_idx, uint8_t argc, mrbz_value* frame);
+
 // Get symbol name by index
 const char* mrbz_get_symbol(mrbz_vm* vm, uint8_t idx);
 
 // Find symbol index by name (returns 0xFF if not found)
 uint8_t mrbz_find_symbol(mrbz_vm* vm, const char* name);
 
+// Compare two values for equality (Ruby ==)
+uint8_t mrbz_values_equal(mrbz_value a, mrbz_value b);
+
+// Allocate an array from the pool, collecting if it is full
+// (returns MRBZ_ARRAY_NONE if no slot could be freed)
+uint8_t mrbz_array_alloc(mrbz_vm* vm, uint8_t len);
+
+// Allocate an empty Hash from the array pool (MRBZ_ARRAY_NONE on failure)
+uint8_t mrbz_hash_new(mrbz_vm* vm);
+
+// Look up a key: returns 1 and the value in *out, or 0 and nil
+uint8_t mrbz_hash_get(mrbz_vm* vm, uint8_t hash, mrbz_value key, mrbz_value* out);
+
+// Store a value (returns 0 if the key is not a Symbol/Integer or the Hash is full)
+uint8_t mrbz_hash_set(mrbz_vm* vm, uint8_t hash, mrbz_value key, mrbz_value value);
+
+// Collect unreachable arrays and compact the pool, return the number freed
+uint8_t mrbz_gc(mrbz_vm* vm);
+
+// Instruction length in bytes including the opcode (0 if unknown)
+uint8_t mrbz_op_length(uint8_t op);
+
+// True if the VM implements an opcode
+uint8_t mrbz_op_supported(uint8_t op);
+
+// Symbol operand of an instruction (IREP-local index), or 0xFF
+uint8_t mrbz_sym_operand(const uint8_t* ip);
+
+// Instruction the VM can't run, found by mrbz_vm_verify
+typedef struct {
+    uint16_t pc;        // Bytecode offset
+    uint8_t irep;       // IREP containing it
+    uint8_t op;         // Opcode
+    uint8_t sym;        // Symbol operand (symbol table index), or 0xFF
+    uint8_t call;       // Next method called in the same IREP, or 0xFF
+} mrbz_bad_op;
+
+typedef void (*mrbz_verify_fn)(mrbz_vm* vm, const mrbz_bad_op* bad, void* user);
+
+// Scan a loaded program for unsupported instructions; calls report (if
+// not 0) for each one and returns how many there are. mrbz_vm_load runs
+// this and refuses to start a program that fails it.
+uint16_t mrbz_vm_verify(mrbz_vm* vm, mrbz_verify_fn report, void* user);
+
+// Give every global variable a slot and flag the constant ones
+void mrbz_analyze_globals(mrbz_vm* vm);
+
+// Assign scratch slots to array literals in an IREP that never escape
+void mrbz_analyze_escapes(mrbz_vm* vm, uint8_t irep);
+
+// Find if/elsif and case/when compare chains in an IREP and build jump
+// tables for them
+void mrbz_analyze_switches(mrbz_vm* vm, uint8_t irep);
+
 // Initialize a VM
 void mrbz_vm_init(mrbz_vm* vm);
 
+// Load bytecode: parse IREPs, symbols and pool, run load-time analysis
+void mrbz_vm_load(mrbz_vm* vm, const uint8_t* bytecode);
+
+// Execute a context until it returns, yields or the VM stops
+void mrbz_vm_exec(mrbz_vm* vm, mrbz_ctx* ctx, mrbz_value* result);
+
 // Run bytecode and get result
 void mrbz_vm_run(mrbz_vm* vm, mrbz_value* result, const uint8_t* bytecode);
 
+// Run a loaded VM for at most max_instructions (fibers included) and
+// return to the caller. State stays in the vm, so the next call picks up
+// where this one stopped. In this mode wait_vbl does not wait: it ends the
+// step with MRBZ_STEP_YIELDED and the caller waits for the frame itself.
+#define MRBZ_STEP_YIELDED  0   // Top level reached wait_vbl
+#define MRBZ_STEP_BUDGET   1   // max_instructions executed
+#define MRBZ_STEP_FINISHED 2   // Program returned or was stopped
+#define MRBZ_STEP_ERROR    3   // VM stopped on an error (see vm->error)
+uint8_t mrbz_vm_step(mrbz_vm* vm, uint16_t max_instructions);
+
+// Serialize run-time state into buf (returns bytes written, 0 if it does
+// not fit). Call between mrbz_vm_step calls, not from a builtin.
+uint16_t mrbz_vm_snapshot(mrbz_vm* vm, uint8_t* buf, uint16_t cap);
+
+// Restore a snapshot into a VM that has loaded the same program
+// (returns bytes consumed, 0 on failure)
+uint16_t mrbz_vm_restore(mrbz_vm* vm, uint8_t* buf, uint16_t len);
+
+#if MRBZ_TRACE
+// Write the trace, oldest record first (returns bytes written, 0 if buf is
+// too small): 'M' 'T' u8 count, then count records of MRBZ_TRACE_REC
+// bytes: u16 pc (LE), op, a, R[a] type, R[a] value (2 bytes, as stored).
+// Call on error, or whenever the embedder wants to look back.
+uint16_t mrbz_trace_dump(const mrbz_vm* vm, uint8_t* buf, uint16_t cap);
+#endif
+
+// Create a fiber running a block IREP (returns MRBZ_FIBER_NONE on failure)
+#define MRBZ_FIBER_NONE 0xFF
+uint8_t mrbz_fiber_new(mrbz_vm* vm, uint8_t irep);
+
+// True if a Fiber value still names the fiber it was made for, not a
+// later one that reused its slot
+uint8_t mrbz_fiber_valid(const mrbz_vm* vm, mrbz_value fib);
+
+// True unless ctx is a fiber whose parent fiber has finished (and maybe
+// given its slot to another one)
+uint8_t mrbz_fiber_parent_live(const mrbz_vm* vm, const mrbz_ctx* ctx);
+
+// Run a suspended fiber until it yields or finishes
+// (returns 1 if the step budget ran out first)
+uint8_t mrbz_fiber_resume(mrbz_vm* vm, uint8_t fib);
+
+// Resume every suspended fiber once (called once per frame)
+void mrbz_fiber_run_all(mrbz_vm* vm);
+
+// Block run to completion by a builtin (Range#each and friends)
+typedef struct {
+    mrbz_ctx ctx;
+    uint16_t entry;     // First instruction past ENTER
+    uint8_t arg;        // Block takes the element (passed in R1)
+} mrbz_block;
+
+// Set up a block for calling; returns 0 if proc is not a block or its
+// registers don't fit (which stops the VM with MRBZ_ERR_BLOCK)
+uint8_t mrbz_block_begin(mrbz_vm* vm, mrbz_block* blk, mrbz_value proc);
+
+// Run the block body once with arg
+void mrbz_block_call(mrbz_vm* vm, mrbz_block* blk, mrbz_value arg);
+
+// Release a block's registers (blocks end in reverse order of begin)
+void mrbz_block_end(mrbz_vm* vm, mrbz_block* blk);
+
+// True if the running context is a block called by a builtin (which
+// can't suspend)
+uint8_t mrbz_block_active(mrbz_vm* vm);
+
+// Stop the VM with MRBZ_ERR_BLOCK at the call that was running
+void mrbz_block_fail(mrbz_vm* vm);
+
+// Built-in class names, indexed by MRBZ_CLASS_*
+extern const char* const mrbz_class_names[MRBZ_CLASS_COUNT];
+
+// Define constants for built-in classes the program refers to
+void mrbz_builtin_define_classes(mrbz_vm* vm);
+
+#if MRBZ_JIT
+// Give the JIT a code buffer (executable memory: WRAM on the Game Boy);
+// call after mrbz_vm_init. Without one every loop is interpreted.
+void mrbz_jit_init(mrbz_vm* vm, uint8_t* code, uint16_t cap);
+
+// Called by a back jump from end to header; counts it, compiles the loop
+// once it is hot and runs the native code if there is some. Returns the
+// bytecode offset to continue interpreting at.
+uint16_t mrbz_jit_back_jump(mrbz_vm* vm, mrbz_value* regs, uint16_t header, uint16_t end);
+#endif
+
 #endif // MRBZ_VM_H